@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "baked_atlas.h"
+#include "font_file.h"
+
+/* whether count elements of size bytes at offset fit in the file */
+static int region_fits(const baked_atlas* baked, uint32_t offset, uint64_t count, size_t size)
+{
+  return offset % 4 == 0 && (uint64_t)offset + count * size <= (uint64_t)baked->dataSize;
+}
+
+static int validate(const baked_atlas* baked)
+{
+  const baked_atlas_header* h = baked->header;
+  uint32_t i, j;
+
+  if (memcmp(h->magic, BAKED_ATLAS_MAGIC, 4) != 0 || h->version != BAKED_ATLAS_VERSION
+      || h->pageSize == 0 || h->pageSize > 65535
+      /* before the pixel region is multiplied out, so it cannot wrap */
+      || h->pageCount > (uint64_t)baked->dataSize / ((uint64_t)h->pageSize * h->pageSize)
+      || !region_fits(baked, h->sizesOffset, h->sizeCount, sizeof(baked_atlas_size))
+      || !region_fits(baked, h->glyphsOffset, h->glyphCount, sizeof(baked_atlas_glyph))
+      || !region_fits(baked, h->pixelsOffset, (uint64_t)h->pageCount * h->pageSize,
+                      h->pageSize))
+    {
+      return -1;
+    }
+  for(i = 0; i < h->sizeCount; i++)
+    {
+      const baked_atlas_size* s = &baked->sizes[i];
+      if ((uint64_t)s->firstGlyph + s->glyphCount > h->glyphCount)
+        return -1;
+      for(j = s->firstGlyph; j < s->firstGlyph + s->glyphCount; j++)
+        {
+          const baked_atlas_glyph* g = &baked->glyphs[j];
+          if (g->page >= (int)h->pageCount
+              || (g->page >= 0 && ((uint32_t)g->x + g->width > h->pageSize
+                                   || (uint32_t)g->y + g->rows > h->pageSize)))
+            return -1;
+        }
+    }
+  return 0;
+}
+
+baked_atlas* baked_atlas_open(const char* path)
+{
+  baked_atlas* baked = calloc(1, sizeof(baked_atlas));
+
+  if (baked == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return NULL;
+    }
+  baked->data = font_file_map(path, &baked->dataSize);
+  if (baked->data == NULL || baked->dataSize < (int)sizeof(baked_atlas_header))
+    {
+      fprintf(stderr, "ERROR: cannot read baked atlas %s\n", path);
+      if (baked->data != NULL)
+        font_file_unmap(baked->data, baked->dataSize);
+      free(baked);
+      return NULL;
+    }
+  baked->header = (const baked_atlas_header*)baked->data;
+  baked->sizes = (const baked_atlas_size*)(baked->data + baked->header->sizesOffset);
+  baked->glyphs = (const baked_atlas_glyph*)(baked->data + baked->header->glyphsOffset);
+  if (validate(baked) != 0)
+    {
+      fprintf(stderr, "ERROR: %s is not a baked atlas of version %d\n", path,
+              BAKED_ATLAS_VERSION);
+      baked_atlas_close(baked);
+      return NULL;
+    }
+  return baked;
+}
+
+void baked_atlas_close(baked_atlas* baked)
+{
+  if (baked == NULL)
+    return;
+  font_file_unmap(baked->data, baked->dataSize);
+  free(baked);
+}
+
+int baked_atlas_find_size(const baked_atlas* baked, int pixelSize)
+{
+  uint32_t i;
+
+  for(i = 0; i < baked->header->sizeCount; i++)
+    {
+      if (baked->sizes[i].pixelSize == (uint32_t)pixelSize)
+        return i;
+    }
+  return -1;
+}
+
+const baked_atlas_glyph* baked_atlas_find_glyph(const baked_atlas* baked, int size,
+                                                unsigned int codepoint)
+{
+  const baked_atlas_size* s = &baked->sizes[size];
+  uint32_t lo = s->firstGlyph;
+  uint32_t hi = s->firstGlyph + s->glyphCount;
+
+  while(lo < hi)
+    {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (baked->glyphs[mid].codepoint < codepoint)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (lo == s->firstGlyph + s->glyphCount || baked->glyphs[lo].codepoint != codepoint)
+    return NULL;
+  return &baked->glyphs[lo];
+}
+
+int baked_atlas_size_pages(const baked_atlas* baked, int size)
+{
+  const baked_atlas_size* s = &baked->sizes[size];
+  unsigned char* used = calloc(baked->header->pageCount + 1, 1);
+  uint32_t i;
+  int count = 0;
+
+  if (used == NULL)
+    return baked->header->pageCount;
+  for(i = s->firstGlyph; i < s->firstGlyph + s->glyphCount; i++)
+    {
+      int page = baked->glyphs[i].page;
+      if (page >= 0 && !used[page])
+        {
+          used[page] = 1;
+          count++;
+        }
+    }
+  free(used);
+  return count;
+}
+
+const unsigned char* baked_atlas_page(const baked_atlas* baked, int page)
+{
+  size_t pageBytes = (size_t)baked->header->pageSize * baked->header->pageSize;
+  return baked->data + baked->header->pixelsOffset + pageBytes * page;
+}
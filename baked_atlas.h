@@ -0,0 +1,118 @@
+/*
+ * Glyph atlas baked ahead of time.
+ *
+ * fontrender_bake renders a charset of a font at a few pixel sizes into
+ * glyph atlas pages and writes them with their glyph metrics to one
+ * file, laid out to be used straight from an mmap:
+ *
+ *   header
+ *   sizes       baked_atlas_size per pixel size, ascending
+ *   glyphs      baked_atlas_glyph per glyph, grouped by size, each
+ *               group sorted by code point
+ *   pixels      pageCount single channel pages of pageSize * pageSize
+ *               bytes, starting at a 4096 byte boundary, ready for
+ *               glTexImage2D(GL_R8)
+ *
+ * The glyph rectangles have the same 1 pixel empty border as the live
+ * glyph_atlas, so a baked page can stand in for one of its pages.
+ *
+ * Numbers are in host byte order. The version changes with every change
+ * of the layout; files of another version are rejected.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef BAKED_ATLAS_H
+#define BAKED_ATLAS_H
+
+#include <stdint.h>
+
+#define BAKED_ATLAS_MAGIC "FBAK"
+#define BAKED_ATLAS_VERSION 1
+#define BAKED_ATLAS_PIXEL_ALIGN 4096
+
+typedef struct baked_atlas_header
+{
+  char magic[4];
+  uint32_t version;
+  /* num_glyphs of the baked face, to catch a different font */
+  uint32_t fontGlyphs;
+  uint32_t pageSize;
+  uint32_t pageCount;
+  uint32_t sizeCount;
+  uint32_t glyphCount;
+  /* byte offsets from the start of the file */
+  uint32_t sizesOffset;
+  uint32_t glyphsOffset;
+  uint32_t pixelsOffset;
+} baked_atlas_header;
+
+typedef struct baked_atlas_size
+{
+  uint32_t pixelSize;
+  uint32_t firstGlyph;
+  uint32_t glyphCount;
+  /* face size metrics, in 26.6 pixels */
+  int32_t ascender;
+  int32_t descender;
+  int32_t height;
+} baked_atlas_size;
+
+typedef struct baked_atlas_glyph
+{
+  uint32_t codepoint;
+  uint32_t glyphIndex;
+  /* horizontal advance in 26.6 pixels, unhinted */
+  int32_t advance;
+  /* bitmap_left and bitmap_top */
+  int16_t left;
+  int16_t top;
+  uint16_t width;
+  uint16_t rows;
+  /* page, or -1 for blank glyphs; rectangle in it without the border */
+  int16_t page;
+  uint16_t x;
+  uint16_t y;
+  uint16_t reserved;
+  /* texture coordinates; v0 is the top row of the glyph */
+  float u0, v0, u1, v1;
+} baked_atlas_glyph;
+
+/* a baked atlas file mapped into memory */
+typedef struct baked_atlas
+{
+  unsigned char* data;
+  int dataSize;
+  const baked_atlas_header* header;
+  const baked_atlas_size* sizes;
+  const baked_atlas_glyph* glyphs;
+} baked_atlas;
+
+/*
+ * Map a baked atlas file. Returns NULL when it cannot be read or is not
+ * a valid file of this version.
+ */
+baked_atlas* baked_atlas_open(const char* path);
+void baked_atlas_close(baked_atlas* baked);
+
+/* index of the baked pixel size, or -1 when it was not baked */
+int baked_atlas_find_size(const baked_atlas* baked, int pixelSize);
+
+/* glyph of codepoint at size (an index), or NULL when not baked */
+const baked_atlas_glyph* baked_atlas_find_glyph(const baked_atlas* baked, int size,
+                                                unsigned int codepoint);
+
+/*
+ * Number of pages glyphs baked at size (an index) are on; other sizes
+ * may have pages of their own.
+ */
+int baked_atlas_size_pages(const baked_atlas* baked, int size);
+
+/* pixels of a page */
+const unsigned char* baked_atlas_page(const baked_atlas* baked, int page);
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "char_tool.h"
+#include "fontrender.h"
+#include "font_file.h"
+#include "font_index.h"
+
+int char_tool_parse(char_tool* tool, int argc, char** argv, const char* defaultColor)
+{
+  image_options defaults = IMAGE_OPTIONS_DEFAULT;
+  int argi = 1;
+
+  memset(tool, 0, sizeof(char_tool));
+  tool->imageOptions = defaults;
+  while(argi + 1 < argc && (strcmp(argv[argi], "-f") == 0 || strcmp(argv[argi], "-F") == 0))
+    {
+      if (argv[argi][1] == 'F')
+        tool->fallbackIndexPath = argv[argi + 1];
+      else if (image_options_parse(argv[argi + 1], &tool->imageOptions) != 0)
+        return -1;
+      argi += 2;
+    }
+  if (argc - argi != 2 && argc - argi != 3)
+    {
+      printf("Usage: %s [-f format] [-F index] char fontPath [RRGGBB]\nExample: %s G /usr/share/fonts/gnu-free/FreeSans.ttf\n", argv[0], argv[0]);
+      printf("  -f format    output format and PNG settings:\n%s", IMAGE_OPTIONS_HELP);
+      printf("  -F index     fall back to the faces of a fontrender_index file\n");
+      return 1;
+    }
+  tool->text = argv[argi];
+  tool->fontPath = argv[argi + 1];
+  if (pixel_color_parse(argc - argi == 3 ? argv[argi + 2] : defaultColor, &tool->color) != 0)
+    {
+      fprintf(stderr, "ERROR: color should look like RRGGBB\n");
+      return -1;
+    }
+  tool->codepoint = first_utf8_char(tool->text, strlen(tool->text));
+  if (tool->codepoint == 0)
+    {
+      fprintf(stderr, "ERROR: %s does not start with a UTF-8 character\n", tool->text);
+      return -1;
+    }
+  return 0;
+}
+
+/* show font information on stderr, since the image goes to stdout */
+static void print_face(const char* path, FT_Face face)
+{
+  fprintf(stderr, "Font loaded from %s.\n", path);
+  fprintf(stderr, "Family name: %s.\n", face->family_name);
+  fprintf(stderr, "Style name: %s.\n", face->style_name);
+  fprintf(stderr, "# of faces in this font: %ld\n", face->num_faces);
+  fprintf(stderr, "BBox: x: (%ld, %ld), y: (%ld, %ld)\n", face->bbox.xMin, face->bbox.xMax,
+          face->bbox.yMin, face->bbox.yMax);
+  fprintf(stderr, "Units per EM: %d\n", face->units_per_EM);
+  fprintf(stderr, "Ascender: %d\n", face->ascender);
+  fprintf(stderr, "Descender: %d\n", face->descender);
+  fprintf(stderr, "(Line) Height: %d\n", face->height);
+}
+
+/* the character's glyph index in the font, or in a -F face replacing it */
+static unsigned int find_glyph(char_tool* tool)
+{
+  unsigned int glyphIndex = FT_Get_Char_Index(tool->face, tool->codepoint);
+  font_index* index;
+  FT_Face fallbackFace;
+
+  if (glyphIndex != 0 || tool->fallbackIndexPath == NULL)
+    return glyphIndex;
+  index = font_index_open(tool->fallbackIndexPath);
+  if (index != NULL
+      && font_index_new_face(index, tool->lib, tool->codepoint, &fallbackFace) == 0)
+    {
+      fprintf(stderr, "Falling back to %s %s.\n", fallbackFace->family_name,
+              fallbackFace->style_name);
+      FT_Done_Face(tool->face);
+      tool->face = fallbackFace;
+      FT_Set_Char_Size(tool->face, 0, CHAR_TOOL_CHAR_SIZE, CHAR_TOOL_DPI, CHAR_TOOL_DPI);
+      glyphIndex = FT_Get_Char_Index(tool->face, tool->codepoint);
+    }
+  font_index_close(index);
+  return glyphIndex;
+}
+
+int char_tool_render(char_tool* tool)
+{
+  unsigned int glyphIndex;
+  FT_Error err;
+
+  /* FreeType's memory comes from the arena */
+  tool->arena = ft_arena_new();
+  if (tool->arena == NULL || ft_arena_new_library(tool->arena, &tool->lib))
+    {
+      fprintf(stderr, "ERROR: init library\n");
+      tool->lib = NULL;
+      return -1;
+    }
+
+  /* mapped and shared with other processes */
+  err = font_file_new_face(tool->lib, tool->fontPath, 0, &tool->face);
+  if (err == FT_Err_Unknown_File_Format)
+    {
+      fprintf(stderr, "ERROR: unrecognized font format\n");
+      tool->face = NULL;
+      return -1;
+    }
+  else if (err)
+    {
+      fprintf(stderr, "ERROR: when loading font\n");
+      tool->face = NULL;
+      return -1;
+    }
+  print_face(tool->fontPath, tool->face);
+
+  if (FT_Set_Char_Size(tool->face, 0, CHAR_TOOL_CHAR_SIZE, CHAR_TOOL_DPI, CHAR_TOOL_DPI))
+    {
+      fprintf(stderr, "ERROR: setting font size\n");
+      return -1;
+    }
+
+  fprintf(stderr, "Try loading character U+%04X\n", tool->codepoint);
+  glyphIndex = find_glyph(tool);
+  if (glyphIndex == 0)
+    {
+      fprintf(stderr, "The character cannot be indexed.\n");
+      return 1;
+    }
+  fprintf(stderr, "Glyph index of U+%04X is %u\n", tool->codepoint, glyphIndex);
+  if (FT_Load_Glyph(tool->face, glyphIndex, FT_LOAD_DEFAULT))
+    {
+      fprintf(stderr, "ERROR: when loading glyph\n");
+      return -1;
+    }
+  if (FT_Render_Glyph(tool->face->glyph, FT_RENDER_MODE_NORMAL))
+    {
+      fprintf(stderr, "ERROR: when rendering glyph\n");
+      return -1;
+    }
+  return 0;
+}
+
+void char_tool_encode_to_stdout(const FT_Bitmap* bitmap, pixel_color color,
+                                const image_options* opt)
+{
+  mem_buffer mb = {NULL, 0, 0};
+
+  if (fontrender_encode_bitmap(bitmap, color, opt, &mb) != 0)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+    }
+  else if (fwrite(mb.data, 1, mb.len, stdout) != mb.len)
+    {
+      fprintf(stderr, "WARNING: incomplete writing action.\n");
+    }
+  free(mb.data);
+}
+
+void char_tool_done(char_tool* tool)
+{
+  if (tool->face != NULL)
+    FT_Done_Face(tool->face);
+  if (tool->lib != NULL)
+    FT_Done_Library(tool->lib);
+  if (tool->arena != NULL)
+    {
+      fprintf(stderr, "Arena: %lu allocations, %lu bytes peak, %lu chunks.\n",
+              tool->arena->allocs, (unsigned long)tool->arena->peak,
+              tool->arena->chunkCount);
+      ft_arena_free(tool->arena);
+    }
+}
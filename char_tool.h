@@ -0,0 +1,73 @@
+/*
+ * Command line and glyph loading shared by the ft2_char tools.
+ *
+ * The ft2_char tools render one character of a font into an image on
+ * stdout and differ only in the PNG writer they use. Everything before
+ * that lives here: the arguments
+ *
+ *   [-f format] [-F index] char fontPath [RRGGBB]
+ *
+ * a FreeType library on an ft_arena, the face (mapped with
+ * font_file_new_face()), its details on stderr, and the glyph of the
+ * first character, from a face of the -F fontrender_index file when the
+ * font lacks it. The tool then writes face->glyph out.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef CHAR_TOOL_H
+#define CHAR_TOOL_H
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "ft_arena.h"
+#include "image_writer.h"
+#include "pixel_convert.h"
+
+/* size glyphs are rendered at, in 26.6 points at 100 dpi */
+#define CHAR_TOOL_CHAR_SIZE (64 * 64)
+#define CHAR_TOOL_DPI 100
+
+typedef struct char_tool
+{
+  /* from the command line */
+  const char* text;
+  const char* fontPath;
+  const char* fallbackIndexPath;
+  pixel_color color;
+  image_options imageOptions;
+  unsigned int codepoint; /* first character of text */
+
+  /* FreeType, and temporaries of the tool, come from arena */
+  ft_arena* arena;
+  FT_Library lib;
+  /* the font, or the fallback face the glyph was found in */
+  FT_Face face;
+} char_tool;
+
+/*
+ * Parse the command line, using defaultColor when none is given. Returns
+ * 1 after printing the usage, -1 on bad arguments, 0 otherwise.
+ */
+int char_tool_parse(char_tool* tool, int argc, char** argv, const char* defaultColor);
+
+/*
+ * Open the font and render the glyph of the character into
+ * tool->face->glyph. Returns 1 when no face has the character, -1 on
+ * errors, all reported on stderr.
+ */
+int char_tool_render(char_tool* tool);
+
+/* write bitmap to stdout with image_writer, in the format given with -f */
+void char_tool_encode_to_stdout(const FT_Bitmap* bitmap, pixel_color color,
+                                const image_options* opt);
+
+/* free the face, library and arena, printing the arena counters */
+void char_tool_done(char_tool* tool);
+
+#endif
@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdint.h>
+
+#include "composite.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define COMPOSITE_X86 1
+# include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define COMPOSITE_NEON 1
+# include <arm_neon.h>
+#endif
+
+/*
+ * a * b / 255, rounded. Exact for all 8-bit inputs; the SIMD kernels use
+ * the same formula on 16-bit lanes.
+ */
+static inline unsigned int mul_div255(unsigned int a, unsigned int b)
+{
+  unsigned int t = a * b + 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+static void max_row_scalar(unsigned char* dst, const unsigned char* src, int n)
+{
+  int i;
+  for(i = 0; i < n; i++)
+    {
+      if (dst[i] < src[i])
+        dst[i] = src[i];
+    }
+}
+
+static void over_row_scalar(unsigned char* dst, const unsigned char* src, int n)
+{
+  int i;
+  for(i = 0; i < n; i++)
+    {
+      /* src + dst * (255 - src) / 255 == src + dst - src * dst / 255 */
+      dst[i] = src[i] + dst[i] - mul_div255(src[i], dst[i]);
+    }
+}
+
+#ifdef COMPOSITE_X86
+
+__attribute__((target("sse2")))
+static void max_row_sse2(unsigned char* dst, const unsigned char* src, int n)
+{
+  int i;
+  for(i = 0; i + 16 <= n; i += 16)
+    {
+      __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+      __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_max_epu8(d, s));
+    }
+  max_row_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i mul_div255_sse2(__m128i a, __m128i b)
+{
+  __m128i t = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void over_row_sse2(unsigned char* dst, const unsigned char* src, int n)
+{
+  __m128i zero = _mm_setzero_si128();
+  int i;
+  for(i = 0; i + 16 <= n; i += 16)
+    {
+      __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+      __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+      __m128i lo = mul_div255_sse2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero));
+      __m128i hi = mul_div255_sse2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero));
+      /* the true result fits in a byte, so wrapping add/sub is exact */
+      __m128i r = _mm_sub_epi8(_mm_add_epi8(d, s), _mm_packus_epi16(lo, hi));
+      _mm_storeu_si128((__m128i*)(dst + i), r);
+    }
+  over_row_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void max_row_avx2(unsigned char* dst, const unsigned char* src, int n)
+{
+  int i;
+  for(i = 0; i + 32 <= n; i += 32)
+    {
+      __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+      __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+      _mm256_storeu_si256((__m256i*)(dst + i), _mm256_max_epu8(d, s));
+    }
+  max_row_sse2(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i mul_div255_avx2(__m256i a, __m256i b)
+{
+  __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(a, b), _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void over_row_avx2(unsigned char* dst, const unsigned char* src, int n)
+{
+  __m256i zero = _mm256_setzero_si256();
+  int i;
+  for(i = 0; i + 32 <= n; i += 32)
+    {
+      __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+      __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+      /* unpack and pack both work per 128 bit lane, so byte order is kept */
+      __m256i lo = mul_div255_avx2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(s, zero));
+      __m256i hi = mul_div255_avx2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(s, zero));
+      __m256i r = _mm256_sub_epi8(_mm256_add_epi8(d, s), _mm256_packus_epi16(lo, hi));
+      _mm256_storeu_si256((__m256i*)(dst + i), r);
+    }
+  over_row_sse2(dst + i, src + i, n - i);
+}
+
+#endif
+
+#ifdef COMPOSITE_NEON
+
+static void max_row_neon(unsigned char* dst, const unsigned char* src, int n)
+{
+  int i;
+  for(i = 0; i + 16 <= n; i += 16)
+    {
+      vst1q_u8(dst + i, vmaxq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+    }
+  max_row_scalar(dst + i, src + i, n - i);
+}
+
+static inline uint8x8_t mul_div255_neon(uint8x8_t a, uint8x8_t b)
+{
+  uint16x8_t t = vaddq_u16(vmull_u8(a, b), vdupq_n_u16(128));
+  return vshrn_n_u16(vaddq_u16(t, vshrq_n_u16(t, 8)), 8);
+}
+
+static void over_row_neon(unsigned char* dst, const unsigned char* src, int n)
+{
+  int i;
+  for(i = 0; i + 16 <= n; i += 16)
+    {
+      uint8x16_t d = vld1q_u8(dst + i);
+      uint8x16_t s = vld1q_u8(src + i);
+      uint8x16_t m = vcombine_u8(mul_div255_neon(vget_low_u8(d), vget_low_u8(s)),
+                                 mul_div255_neon(vget_high_u8(d), vget_high_u8(s)));
+      vst1q_u8(dst + i, vsubq_u8(vaddq_u8(d, s), m));
+    }
+  over_row_scalar(dst + i, src + i, n - i);
+}
+
+#endif
+
+composite_row_func composite_get_row_func(composite_mode mode)
+{
+#if defined(COMPOSITE_X86)
+  if (__builtin_cpu_supports("avx2"))
+    return mode == COMPOSITE_OVER ? over_row_avx2 : max_row_avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return mode == COMPOSITE_OVER ? over_row_sse2 : max_row_sse2;
+#elif defined(COMPOSITE_NEON)
+  return mode == COMPOSITE_OVER ? over_row_neon : max_row_neon;
+#endif
+  return mode == COMPOSITE_OVER ? over_row_scalar : max_row_scalar;
+}
+
+const char* composite_kernel_name(void)
+{
+#if defined(COMPOSITE_X86)
+  if (__builtin_cpu_supports("avx2"))
+    return "avx2";
+  if (__builtin_cpu_supports("sse2"))
+    return "sse2";
+#elif defined(COMPOSITE_NEON)
+  return "neon";
+#endif
+  return "scalar";
+}
+
+void composite_glyph(unsigned char* canvas, int canvasW, int canvasH,
+                     const unsigned char* glyph, int glyphW, int glyphH,
+                     int x, int y, composite_row_func rowFunc)
+{
+  int x0 = x < 0 ? 0 : x;
+  int y0 = y < 0 ? 0 : y;
+  int x1 = x + glyphW > canvasW ? canvasW : x + glyphW;
+  int y1 = y + glyphH > canvasH ? canvasH : y + glyphH;
+  int row;
+
+  if (x0 >= x1 || y0 >= y1)
+    return;
+  for(row = y0; row < y1; row++)
+    {
+      rowFunc(canvas + (long)row * canvasW + x0,
+              glyph + (long)(row - y) * glyphW + (x0 - x),
+              x1 - x0);
+    }
+}
+
+int composite_mono_stride(int canvasW)
+{
+  return ((canvasW + 31) / 32 + 1) * 4;
+}
+
+/*
+ * dst |= src shifted right by shift bits (0-7), over n source bytes.
+ * Source bytes are gathered big-endian into 32-bit words, so one shift
+ * and OR moves 32 pixels; the bits shifted out of a word carry into the
+ * next. dst must have room for n + 1 bytes.
+ */
+static void or_row_shifted(unsigned char* dst, const unsigned char* src, int n, int shift)
+{
+  uint32_t carry = 0;
+  uint32_t v, out;
+  int k;
+
+  for(k = 0; k + 4 <= n; k += 4)
+    {
+      v = (uint32_t)src[k] << 24 | (uint32_t)src[k + 1] << 16
+        | (uint32_t)src[k + 2] << 8 | src[k + 3];
+      out = (v >> shift) | carry;
+      carry = shift > 0 ? v << (32 - shift) : 0;
+      dst[k] |= out >> 24;
+      dst[k + 1] |= out >> 16;
+      dst[k + 2] |= out >> 8;
+      dst[k + 3] |= out;
+    }
+  for(; k < n; k++)
+    {
+      v = src[k];
+      dst[k] |= (v >> shift) | (carry >> 24);
+      carry = shift > 0 ? v << (32 - shift) : 0;
+    }
+  dst[n] |= carry >> 24;
+}
+
+void composite_glyph_mono(unsigned char* canvas, int canvasStride, int canvasW, int canvasH,
+                          const unsigned char* glyph, int glyphPitch, int glyphW, int glyphH,
+                          int x, int y)
+{
+  int y0 = y < 0 ? 0 : y;
+  int y1 = y + glyphH > canvasH ? canvasH : y + glyphH;
+  int row, i;
+
+  if (y0 >= y1 || x >= canvasW || x + glyphW <= 0)
+    return;
+  if (x >= 0 && x + glyphW <= canvasW)
+    {
+      for(row = y0; row < y1; row++)
+        {
+          or_row_shifted(canvas + (long)row * canvasStride + (x >> 3),
+                         glyph + (long)(row - y) * glyphPitch, (glyphW + 7) / 8, x & 7);
+        }
+      return;
+    }
+
+  /* clipped horizontally; the canvas normally fits the ink, so this is rare */
+  for(row = y0; row < y1; row++)
+    {
+      unsigned char* dst = canvas + (long)row * canvasStride;
+      const unsigned char* src = glyph + (long)(row - y) * glyphPitch;
+      for(i = x < 0 ? -x : 0; i < glyphW && x + i < canvasW; i++)
+        {
+          if (src[i >> 3] & (0x80 >> (i & 7)))
+            dst[(x + i) >> 3] |= 0x80 >> ((x + i) & 7);
+        }
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ * Compositing of 8-bit glyph coverage onto an 8-bit coverage canvas.
+ *
+ * Glyph rectangles are clipped against the canvas once, then blended a
+ * whole row at a time. Row kernels use SSE2/AVX2 on x86 (picked at run
+ * time) and NEON on ARM, with a scalar fallback. All kernels produce
+ * exactly the same bytes.
+ *
+ * 1-bit canvases for mono glyphs are combined with OR.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef COMPOSITE_H
+#define COMPOSITE_H
+
+typedef enum composite_mode
+{
+  /* dst = max(dst, src); overlapping glyphs do not darken */
+  COMPOSITE_MAX = 0,
+  /* dst = src + dst * (255 - src) / 255, source-over on coverage */
+  COMPOSITE_OVER = 1
+} composite_mode;
+
+/* blend n bytes of src into dst */
+typedef void (*composite_row_func)(unsigned char* dst, const unsigned char* src, int n);
+
+/* Row kernel for a mode, best one for the running CPU. */
+composite_row_func composite_get_row_func(composite_mode mode);
+
+/* Name of the kernel set composite_get_row_func() picks, e.g. "avx2". */
+const char* composite_kernel_name(void);
+
+/*
+ * Blend a glyph bitmap (glyphW bytes per row) into the canvas (canvasW
+ * bytes per row) with its top-left corner at (x, y). Parts outside the
+ * canvas are dropped.
+ */
+void composite_glyph(unsigned char* canvas, int canvasW, int canvasH,
+                     const unsigned char* glyph, int glyphW, int glyphH,
+                     int x, int y, composite_row_func rowFunc);
+
+/*
+ * Bytes per row of a 1-bit canvas canvasW pixels wide. Rows are rounded
+ * up to whole 32-bit words plus one spare word, which the compositing
+ * below may OR zeros into.
+ */
+int composite_mono_stride(int canvasW);
+
+/*
+ * OR a 1-bit glyph (glyphPitch bytes per row, most significant bit
+ * first, unused bits 0) into a 1-bit canvas with the same bit order and
+ * canvasStride bytes per row, with its top-left corner at (x, y). Rows
+ * are combined 32 bits at a time. Parts outside the canvas are dropped.
+ */
+void composite_glyph_mono(unsigned char* canvas, int canvasStride, int canvasW, int canvasH,
+                          const unsigned char* glyph, int glyphPitch, int glyphW, int glyphH,
+                          int x, int y);
+
+#endif
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "font_fallback.h"
+
+font_fallback* font_fallback_new(const char* indexPath)
+{
+  font_fallback* fb = calloc(1, sizeof(font_fallback));
+  int faceCount;
+
+  if (fb == NULL)
+    return NULL;
+  fb->index = font_index_open(indexPath);
+  if (fb->index == NULL)
+    {
+      free(fb);
+      return NULL;
+    }
+  faceCount = fb->index->header->faceCount;
+  fb->faces = calloc(faceCount > 0 ? faceCount : 1, sizeof(font_entry*));
+  fb->unusable = calloc(faceCount > 0 ? faceCount : 1, 1);
+  if (fb->faces == NULL || fb->unusable == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      font_fallback_free(fb);
+      return NULL;
+    }
+  return fb;
+}
+
+void font_fallback_free(font_fallback* fb)
+{
+  int i;
+
+  if (fb == NULL)
+    return;
+  for(i = 0; fb->faces != NULL && i < (int)fb->index->header->faceCount; i++)
+    {
+      if (fb->faces[i] != NULL)
+        font_entry_close(fb->faces[i]);
+    }
+  font_index_close(fb->index);
+  free(fb->faces);
+  free(fb->unusable);
+  free(fb->runs);
+  free(fb);
+}
+
+void font_fallback_set_char_size(font_fallback* fb, FT_F26Dot6 charSize)
+{
+  int i;
+
+  fb->charSize = charSize;
+  for(i = 0; i < (int)fb->index->header->faceCount; i++)
+    {
+      if (fb->faces[i] != NULL)
+        font_entry_set_char_size(fb->faces[i], charSize);
+    }
+}
+
+void font_fallback_set_stats(font_fallback* fb, render_stats* stats)
+{
+  int i;
+
+  fb->stats = stats;
+  for(i = 0; i < (int)fb->index->header->faceCount; i++)
+    {
+      if (fb->faces[i] != NULL)
+        {
+          fb->faces[i]->cache->stats = stats;
+          fb->faces[i]->shapes->stats = stats;
+        }
+    }
+}
+
+/* the opened fallback face, or NULL when it cannot be opened */
+static font_entry* get_face(font_fallback* fb, int face, const text_run* main)
+{
+  font_entry* e = fb->faces[face];
+  const char* path;
+  int faceIndex;
+  double start;
+
+  if (e != NULL || fb->unusable[face])
+    return e;
+  start = fb->stats != NULL ? render_stats_now() : 0;
+  path = font_index_face_path(fb->index, face, &faceIndex);
+  e = font_entry_open_face(fb->lib, path, faceIndex, FONT_FALLBACK_GLYPH_CACHE_BYTES,
+                           FONT_FALLBACK_SHAPE_CACHE_BYTES);
+  if (e == NULL)
+    {
+      /* the font went away since the index was built; not tried again */
+      fb->unusable[face] = 1;
+      fb->failures++;
+      return NULL;
+    }
+  font_entry_set_char_size(e, fb->charSize);
+  e->shapes->splitWords = main->shapes->splitWords;
+  e->cache->stats = fb->stats;
+  e->shapes->stats = fb->stats;
+  if (fb->stats != NULL)
+    render_stats_add(fb->stats, RENDER_STAGE_FACE_LOAD, render_stats_now() - start);
+  fb->faces[face] = e;
+  fb->opened++;
+  return e;
+}
+
+/*
+ * Decode the UTF-8 character at s into *c. Returns its length in bytes;
+ * a malformed byte is one character of its own, decoded as 0.
+ */
+static int next_utf8_char(const unsigned char* s, int len, unsigned int* c)
+{
+  int codeLength;
+  int i;
+
+  if (s[0] < 0x80)
+    {
+      *c = s[0];
+      return 1;
+    }
+  else if ((s[0] & 0xe0) == 0xc0)
+    codeLength = 2;
+  else if ((s[0] & 0xf0) == 0xe0)
+    codeLength = 3;
+  else if ((s[0] & 0xf8) == 0xf0)
+    codeLength = 4;
+  else
+    codeLength = 0;
+  for(i = 1; i < codeLength; i++)
+    {
+      if (i >= len || (s[i] & 0xc0) != 0x80)
+        codeLength = 0;
+    }
+  if (codeLength == 0)
+    {
+      *c = 0;
+      return 1;
+    }
+  *c = first_utf8_char((const char*)s, codeLength);
+  return codeLength;
+}
+
+/* characters that belong with the one before them */
+static int is_attached(unsigned int c)
+{
+  return c == 0
+    || (c >= 0x0300 && c <= 0x036f)    /* combining diacritical marks */
+    || (c >= 0x1ab0 && c <= 0x1aff)
+    || (c >= 0x1dc0 && c <= 0x1dff)
+    || (c >= 0x200c && c <= 0x200d)    /* ZWNJ, ZWJ */
+    || (c >= 0x20d0 && c <= 0x20ff)
+    || (c >= 0xfe00 && c <= 0xfe0f)    /* variation selectors */
+    || (c >= 0xfe20 && c <= 0xfe2f)
+    || (c >= 0x1f3fb && c <= 0x1f3ff)  /* emoji skin tones */
+    || (c >= 0xe0100 && c <= 0xe01ef);
+}
+
+int font_fallback_split(font_fallback* fb, const text_run* main,
+                        const char* text, int textLen, const text_run** outRuns)
+{
+  const unsigned char* s = (const unsigned char*)text;
+  int runCount = 0;
+  int runFace = -1; /* index face of the current run, -1 for the main font */
+  int pos = 0;
+
+  while(pos < textLen)
+    {
+      unsigned int c;
+      int charLen = next_utf8_char(s + pos, textLen - pos, &c);
+      int face = -1;
+
+      if (runCount > 0 && is_attached(c)
+          && (runFace < 0 || font_index_face_has(fb->index, runFace, c)))
+        {
+          face = runFace;
+        }
+      else if (c != 0 && FT_Get_Char_Index(main->ftFace, c) == 0)
+        {
+          /* the face of the current run is as good as the first, and keeps runs long */
+          if (runFace >= 0 && font_index_face_has(fb->index, runFace, c))
+            face = runFace;
+          else
+            face = font_index_lookup(fb->index, c);
+          if (face >= 0 && get_face(fb, face, main) == NULL)
+            face = -1;
+        }
+
+      if (runCount == 0 || face != runFace)
+        {
+          text_run* r;
+          if (runCount == fb->runCap)
+            {
+              int newCap = fb->runCap > 0 ? fb->runCap * 2 : 16;
+              text_run* newRuns = realloc(fb->runs, sizeof(text_run) * newCap);
+              if (newRuns == NULL)
+                return -1;
+              fb->runs = newRuns;
+              fb->runCap = newCap;
+            }
+          r = &fb->runs[runCount++];
+          if (face < 0)
+            {
+              *r = *main;
+            }
+          else
+            {
+              font_entry* e = fb->faces[face];
+              r->font = e->font;
+              r->ftFace = e->ftFace;
+              r->shapes = e->shapes;
+              r->cache = e->cache;
+            }
+          r->start = pos;
+          r->len = 0;
+          runFace = face;
+        }
+      fb->runs[runCount - 1].len += charLen;
+      pos += charLen;
+    }
+
+  if (runCount == 0)
+    {
+      /* empty text renders with the main font, like render_text() */
+      if (fb->runCap == 0)
+        {
+          fb->runs = malloc(sizeof(text_run));
+          if (fb->runs == NULL)
+            return -1;
+          fb->runCap = 1;
+        }
+      fb->runs[0] = *main;
+      fb->runs[0].start = 0;
+      fb->runs[0].len = 0;
+      runCount = 1;
+    }
+  *outRuns = fb->runs;
+  return runCount;
+}
@@ -0,0 +1,83 @@
+/*
+ * Font fallback through a font_index.
+ *
+ * A font_fallback splits text into runs by font: characters the main
+ * font has stay with it, the others go to the first indexed face that
+ * covers them. Marks, joiners and variation selectors stay with the
+ * character before them when its font covers them too. Characters no
+ * face covers stay with the main font and render as its .notdef.
+ *
+ * Fallback faces are opened on first use and kept, each with its own
+ * caches, at the size last set with font_fallback_set_char_size(). The
+ * runs go to render_text_runs(). A font_fallback is not thread-safe;
+ * give every thread its own (the index mapping is shared by the page
+ * cache anyway), with lib set to the thread's own FreeType library.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef FONT_FALLBACK_H
+#define FONT_FALLBACK_H
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "font_index.h"
+#include "font_pool.h"
+#include "text_render.h"
+#include "render_stats.h"
+
+/* cache limits of every fallback face */
+#define FONT_FALLBACK_GLYPH_CACHE_BYTES (2 * 1024 * 1024)
+#define FONT_FALLBACK_SHAPE_CACHE_BYTES (256 * 1024)
+
+typedef struct font_fallback
+{
+  font_index* index;
+  /*
+   * library faces are opened on, see font_entry_open_face(); NULL (the
+   * default) for hb-ft's, which only one thread may use
+   */
+  FT_Library lib;
+  /* by index face, NULL until used */
+  font_entry** faces;
+  /* by index face, set when the face could not be opened */
+  unsigned char* unusable;
+  FT_F26Dot6 charSize;
+  /* attached to the caches of every face opened */
+  render_stats* stats;
+  /* faces opened so far, and faces that could not be */
+  unsigned long opened;
+  unsigned long failures;
+  /* result of the last font_fallback_split() */
+  text_run* runs;
+  int runCap;
+} font_fallback;
+
+/*
+ * Use the index file at indexPath (see font_index_build()). Returns NULL
+ * when it cannot be opened.
+ */
+font_fallback* font_fallback_new(const char* indexPath);
+void font_fallback_free(font_fallback* fb);
+
+/* size of the fallback faces in 26.6 pixels; use the main font's size */
+void font_fallback_set_char_size(font_fallback* fb, FT_F26Dot6 charSize);
+
+/* attach stats to the caches of every fallback face, or detach with NULL */
+void font_fallback_set_stats(font_fallback* fb, render_stats* stats);
+
+/*
+ * Split a UTF-8 string into runs by font. main is the main font; its
+ * start and len are ignored. *outRuns receives the runs, which stay
+ * valid until the next call. Returns the number of runs (1, with the
+ * main font, when it has every character), or -1 when out of memory.
+ */
+int font_fallback_split(font_fallback* fb, const text_run* main,
+                        const char* text, int textLen, const text_run** outRuns);
+
+#endif
@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+/* memfd_create() and file seals */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "font_file.h"
+
+/* set by font_file_set_cache_dir(), else FONTRENDER_FONT_CACHE is used */
+static char* cacheDir = NULL;
+static int cacheDirSet = 0;
+
+static uint32_t read_u32(const unsigned char* p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* tables only read a glyph at a time, left to be paged in on demand */
+static int is_glyph_data(const unsigned char* tag)
+{
+  return memcmp(tag, "glyf", 4) == 0 || memcmp(tag, "CFF ", 4) == 0
+    || memcmp(tag, "CFF2", 4) == 0 || memcmp(tag, "EBDT", 4) == 0
+    || memcmp(tag, "CBDT", 4) == 0 || memcmp(tag, "sbix", 4) == 0
+    || memcmp(tag, "SVG ", 4) == 0;
+}
+
+/* prefetch the tables of the sfnt at offset, except the glyph data */
+static void advise_tables(unsigned char* data, int size, uint32_t offset)
+{
+  long pageSize = sysconf(_SC_PAGESIZE);
+  uint32_t numTables;
+  uint32_t i;
+
+  if ((uint64_t)offset + 12 > (uint64_t)size)
+    return;
+  numTables = (data[offset + 4] << 8) | data[offset + 5];
+  for(i = 0; i < numTables && (uint64_t)offset + 12 + 16 * (i + 1) <= (uint64_t)size; i++)
+    {
+      const unsigned char* record = data + offset + 12 + 16 * i;
+      uint32_t start = read_u32(record + 8);
+      uint32_t length = read_u32(record + 12);
+      uint32_t aligned;
+
+      if (is_glyph_data(record) || length == 0
+          || (uint64_t)start + length > (uint64_t)size)
+        continue;
+      aligned = start - start % pageSize;
+      madvise(data + aligned, length + (start - aligned), MADV_WILLNEED);
+    }
+}
+
+/*
+ * Lookups jump around the file, so readahead is switched off for the
+ * whole mapping; the small tables every lookup needs are read now.
+ * Files that are not sfnt fonts (e.g. a font index) only get the first.
+ */
+static void advise_font(unsigned char* data, int size)
+{
+  madvise(data, size, MADV_RANDOM);
+  if (size < 12)
+    return;
+  if (memcmp(data, "ttcf", 4) == 0)
+    {
+      /* a collection: one table directory per face */
+      uint32_t numFonts = read_u32(data + 8);
+      uint32_t i;
+      for(i = 0; i < numFonts && 12 + 4 * (uint64_t)(i + 1) <= (uint64_t)size; i++)
+        {
+          advise_tables(data, size, read_u32(data + 12 + 4 * i));
+        }
+    }
+  else if (read_u32(data) == 0x00010000 || memcmp(data, "OTTO", 4) == 0
+           || memcmp(data, "true", 4) == 0)
+    {
+      advise_tables(data, size, 0);
+    }
+}
+
+static unsigned char* map_fd(int fd, int size)
+{
+  unsigned char* data;
+
+  if (size <= 0)
+    {
+      fprintf(stderr, "WARNING: empty font file\n");
+      return NULL;
+    }
+  data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED)
+    {
+      fprintf(stderr, "WARNING: mmap failed\n");
+      return NULL;
+    }
+  advise_font(data, size);
+  return data;
+}
+
+static int copy_fd(int in, int out)
+{
+  char buf[65536];
+  ssize_t n;
+
+  while((n = read(in, buf, sizeof(buf))) > 0)
+    {
+      char* p = buf;
+      while(n > 0)
+        {
+          ssize_t written = write(out, p, n);
+          if (written <= 0)
+            return -1;
+          p += written;
+          n -= written;
+        }
+    }
+  return n < 0 ? -1 : 0;
+}
+
+static const char* get_cache_dir()
+{
+  if (!cacheDirSet)
+    {
+      const char* dir = getenv(FONT_FILE_CACHE_ENV);
+      return dir != NULL && dir[0] != '\0' ? dir : NULL;
+    }
+  return cacheDir;
+}
+
+/*
+ * Open the cached copy of the font at path, making it first if needed.
+ * Returns -1 when there is no usable copy.
+ */
+static int open_cached(const char* dir, const char* path, const struct stat* st)
+{
+  char cachePath[4096];
+  char tmpPath[4096 + 32];
+  int fd, in;
+
+  snprintf(cachePath, sizeof(cachePath), "%s/%llx-%llx-%llx-%llx.font", dir,
+           (unsigned long long)st->st_dev, (unsigned long long)st->st_ino,
+           (unsigned long long)st->st_size, (unsigned long long)st->st_mtime);
+  fd = open(cachePath, O_RDONLY);
+  if (fd >= 0)
+    return fd;
+
+  /* copied under a private name and renamed, so no one maps half a copy */
+  snprintf(tmpPath, sizeof(tmpPath), "%s.%ld.tmp", cachePath, (long)getpid());
+  in = open(path, O_RDONLY);
+  if (in < 0)
+    return -1;
+  fd = open(tmpPath, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    {
+      fprintf(stderr, "WARNING: cannot write to font cache %s\n", dir);
+      close(in);
+      return -1;
+    }
+  if (copy_fd(in, fd) != 0 || close(fd) != 0 || rename(tmpPath, cachePath) != 0)
+    {
+      fprintf(stderr, "WARNING: cannot copy %s to font cache %s\n", path, dir);
+      unlink(tmpPath);
+      close(in);
+      return -1;
+    }
+  close(in);
+  return open(cachePath, O_RDONLY);
+}
+
+unsigned char* font_file_map(const char* path, int* fileSize)
+{
+  struct stat statBuf;
+  const char* dir;
+  unsigned char* data;
+  int fd = -1;
+
+  if (strncmp(path, "fd:", 3) == 0)
+    {
+      /* the descriptor stays open; it belongs to whoever passed it on */
+      fd = atoi(path + 3);
+      if (fstat(fd, &statBuf) != 0 || !S_ISREG(statBuf.st_mode))
+        {
+          fprintf(stderr, "WARNING: %s is not an open font file\n", path);
+          return NULL;
+        }
+      *fileSize = statBuf.st_size;
+      return map_fd(fd, *fileSize);
+    }
+
+  if (stat(path, &statBuf) != 0)
+    {
+      return NULL;
+    }
+  else if (!S_ISREG(statBuf.st_mode))
+    {
+      fprintf(stderr, "WARNING: not a file\n");
+      return NULL;
+    }
+  *fileSize = statBuf.st_size;
+  dir = get_cache_dir();
+  if (dir != NULL)
+    fd = open_cached(dir, path, &statBuf);
+  if (fd < 0)
+    fd = open(path, O_RDONLY);
+  if (fd < 0)
+    {
+      fprintf(stderr, "WARNING: cannot open %s\n", path);
+      return NULL;
+    }
+  data = map_fd(fd, *fileSize);
+  close(fd);
+  return data;
+}
+
+void font_file_unmap(unsigned char* data, int size)
+{
+  munmap(data, size);
+}
+
+void font_file_set_cache_dir(const char* dir)
+{
+  free(cacheDir);
+  cacheDir = dir != NULL ? strdup(dir) : NULL;
+  cacheDirSet = 1;
+}
+
+int font_file_memfd(const char* path)
+{
+#ifdef MFD_ALLOW_SEALING
+  int in = open(path, O_RDONLY);
+  int fd;
+
+  if (in < 0)
+    {
+      fprintf(stderr, "WARNING: cannot open %s\n", path);
+      return -1;
+    }
+  /* no MFD_CLOEXEC: the point is to hand it to child processes */
+  fd = memfd_create("fontrender-font", MFD_ALLOW_SEALING);
+  if (fd < 0 || copy_fd(in, fd) != 0
+      || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0)
+    {
+      fprintf(stderr, "WARNING: cannot copy %s into a memfd\n", path);
+      if (fd >= 0)
+        close(fd);
+      close(in);
+      return -1;
+    }
+  close(in);
+  return fd;
+#else
+  fprintf(stderr, "WARNING: memfd is not supported here\n");
+  return -1;
+#endif
+}
+
+/* FT_Done_Face() closes the stream, dropping the mapping with it */
+static void close_stream(FT_Stream stream)
+{
+  font_file_unmap(stream->base, stream->size);
+  free(stream);
+}
+
+FT_Error font_file_new_face(FT_Library lib, const char* path, FT_Long faceIndex, FT_Face* face)
+{
+  FT_Open_Args args;
+  FT_Stream stream;
+  int size;
+  unsigned char* data = font_file_map(path, &size);
+
+  if (data == NULL)
+    return FT_Err_Cannot_Open_Resource;
+  stream = calloc(1, sizeof(FT_StreamRec));
+  if (stream == NULL)
+    {
+      font_file_unmap(data, size);
+      return FT_Err_Out_Of_Memory;
+    }
+  /* a memory stream: no read function, FreeType reads base directly */
+  stream->base = data;
+  stream->size = size;
+  stream->close = close_stream;
+
+  memset(&args, 0, sizeof(args));
+  args.flags = FT_OPEN_STREAM;
+  args.stream = stream;
+  /* the stream is closed by FreeType on failure too */
+  return FT_Open_Face(lib, &args, faceIndex, face);
+}
@@ -0,0 +1,62 @@
+/*
+ * Font files mapped into memory.
+ *
+ * Every tool loads fonts through here. A font is mapped read-only and
+ * shared, so all processes using a font on one machine share its page
+ * cache pages instead of each reading the file through FreeType's
+ * stream. The mapping is advised for random access, and the tables read
+ * on every lookup (cmap, hmtx, loca, GSUB, ...) are prefetched; glyph
+ * outlines are left to be paged in when used.
+ *
+ * Besides file paths, a font can come from:
+ * - "fd:N", an inherited file descriptor such as a memfd made with
+ *   font_file_memfd() by a parent process.
+ * - a shared font cache directory, set with font_file_set_cache_dir()
+ *   or the FONTRENDER_FONT_CACHE environment variable. The first
+ *   process to use a font copies it there, named after the file's
+ *   device, inode, size and modification time; later ones map the
+ *   copy. Put it on tmpfs (/dev/shm) for fonts on slow or network file
+ *   systems.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef FONT_FILE_H
+#define FONT_FILE_H
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+/* environment variable naming the shared font cache directory */
+#define FONT_FILE_CACHE_ENV "FONTRENDER_FONT_CACHE"
+
+/*
+ * Map a whole font file (or "fd:N") read-only; *fileSize receives its
+ * length. Returns NULL when it cannot be mapped.
+ */
+unsigned char* font_file_map(const char* path, int* fileSize);
+void font_file_unmap(unsigned char* data, int size);
+
+/*
+ * Map fonts through copies in dir from now on, or directly again with
+ * NULL. Overrides FONTRENDER_FONT_CACHE. The directory must exist.
+ */
+void font_file_set_cache_dir(const char* dir);
+
+/*
+ * Copy a font file into a sealed memfd, to be mapped as "fd:N" by child
+ * processes that inherit it. Returns the descriptor, or -1 on failure.
+ */
+int font_file_memfd(const char* path);
+
+/*
+ * FT_New_Face() on a font_file_map() mapping of path, with the same
+ * sources. The face owns the mapping; FT_Done_Face() unmaps it.
+ */
+FT_Error font_file_new_face(FT_Library lib, const char* path, FT_Long faceIndex, FT_Face* face);
+
+#endif
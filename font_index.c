@@ -0,0 +1,487 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "font_index.h"
+#include "font_file.h"
+
+/* deepest directory nesting scanned, which also stops symlink loops */
+#define FONT_INDEX_MAX_DEPTH 16
+#define ALIGN4(n) (((n) + 3) & ~(size_t)3)
+
+typedef struct index_builder
+{
+  FT_Library lib;
+  font_index_face* faces;
+  int faceCount;
+  size_t faceCap;
+  font_index_page* pages;
+  size_t pageCount;
+  size_t pageCap;
+  uint16_t* map;
+  size_t mapPageCount;
+  size_t mapPageCap;
+  uint32_t directory[FONT_INDEX_PAGES];
+  char* strings;
+  size_t stringsSize;
+  size_t stringsCap;
+  uint32_t lastPath; /* faces of a collection share their path */
+  /* coverage of the face being indexed, one bit per code point */
+  uint8_t coverage[0x110000 / 8];
+  int verbose;
+  int failed;
+} index_builder;
+
+/* make room for need elements of elemSize bytes in *array */
+static int grow(void** array, size_t* cap, size_t need, size_t elemSize)
+{
+  size_t newCap;
+  void* newArray;
+
+  if (need <= *cap)
+    return 0;
+  newCap = *cap > 0 ? *cap * 2 : 64;
+  while(newCap < need)
+    newCap *= 2;
+  newArray = realloc(*array, newCap * elemSize);
+  if (newArray == NULL)
+    return -1;
+  *array = newArray;
+  *cap = newCap;
+  return 0;
+}
+
+static uint32_t add_path(index_builder* b, const char* path)
+{
+  size_t len = strlen(path) + 1;
+
+  if (b->stringsSize > 0 && strcmp(b->strings + b->lastPath, path) == 0)
+    return b->lastPath;
+  if (grow((void**)&b->strings, &b->stringsCap, b->stringsSize + len, 1) != 0)
+    {
+      b->failed = 1;
+      return 0;
+    }
+  memcpy(b->strings + b->stringsSize, path, len);
+  b->lastPath = b->stringsSize;
+  b->stringsSize += len;
+  return b->lastPath;
+}
+
+/* append the non-empty pages of b->coverage and claim their free map entries */
+static void add_pages(index_builder* b, font_index_face* f, uint16_t id)
+{
+  uint32_t p;
+  int i;
+
+  f->firstPage = b->pageCount;
+  for(p = 0; p < FONT_INDEX_PAGES && !b->failed; p++)
+    {
+      const uint8_t* bits = &b->coverage[p * 32];
+      uint16_t* map;
+
+      for(i = 0; i < 32 && bits[i] == 0; i++);
+      if (i == 32)
+        continue;
+      if (grow((void**)&b->pages, &b->pageCap, b->pageCount + 1, sizeof(font_index_page)) != 0)
+        {
+          b->failed = 1;
+          break;
+        }
+      b->pages[b->pageCount].page = p;
+      memcpy(b->pages[b->pageCount].bits, bits, 32);
+      b->pageCount++;
+      f->pageCount++;
+
+      if (b->directory[p] == FONT_INDEX_NONE)
+        {
+          if (grow((void**)&b->map, &b->mapPageCap, b->mapPageCount + 1, 256 * sizeof(uint16_t)) != 0)
+            {
+              b->failed = 1;
+              break;
+            }
+          /* all ones is FONT_INDEX_NO_FACE */
+          memset(&b->map[b->mapPageCount * 256], 0xff, 256 * sizeof(uint16_t));
+          b->directory[p] = b->mapPageCount++;
+        }
+      map = &b->map[(size_t)b->directory[p] * 256];
+      for(i = 0; i < 256; i++)
+        {
+          if (map[i] == FONT_INDEX_NO_FACE && (bits[i >> 3] & (1 << (i & 7))))
+            map[i] = id;
+        }
+    }
+}
+
+static void index_face(index_builder* b, const char* path, int faceIndex, FT_Face face)
+{
+  font_index_face* f;
+  FT_ULong charcode;
+  FT_UInt glyphIndex;
+  uint32_t count = 0;
+
+  if (FT_Select_Charmap(face, FT_ENCODING_UNICODE) != 0)
+    return;
+  memset(b->coverage, 0, sizeof(b->coverage));
+  charcode = FT_Get_First_Char(face, &glyphIndex);
+  while(glyphIndex != 0)
+    {
+      if (charcode < 0x110000)
+        {
+          b->coverage[charcode >> 3] |= 1 << (charcode & 7);
+          count++;
+        }
+      charcode = FT_Get_Next_Char(face, charcode, &glyphIndex);
+    }
+  if (count == 0)
+    return;
+  if (b->faceCount == FONT_INDEX_MAX_FACES)
+    {
+      fprintf(stderr, "WARNING: more than %d faces, %s not indexed\n", FONT_INDEX_MAX_FACES, path);
+      return;
+    }
+  if (grow((void**)&b->faces, &b->faceCap, b->faceCount + 1, sizeof(font_index_face)) != 0)
+    {
+      b->failed = 1;
+      return;
+    }
+
+  f = &b->faces[b->faceCount];
+  memset(f, 0, sizeof(font_index_face));
+  f->pathOffset = add_path(b, path);
+  f->faceIndex = faceIndex;
+  f->codepoints = count;
+  add_pages(b, f, b->faceCount);
+  if (b->verbose)
+    fprintf(stderr, "%d: %s (face %d), %u code points\n", b->faceCount, path, faceIndex, count);
+  b->faceCount++;
+}
+
+static void index_file(index_builder* b, const char* path)
+{
+  FT_Face face;
+  long faceCount;
+  long i;
+
+  if (FT_New_Face(b->lib, path, 0, &face) != 0)
+    return;
+  faceCount = face->num_faces;
+  index_face(b, path, 0, face);
+  FT_Done_Face(face);
+  for(i = 1; i < faceCount && !b->failed; i++)
+    {
+      if (FT_New_Face(b->lib, path, i, &face) != 0)
+        continue;
+      index_face(b, path, i, face);
+      FT_Done_Face(face);
+    }
+}
+
+static int compare_names(const void* a, const void* b)
+{
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void scan_dir(index_builder* b, const char* dirPath, int depth)
+{
+  DIR* dir;
+  struct dirent* ent;
+  char** names = NULL;
+  size_t nameCount = 0, nameCap = 0;
+  size_t i;
+
+  if (depth > FONT_INDEX_MAX_DEPTH)
+    return;
+  dir = opendir(dirPath);
+  if (dir == NULL)
+    {
+      fprintf(stderr, "WARNING: cannot open directory %s\n", dirPath);
+      return;
+    }
+  /* sorted, so the index does not depend on the order readdir gives */
+  while((ent = readdir(dir)) != NULL)
+    {
+      if (ent->d_name[0] == '.')
+        continue;
+      if (grow((void**)&names, &nameCap, nameCount + 1, sizeof(char*)) != 0
+          || (names[nameCount] = strdup(ent->d_name)) == NULL)
+        {
+          b->failed = 1;
+          break;
+        }
+      nameCount++;
+    }
+  closedir(dir);
+  qsort(names, nameCount, sizeof(char*), compare_names);
+
+  for(i = 0; i < nameCount; i++)
+    {
+      size_t len = strlen(dirPath) + strlen(names[i]) + 2;
+      char* path = malloc(len);
+      struct stat st;
+
+      if (path == NULL)
+        {
+          b->failed = 1;
+        }
+      else if (!b->failed)
+        {
+          snprintf(path, len, "%s/%s", dirPath, names[i]);
+          /* stat follows symlinks, as fontconfig does */
+          if (stat(path, &st) == 0)
+            {
+              if (S_ISDIR(st.st_mode))
+                scan_dir(b, path, depth + 1);
+              else if (S_ISREG(st.st_mode))
+                index_file(b, path);
+            }
+        }
+      free(path);
+      free(names[i]);
+    }
+  free(names);
+}
+
+static int write_index(index_builder* b, const char* path)
+{
+  font_index_header h;
+  static const uint8_t zeros[4] = {0, 0, 0, 0};
+  size_t tmpLen = strlen(path) + 5;
+  char* tmpPath = malloc(tmpLen);
+  FILE* f;
+  int ok;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, FONT_INDEX_MAGIC, 4);
+  h.version = FONT_INDEX_VERSION;
+  h.faceCount = b->faceCount;
+  h.pageCount = b->pageCount;
+  h.mapPageCount = b->mapPageCount;
+  h.facesOffset = ALIGN4(sizeof(h));
+  h.pagesOffset = h.facesOffset + sizeof(font_index_face) * b->faceCount;
+  h.directoryOffset = h.pagesOffset + sizeof(font_index_page) * b->pageCount;
+  h.mapOffset = h.directoryOffset + sizeof(uint32_t) * FONT_INDEX_PAGES;
+  h.stringsOffset = h.mapOffset + sizeof(uint16_t) * 256 * b->mapPageCount;
+  h.stringsSize = b->stringsSize;
+
+  if (tmpPath == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return -1;
+    }
+  snprintf(tmpPath, tmpLen, "%s.tmp", path);
+  f = fopen(tmpPath, "wb");
+  if (f == NULL)
+    {
+      fprintf(stderr, "ERROR: cannot open %s\n", tmpPath);
+      free(tmpPath);
+      return -1;
+    }
+  ok = fwrite(&h, sizeof(h), 1, f) == 1
+    && fwrite(zeros, 1, h.facesOffset - sizeof(h), f) == h.facesOffset - sizeof(h)
+    && fwrite(b->faces, sizeof(font_index_face), b->faceCount, f) == (size_t)b->faceCount
+    && fwrite(b->pages, sizeof(font_index_page), b->pageCount, f) == b->pageCount
+    && fwrite(b->directory, sizeof(uint32_t), FONT_INDEX_PAGES, f) == FONT_INDEX_PAGES
+    && fwrite(b->map, 256 * sizeof(uint16_t), b->mapPageCount, f) == b->mapPageCount
+    && fwrite(b->strings, 1, b->stringsSize, f) == b->stringsSize;
+  if (fclose(f) != 0 || !ok || rename(tmpPath, path) != 0)
+    {
+      fprintf(stderr, "ERROR: cannot write %s\n", path);
+      remove(tmpPath);
+      free(tmpPath);
+      return -1;
+    }
+  free(tmpPath);
+  return 0;
+}
+
+int font_index_build(const char* const* dirs, int dirCount, const char* path, int verbose)
+{
+  index_builder* b = calloc(1, sizeof(index_builder));
+  int ret = -1;
+  int i;
+
+  if (b == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return -1;
+    }
+  if (FT_Init_FreeType(&b->lib) != 0)
+    {
+      fprintf(stderr, "ERROR: init library\n");
+      free(b);
+      return -1;
+    }
+  b->verbose = verbose;
+  for(i = 0; i < FONT_INDEX_PAGES; i++)
+    {
+      b->directory[i] = FONT_INDEX_NONE;
+    }
+  for(i = 0; i < dirCount && !b->failed; i++)
+    {
+      scan_dir(b, dirs[i], 0);
+    }
+
+  if (b->failed)
+    fprintf(stderr, "ERROR: out of memory\n");
+  else if (write_index(b, path) == 0)
+    ret = b->faceCount;
+  FT_Done_FreeType(b->lib);
+  free(b->faces);
+  free(b->pages);
+  free(b->map);
+  free(b->strings);
+  free(b);
+  return ret;
+}
+
+/* whether count elements of size bytes at offset fit in the file */
+static int region_fits(const font_index* index, uint32_t offset, uint64_t count, size_t size)
+{
+  return offset % 4 == 0 && (uint64_t)offset + count * size <= (uint64_t)index->dataSize;
+}
+
+static int validate(const font_index* index)
+{
+  const font_index_header* h = index->header;
+  uint32_t i;
+
+  if (memcmp(h->magic, FONT_INDEX_MAGIC, 4) != 0 || h->version != FONT_INDEX_VERSION
+      || h->faceCount > FONT_INDEX_MAX_FACES
+      || !region_fits(index, h->facesOffset, h->faceCount, sizeof(font_index_face))
+      || !region_fits(index, h->pagesOffset, h->pageCount, sizeof(font_index_page))
+      || !region_fits(index, h->directoryOffset, FONT_INDEX_PAGES, sizeof(uint32_t))
+      || !region_fits(index, h->mapOffset, (uint64_t)h->mapPageCount * 256, sizeof(uint16_t))
+      || (uint64_t)h->stringsOffset + h->stringsSize > (uint64_t)index->dataSize
+      || (h->stringsSize > 0 && index->strings[h->stringsSize - 1] != '\0'))
+    {
+      return -1;
+    }
+  for(i = 0; i < h->faceCount; i++)
+    {
+      const font_index_face* f = &index->faces[i];
+      if (f->pathOffset >= h->stringsSize
+          || (uint64_t)f->firstPage + f->pageCount > h->pageCount)
+        return -1;
+    }
+  for(i = 0; i < FONT_INDEX_PAGES; i++)
+    {
+      if (index->directory[i] != FONT_INDEX_NONE && index->directory[i] >= h->mapPageCount)
+        return -1;
+    }
+  return 0;
+}
+
+font_index* font_index_open(const char* path)
+{
+  font_index* index = calloc(1, sizeof(font_index));
+
+  if (index == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return NULL;
+    }
+  index->data = font_file_map(path, &index->dataSize);
+  if (index->data == NULL || index->dataSize < (int)sizeof(font_index_header))
+    {
+      fprintf(stderr, "ERROR: cannot read font index %s\n", path);
+      if (index->data != NULL)
+        font_file_unmap(index->data, index->dataSize);
+      free(index);
+      return NULL;
+    }
+  index->header = (const font_index_header*)index->data;
+  index->faces = (const font_index_face*)(index->data + index->header->facesOffset);
+  index->pages = (const font_index_page*)(index->data + index->header->pagesOffset);
+  index->directory = (const uint32_t*)(index->data + index->header->directoryOffset);
+  index->map = (const uint16_t*)(index->data + index->header->mapOffset);
+  index->strings = (const char*)(index->data + index->header->stringsOffset);
+  if (validate(index) != 0)
+    {
+      fprintf(stderr, "ERROR: %s is not a valid font index\n", path);
+      font_index_close(index);
+      return NULL;
+    }
+  return index;
+}
+
+void font_index_close(font_index* index)
+{
+  if (index == NULL)
+    return;
+  font_file_unmap(index->data, index->dataSize);
+  free(index);
+}
+
+int font_index_lookup(const font_index* index, unsigned int codepoint)
+{
+  uint32_t mapPage;
+  uint16_t face;
+
+  if (codepoint >= 0x110000)
+    return -1;
+  mapPage = index->directory[codepoint >> 8];
+  if (mapPage == FONT_INDEX_NONE)
+    return -1;
+  face = index->map[(size_t)mapPage * 256 + (codepoint & 255)];
+  return face < index->header->faceCount ? face : -1;
+}
+
+int font_index_face_has(const font_index* index, int face, unsigned int codepoint)
+{
+  const font_index_face* f;
+  uint32_t page = codepoint >> 8;
+  uint32_t lo, hi;
+
+  if (face < 0 || face >= (int)index->header->faceCount || codepoint >= 0x110000)
+    return 0;
+  f = &index->faces[face];
+  lo = f->firstPage;
+  hi = f->firstPage + f->pageCount;
+  while(lo < hi)
+    {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (index->pages[mid].page < page)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (lo == f->firstPage + f->pageCount || index->pages[lo].page != page)
+    return 0;
+  return (index->pages[lo].bits[(codepoint & 255) >> 3] >> (codepoint & 7)) & 1;
+}
+
+const char* font_index_face_path(const font_index* index, int face, int* faceIndex)
+{
+  const font_index_face* f = &index->faces[face];
+  if (faceIndex != NULL)
+    *faceIndex = f->faceIndex;
+  return index->strings + f->pathOffset;
+}
+
+FT_Error font_index_new_face(const font_index* index, FT_Library lib,
+                             unsigned int codepoint, FT_Face* face)
+{
+  int fallback = font_index_lookup(index, codepoint);
+  const char* path;
+  int faceIndex;
+
+  if (fallback < 0)
+    return FT_Err_Invalid_Character_Code;
+  path = font_index_face_path(index, fallback, &faceIndex);
+  return font_file_new_face(lib, path, faceIndex, face);
+}
@@ -0,0 +1,127 @@
+/*
+ * On-disk index of the Unicode coverage of installed fonts.
+ *
+ * font_index_build() scans font directories once, reads the Unicode
+ * cmap of every face and writes a file that is used straight from an
+ * mmap, without parsing:
+ *
+ *   header
+ *   faces       font_index_face per face, in priority order
+ *   pages       sparse coverage bitsets: one font_index_page for every
+ *               256 code point page a face has any glyph in, sorted by
+ *               face, then page
+ *   directory   uint32 per page of U+0000..U+10FFFF: a map page, or
+ *               FONT_INDEX_NONE when no face covers the page
+ *   map         uint16 per code point of every map page: the first face
+ *               covering it, or FONT_INDEX_NO_FACE
+ *   strings     NUL terminated font paths
+ *
+ * Lookups of the first face for a code point are two array reads.
+ * Whether a given face covers a code point is a binary search of its
+ * pages. Faces come in the order of the directories given, then sorted
+ * by path, so the first directory has priority.
+ *
+ * Numbers are in host byte order; the file is meant for the machine it
+ * was built on.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef FONT_INDEX_H
+#define FONT_INDEX_H
+
+#include <stdint.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#define FONT_INDEX_MAGIC "FIDX"
+#define FONT_INDEX_VERSION 1
+/* code point pages of 256 code points, up to U+10FFFF */
+#define FONT_INDEX_PAGES (0x110000 >> 8)
+#define FONT_INDEX_NONE 0xffffffffu
+#define FONT_INDEX_NO_FACE 0xffff
+/* face ids are 16-bit in the map; faces beyond this are not indexed */
+#define FONT_INDEX_MAX_FACES 0xfffe
+
+typedef struct font_index_header
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t faceCount;
+  uint32_t pageCount;
+  uint32_t mapPageCount;
+  /* byte offsets from the start of the file */
+  uint32_t facesOffset;
+  uint32_t pagesOffset;
+  uint32_t directoryOffset;
+  uint32_t mapOffset;
+  uint32_t stringsOffset;
+  uint32_t stringsSize;
+} font_index_header;
+
+typedef struct font_index_face
+{
+  uint32_t pathOffset; /* into the strings */
+  uint32_t faceIndex;  /* face of a font collection */
+  uint32_t firstPage;
+  uint32_t pageCount;
+  uint32_t codepoints; /* number of code points covered */
+} font_index_face;
+
+typedef struct font_index_page
+{
+  uint32_t page;      /* code point >> 8 */
+  uint8_t bits[32];   /* bit (code point & 255), least significant first */
+} font_index_page;
+
+/* an index file mapped into memory */
+typedef struct font_index
+{
+  unsigned char* data;
+  int dataSize;
+  const font_index_header* header;
+  const font_index_face* faces;
+  const font_index_page* pages;
+  const uint32_t* directory;
+  const uint16_t* map;
+  const char* strings;
+} font_index;
+
+/*
+ * Scan dirCount directories, recursively, and write the index of every
+ * face with a Unicode cmap to path. Files FreeType cannot open are
+ * skipped. The file is written next to path and renamed over it, so
+ * processes using an older index are not disturbed. verbose lists the
+ * faces on stderr. Returns the number of faces indexed, or -1 on
+ * failure.
+ */
+int font_index_build(const char* const* dirs, int dirCount, const char* path, int verbose);
+
+/*
+ * Map an index file. Returns NULL when it cannot be read or is not a
+ * valid index.
+ */
+font_index* font_index_open(const char* path);
+void font_index_close(font_index* index);
+
+/* first face covering codepoint, or -1 when no face does */
+int font_index_lookup(const font_index* index, unsigned int codepoint);
+
+/* whether face covers codepoint */
+int font_index_face_has(const font_index* index, int face, unsigned int codepoint);
+
+/* font file of face; *faceIndex receives its face in the file */
+const char* font_index_face_path(const font_index* index, int face, int* faceIndex);
+
+/*
+ * font_file_new_face() of the first face covering codepoint. Returns the
+ * FreeType error, FT_Err_Invalid_Character_Code when no face covers it.
+ */
+FT_Error font_index_new_face(const font_index* index, FT_Library lib,
+                             unsigned int codepoint, FT_Face* face);
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <hb-ft.h>
+#include <hb-ot.h>
+
+#include "font_pool.h"
+
+font_pool* font_pool_new(int maxFonts)
+{
+  font_pool* pool = calloc(1, sizeof(font_pool));
+  if (pool == NULL)
+    return NULL;
+  pool->maxFonts = maxFonts > 0 ? maxFonts : 1;
+  return pool;
+}
+
+void font_entry_close(font_entry* e)
+{
+  /*
+   * FT_Done_Face is not needed for hb-ft faces, since harfbuzz will do
+   * that.
+   */
+  glyph_cache_free(e->cache);
+  shape_cache_free(e->shapes);
+  hb_font_destroy(e->font);
+  if (e->ownsFace)
+    FT_Done_Face(e->ftFace);
+  hb_face_destroy(e->face);
+  hb_blob_destroy(e->blob);
+  font_file_unmap(e->data, e->dataSize);
+  free(e->path);
+  free(e);
+}
+
+void font_pool_free(font_pool* pool)
+{
+  font_entry* e;
+  font_entry* next;
+
+  if (pool == NULL)
+    return;
+  for(e = pool->head; e != NULL; e = next)
+    {
+      next = e->next;
+      font_entry_close(e);
+    }
+  free(pool);
+}
+
+font_entry* font_entry_open(const char* path, size_t glyphCacheBytes, size_t shapeCacheBytes)
+{
+  return font_entry_open_face(NULL, path, 0, glyphCacheBytes, shapeCacheBytes);
+}
+
+font_entry* font_entry_open_face(FT_Library lib, const char* path, int faceIndex,
+                                 size_t glyphCacheBytes, size_t shapeCacheBytes)
+{
+  font_entry* e = calloc(1, sizeof(font_entry));
+  size_t pathLen = strlen(path);
+
+  if (e == NULL)
+    return NULL;
+  e->path = malloc(pathLen + 1);
+  e->cache = glyph_cache_new(glyphCacheBytes);
+  e->shapes = shape_cache_new(shapeCacheBytes);
+  if (e->path == NULL || e->cache == NULL || e->shapes == NULL)
+    {
+      glyph_cache_free(e->cache);
+      shape_cache_free(e->shapes);
+      free(e->path);
+      free(e);
+      return NULL;
+    }
+  memcpy(e->path, path, pathLen + 1);
+  e->faceIndex = faceIndex;
+
+  e->data = font_file_map(path, &e->dataSize);
+  if (e->data == NULL)
+    {
+      fprintf(stderr, "WARNING: cannot read font file %s\n", path);
+      glyph_cache_free(e->cache);
+      shape_cache_free(e->shapes);
+      free(e->path);
+      free(e);
+      return NULL;
+    }
+  e->blob = hb_blob_create((const char*)e->data, e->dataSize,
+                           HB_MEMORY_MODE_READONLY, NULL, NULL);
+  e->face = hb_face_create(e->blob, faceIndex);
+  e->font = hb_font_create(e->face);
+  if (lib != NULL)
+    {
+      if (FT_New_Memory_Face(lib, e->data, e->dataSize, faceIndex, &e->ftFace) == 0)
+        e->ownsFace = 1;
+      else
+        e->ftFace = NULL;
+      hb_ot_font_set_funcs(e->font);
+    }
+  else
+    {
+      hb_ft_font_set_funcs(e->font);
+      e->ftFace = hb_ft_font_get_face(e->font);
+    }
+  if (e->ftFace == NULL)
+    {
+      fprintf(stderr, "WARNING: FreeType cannot open %s\n", path);
+      font_entry_close(e);
+      return NULL;
+    }
+  return e;
+}
+
+font_entry* font_pool_get(font_pool* pool, const char* path)
+{
+  font_entry** p;
+  font_entry* e;
+
+  for(p = &pool->head; *p != NULL; p = &(*p)->next)
+    {
+      if (strcmp((*p)->path, path) == 0)
+        {
+          /* move to front */
+          e = *p;
+          *p = e->next;
+          e->next = pool->head;
+          pool->head = e;
+          pool->hits++;
+          return e;
+        }
+    }
+
+  pool->misses++;
+  e = font_entry_open_face(pool->lib, path, 0, FONT_POOL_GLYPH_CACHE_BYTES,
+                           FONT_POOL_SHAPE_CACHE_BYTES);
+  if (e == NULL)
+    return NULL;
+
+  if (pool->count >= pool->maxFonts)
+    {
+      /* close the least recently used font, at the end of the list */
+      for(p = &pool->head; (*p)->next != NULL; p = &(*p)->next);
+      font_entry_close(*p);
+      *p = NULL;
+      pool->count--;
+    }
+  e->next = pool->head;
+  pool->head = e;
+  pool->count++;
+  return e;
+}
+
+void font_entry_set_char_size(font_entry* entry, FT_F26Dot6 charSize)
+{
+  if (entry->charSize == charSize)
+    return;
+  /* at 72 dpi, the same way hb-ft sizes the face from the scale */
+  FT_Set_Char_Size(entry->ftFace, charSize, charSize, 0, 0);
+  hb_font_set_scale(entry->font, charSize, charSize);
+  entry->charSize = charSize;
+}
+
+void font_entry_set_pixel_size(font_entry* entry, int pixelSize)
+{
+  font_entry_set_char_size(entry, (FT_F26Dot6)pixelSize * 64);
+}
@@ -0,0 +1,96 @@
+/*
+ * Pool of opened fonts, keyed by font path.
+ *
+ * Every entry keeps the font file mapped with font_file_map(), the harfbuzz blob/face/font
+ * (with hb-ft font funcs, so there is a FreeType face behind it), a
+ * glyph cache for that face and a cache of runs shaped with the font. When the pool is full, the least recently
+ * used font is closed.
+ *
+ * hb-ft opens its faces on one FreeType library shared by the whole
+ * process, which must not be used by two threads at once. Threads of
+ * their own open fonts on their own library instead (pool->lib, or the
+ * lib argument of font_entry_open_face()); such entries have a FreeType
+ * face of that library and hb-ot font funcs.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef FONT_POOL_H
+#define FONT_POOL_H
+
+#include <hb.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "glyph_cache.h"
+#include "shape_cache.h"
+#include "font_file.h"
+
+/* glyph cache limit for each opened font */
+#define FONT_POOL_GLYPH_CACHE_BYTES (4 * 1024 * 1024)
+/* shape cache limit for each opened font */
+#define FONT_POOL_SHAPE_CACHE_BYTES (512 * 1024)
+
+typedef struct font_entry
+{
+  char* path;
+  int faceIndex; /* face of a font collection, 0 for single fonts */
+  unsigned char* data;
+  int dataSize;
+  hb_blob_t* blob;
+  hb_face_t* face;
+  hb_font_t* font;
+  FT_Face ftFace;
+  int ownsFace; /* ftFace was opened on a caller's library, not by hb-ft */
+  FT_F26Dot6 charSize; /* 26.6 pixels, 0 until set */
+  glyph_cache* cache;
+  shape_cache* shapes;
+  struct font_entry* next;
+} font_entry;
+
+typedef struct font_pool
+{
+  /* most recently used first */
+  font_entry* head;
+  int count;
+  int maxFonts;
+  /* library fonts are opened on, NULL (the default) for hb-ft's */
+  FT_Library lib;
+  unsigned long hits;
+  unsigned long misses;
+} font_pool;
+
+font_pool* font_pool_new(int maxFonts);
+void font_pool_free(font_pool* pool);
+
+/*
+ * Find the font opened from path, opening it on a miss. Returns NULL
+ * when the font cannot be opened. The entry belongs to the pool and may
+ * be closed by a later font_pool_get().
+ */
+font_entry* font_pool_get(font_pool* pool, const char* path);
+
+/*
+ * Open a font outside of any pool, with caches of the given limits.
+ * Returns NULL when the font cannot be opened. Close it with
+ * font_entry_close().
+ */
+font_entry* font_entry_open(const char* path, size_t glyphCacheBytes, size_t shapeCacheBytes);
+/*
+ * Same for face faceIndex of a font collection (.ttc), with the FreeType
+ * face opened on lib, or by hb-ft when lib is NULL.
+ */
+font_entry* font_entry_open_face(FT_Library lib, const char* path, int faceIndex,
+                                 size_t glyphCacheBytes, size_t shapeCacheBytes);
+void font_entry_close(font_entry* entry);
+
+/* Set both the harfbuzz scale and the FreeType char size. */
+void font_entry_set_pixel_size(font_entry* entry, int pixelSize);
+/* same, with the size in 26.6 pixels */
+void font_entry_set_char_size(font_entry* entry, FT_F26Dot6 charSize);
+
+#endif
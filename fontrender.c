@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fontrender.h"
+
+fontrender_font* fontrender_open(const char* path)
+{
+  return fontrender_open_library(NULL, path);
+}
+
+fontrender_font* fontrender_open_library(FT_Library lib, const char* path)
+{
+  fontrender_font* font = calloc(1, sizeof(fontrender_font));
+
+  if (font == NULL)
+    {
+      return NULL;
+    }
+  font->entry = font_entry_open_face(lib, path, 0, FONTRENDER_GLYPH_CACHE_BYTES,
+                                     FONTRENDER_SHAPE_CACHE_BYTES);
+  if (font->entry == NULL)
+    {
+      free(font);
+      return NULL;
+    }
+  font->buffer = hb_buffer_create();
+  font->mode = COMPOSITE_MAX;
+  return font;
+}
+
+void fontrender_close(fontrender_font* font)
+{
+  if (font == NULL)
+    return;
+  hb_buffer_destroy(font->buffer);
+  font_entry_close(font->entry);
+  free(font);
+}
+
+void fontrender_set_pixel_size(fontrender_font* font, int pixelSize)
+{
+  fontrender_set_char_size(font, (FT_F26Dot6)pixelSize * 64);
+}
+
+void fontrender_set_char_size(fontrender_font* font, FT_F26Dot6 charSize)
+{
+  font_entry_set_char_size(font->entry, charSize);
+  if (font->fallback != NULL)
+    font_fallback_set_char_size(font->fallback, charSize);
+}
+
+int fontrender_set_mono(fontrender_font* font, int mono)
+{
+  glyph_cache* old = font->entry->cache;
+  glyph_cache* cache;
+
+  if (old->mono == (mono != 0))
+    return 0;
+  cache = mono ? glyph_cache_new_mono(old->maxBytes) : glyph_cache_new(old->maxBytes);
+  if (cache == NULL)
+    return -1;
+  cache->stats = old->stats;
+  glyph_cache_free(old);
+  font->entry->cache = cache;
+  return 0;
+}
+
+void fontrender_set_stats(fontrender_font* font, render_stats* stats)
+{
+  font->stats = stats;
+  font->entry->cache->stats = stats;
+  font->entry->shapes->stats = stats;
+  if (font->fallback != NULL)
+    font_fallback_set_stats(font->fallback, stats);
+}
+
+/*
+ * Count the time since start as compositing, less the shaping and glyph
+ * rendering nested in it (nested is render_stats_nested_seconds() at
+ * start) and other seconds the caller timed itself.
+ */
+static void add_composite(render_stats* stats, double start, double nested, double other)
+{
+  double seconds = render_stats_now() - start;
+  seconds -= render_stats_nested_seconds(stats) - nested + other;
+  render_stats_add(stats, RENDER_STAGE_COMPOSITE, seconds);
+}
+
+void fontrender_set_word_shaping(fontrender_font* font, int wordShaping)
+{
+  font->entry->shapes->splitWords = wordShaping;
+}
+
+void fontrender_set_fallback(fontrender_font* font, font_fallback* fallback)
+{
+  font->fallback = fallback;
+  if (fallback == NULL)
+    return;
+  font_fallback_set_char_size(fallback, font->entry->charSize);
+  font_fallback_set_stats(fallback, font->stats);
+}
+
+unsigned int fontrender_glyph_index(fontrender_font* font, unsigned int codepoint)
+{
+  return FT_Get_Char_Index(font->entry->ftFace, codepoint);
+}
+
+int fontrender_measure(fontrender_font* font, const char* text, int textLen,
+                       int* outW, int* outH)
+{
+  font_entry* e = font->entry;
+  return measure_text(e->font, e->ftFace, font->buffer, e->shapes, e->cache,
+                      text, textLen, outW, outH);
+}
+
+/* strips copied into a caller's buffer, for fontrender_render() */
+typedef struct buffer_sink
+{
+  unsigned char* buffer;
+  int pitch;
+  int bufW;
+  int bufH;
+  int w;
+} buffer_sink;
+
+static int buffer_begin(void* user, int w, int h)
+{
+  ((buffer_sink*)user)->w = w;
+  return 0;
+}
+
+static int buffer_strip(void* user, const unsigned char* rows, int y, int n)
+{
+  buffer_sink* b = user;
+  int cols = b->w < b->bufW ? b->w : b->bufW;
+  int i;
+
+  for(i = 0; i < n && y + i < b->bufH; i++)
+    {
+      memcpy(b->buffer + (size_t)(y + i) * b->pitch, rows + (size_t)i * b->w, cols);
+    }
+  return 0;
+}
+
+int fontrender_render(fontrender_font* font, const char* text, int textLen,
+                      unsigned char* buffer, int pitch, int bufW, int bufH)
+{
+  font_entry* e = font->entry;
+  buffer_sink b = {buffer, pitch, bufW, bufH, 0};
+  text_strip_sink sink = {buffer_begin, buffer_strip, &b};
+  double start = 0, nested = 0;
+  int ret;
+
+  if (e->cache->mono)
+    {
+      fprintf(stderr, "ERROR: fontrender_render needs an 8-bit font\n");
+      return -1;
+    }
+  if (font->stats != NULL)
+    {
+      nested = render_stats_nested_seconds(font->stats);
+      start = render_stats_now();
+    }
+  /* strips of a bounded size, so the whole image is never allocated */
+  ret = render_text_strips(e->font, e->ftFace, font->buffer, e->shapes, e->cache,
+                           text, textLen, font->mode, font->verbose,
+                           FONTRENDER_STRIP_ROWS, &sink);
+  if (font->stats != NULL)
+    {
+      add_composite(font->stats, start, nested, 0);
+      font->stats->images++;
+    }
+  return ret;
+}
+
+int fontrender_encode_text(hb_font_t* font, FT_Face ftFace, hb_buffer_t* buffer,
+                           shape_cache* shapes, glyph_cache* cache,
+                           const char* text, int textLen, composite_mode mode,
+                           pixel_color color, const image_options* opt, int verbose,
+                           mem_buffer* out)
+{
+  render_stats* stats = shapes->stats;
+  double start = 0, nested = 0;
+  int w, h, stride;
+  unsigned char* img;
+  int ret;
+
+  if (stats != NULL)
+    {
+      nested = render_stats_nested_seconds(stats);
+      start = render_stats_now();
+    }
+  if (cache->mono)
+    img = render_text_mono(font, ftFace, buffer, shapes, cache, text, textLen, verbose,
+                           &w, &h, &stride);
+  else
+    img = render_text(font, ftFace, buffer, shapes, cache, text, textLen, mode, verbose,
+                      &w, &h);
+  if (img == NULL)
+    return -1;
+  if (stats != NULL)
+    {
+      add_composite(stats, start, nested, 0);
+      start = render_stats_now();
+    }
+
+  if (cache->mono)
+    ret = encode_image_mono(opt, img, stride, w, h, color, out);
+  else
+    ret = encode_image(opt, img, w, h, color, out);
+  if (stats != NULL)
+    {
+      render_stats_add(stats, RENDER_STAGE_ENCODE, render_stats_now() - start);
+      stats->images++;
+    }
+  free(img);
+  return ret;
+}
+
+int fontrender_encode_runs(hb_buffer_t* buffer, const text_run* runs, int runCount,
+                           const char* text, composite_mode mode, pixel_color color,
+                           const image_options* opt, int verbose, mem_buffer* out)
+{
+  render_stats* stats = runs[0].shapes->stats;
+  double start = 0, nested = 0;
+  int w, h;
+  unsigned char* img;
+  int ret;
+
+  if (stats != NULL)
+    {
+      nested = render_stats_nested_seconds(stats);
+      start = render_stats_now();
+    }
+  img = render_text_runs(buffer, runs, runCount, text, mode, verbose, &w, &h);
+  if (img == NULL)
+    return -1;
+  if (stats != NULL)
+    {
+      add_composite(stats, start, nested, 0);
+      start = render_stats_now();
+    }
+
+  ret = encode_image(opt, img, w, h, color, out);
+  if (stats != NULL)
+    {
+      render_stats_add(stats, RENDER_STAGE_ENCODE, render_stats_now() - start);
+      stats->images++;
+    }
+  free(img);
+  return ret;
+}
+
+int fontrender_encode(fontrender_font* font, const char* text, int textLen,
+                      const image_options* opt, mem_buffer* out)
+{
+  font_entry* e = font->entry;
+
+  if (font->fallback != NULL && !e->cache->mono)
+    {
+      text_run main = {e->font, e->ftFace, e->shapes, e->cache, 0, textLen};
+      const text_run* runs;
+      int runCount = font_fallback_split(font->fallback, &main, text, textLen, &runs);
+      if (runCount < 0)
+        return -1;
+      /* text the font has on its own takes the usual path */
+      if (runCount > 1 || runs[0].ftFace != e->ftFace)
+        return fontrender_encode_runs(font->buffer, runs, runCount, text, font->mode,
+                                      font->color, opt, font->verbose, out);
+    }
+  return fontrender_encode_text(e->font, e->ftFace, font->buffer, e->shapes, e->cache,
+                                text, textLen, font->mode, font->color, opt, font->verbose,
+                                out);
+}
+
+/* strips written through an image_stream, for fontrender_stream() */
+typedef struct file_sink
+{
+  image_stream stream;
+  const image_options* opt;
+  pixel_color color;
+  FILE* out;
+  /* time spent encoding, when stats is set */
+  render_stats* stats;
+  double encodeSeconds;
+} file_sink;
+
+static int file_begin(void* user, int w, int h)
+{
+  file_sink* f = user;
+  double start;
+  int ret;
+
+  if (f->stats == NULL)
+    return image_stream_begin(&f->stream, f->opt, w, h, f->color, f->out);
+  start = render_stats_now();
+  ret = image_stream_begin(&f->stream, f->opt, w, h, f->color, f->out);
+  f->encodeSeconds += render_stats_now() - start;
+  return ret;
+}
+
+static int file_strip(void* user, const unsigned char* rows, int y, int n)
+{
+  file_sink* f = user;
+  double start;
+  int ret;
+
+  if (f->stats == NULL)
+    return image_stream_write(&f->stream, rows, n);
+  start = render_stats_now();
+  ret = image_stream_write(&f->stream, rows, n);
+  f->encodeSeconds += render_stats_now() - start;
+  return ret;
+}
+
+int fontrender_stream(fontrender_font* font, const char* text, int textLen,
+                      const image_options* opt, int stripRows, FILE* out)
+{
+  font_entry* e = font->entry;
+  file_sink f;
+  text_strip_sink sink = {file_begin, file_strip, &f};
+  double start = 0, nested = 0;
+  int ret;
+
+  if (e->cache->mono)
+    {
+      fprintf(stderr, "ERROR: fontrender_stream needs an 8-bit font\n");
+      return -1;
+    }
+  /* begin is not called when shaping or layout runs out of memory */
+  memset(&f, 0, sizeof(f));
+  f.opt = opt;
+  f.color = font->color;
+  f.out = out;
+  f.stats = font->stats;
+  if (f.stats != NULL)
+    {
+      nested = render_stats_nested_seconds(f.stats);
+      start = render_stats_now();
+    }
+  ret = render_text_strips(e->font, e->ftFace, font->buffer, e->shapes, e->cache,
+                           text, textLen, font->mode, font->verbose, stripRows, &sink);
+  if (f.stats != NULL)
+    {
+      /* strips are encoded as they come, in between compositing */
+      add_composite(f.stats, start, nested, f.encodeSeconds);
+      start = render_stats_now();
+    }
+  if (image_stream_end(&f.stream) != 0)
+    ret = -1;
+  fflush(out);
+  if (f.stats != NULL)
+    {
+      render_stats_add(f.stats, RENDER_STAGE_ENCODE,
+                       f.encodeSeconds + render_stats_now() - start);
+      f.stats->bytesWritten += f.stream.bytes;
+      f.stats->images++;
+    }
+  return ret;
+}
+
+int fontrender_encode_bitmap(const FT_Bitmap* bitmap, pixel_color color,
+                             const image_options* opt, mem_buffer* out)
+{
+  int w = bitmap->width;
+  int h = bitmap->rows;
+  unsigned char* cov;
+  int ret;
+  int i;
+
+  if (bitmap->pitch == w)
+    {
+      return encode_image(opt, bitmap->buffer, w, h, color, out);
+    }
+  cov = malloc((size_t)w * h + 1);
+  if (cov == NULL)
+    {
+      return -1;
+    }
+  /* pitch may be padded or negative (bottom-up) */
+  for(i = 0; i < h; i++)
+    {
+      const unsigned char* src = bitmap->pitch >= 0
+        ? bitmap->buffer + i * bitmap->pitch
+        : bitmap->buffer + (h - 1 - i) * -bitmap->pitch;
+      memcpy(cov + (size_t)i * w, src, w);
+    }
+  ret = encode_image(opt, cov, w, h, color, out);
+  free(cov);
+  return ret;
+}
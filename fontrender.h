@@ -0,0 +1,164 @@
+/*
+ * In-process text rendering.
+ *
+ * A fontrender_font is an opened font with everything needed to render
+ * with it: the mmapped file, harfbuzz and FreeType faces, a shaping
+ * buffer and caches of shaped runs and glyph bitmaps. Open a font once
+ * and render any number of strings with it, into a caller's buffer or
+ * encoded into one of the image_writer formats.
+ *
+ * The color, mode and verbose fields may be set directly between calls.
+ * Timings of every stage can be collected with fontrender_set_stats().
+ * A font is not thread-safe; open one per thread.
+ *
+ * The lower level functions taking harfbuzz/FreeType objects and caches
+ * are for callers that set these up themselves (e.g. worker threads
+ * sharing one hb_face_t).
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef FONTRENDER_H
+#define FONTRENDER_H
+
+#include <stdio.h>
+#include <hb.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "font_pool.h"
+#include "text_render.h"
+#include "image_writer.h"
+#include "pixel_convert.h"
+#include "render_stats.h"
+#include "font_fallback.h"
+
+/* cache limits of a font opened with fontrender_open() */
+#define FONTRENDER_GLYPH_CACHE_BYTES (8 * 1024 * 1024)
+#define FONTRENDER_SHAPE_CACHE_BYTES (1024 * 1024)
+/* rows composited at a time by fontrender_render() */
+#define FONTRENDER_STRIP_ROWS 64
+
+typedef struct fontrender_font
+{
+  font_entry* entry;
+  hb_buffer_t* buffer;
+  /* fill color for encoding, black by default */
+  pixel_color color;
+  /* how overlapping glyphs combine, COMPOSITE_MAX by default */
+  composite_mode mode;
+  /* shaping and layout details on stderr, every glyph too when > 1 */
+  int verbose;
+  /* set with fontrender_set_stats() */
+  render_stats* stats;
+  /* set with fontrender_set_fallback() */
+  font_fallback* fallback;
+} fontrender_font;
+
+/*
+ * Open the font file at path. The size is unset; call
+ * fontrender_set_pixel_size() or fontrender_set_char_size() before
+ * rendering. Returns NULL when the font cannot be opened.
+ */
+fontrender_font* fontrender_open(const char* path);
+/*
+ * fontrender_open() with the face on lib, e.g. one of
+ * ft_arena_new_library(), instead of harfbuzz's FreeType library; see
+ * font_entry_open_face(). lib must outlive the font.
+ */
+fontrender_font* fontrender_open_library(FT_Library lib, const char* path);
+void fontrender_close(fontrender_font* font);
+
+void fontrender_set_pixel_size(fontrender_font* font, int pixelSize);
+/* size in 26.6 pixels */
+void fontrender_set_char_size(fontrender_font* font, FT_F26Dot6 charSize);
+
+/*
+ * Switch to 1-bit glyphs (see glyph_cache_new_mono()) or back. The glyph
+ * cache is emptied. Returns -1 when out of memory.
+ */
+int fontrender_set_mono(fontrender_font* font, int mono);
+
+/*
+ * Time every stage of rendering into stats, or stop with NULL. Images
+ * written by fontrender_stream() count towards stats->bytesWritten;
+ * callers writing fontrender_encode() results add those themselves.
+ */
+void fontrender_set_stats(fontrender_font* font, render_stats* stats);
+
+/* shape and cache a word at a time, see shape_cache_shape_words() */
+void fontrender_set_word_shaping(fontrender_font* font, int wordShaping);
+
+/*
+ * Render characters the font lacks with faces from fallback, or stop
+ * with NULL. fallback stays the caller's and gets the font's size and
+ * stats. Only fontrender_encode() of an 8-bit font falls back; the
+ * other functions render with the font alone.
+ */
+void fontrender_set_fallback(fontrender_font* font, font_fallback* fallback);
+
+/* glyph index of a code point, 0 when the font has no glyph for it */
+unsigned int fontrender_glyph_index(fontrender_font* font, unsigned int codepoint);
+
+/* size of the coverage image of a UTF-8 string. Returns -1 when out of memory */
+int fontrender_measure(fontrender_font* font, const char* text, int textLen,
+                       int* outW, int* outH);
+
+/*
+ * Render a UTF-8 string as 8-bit coverage into buffer (pitch bytes per
+ * row), with the top-left corner of the image at the top-left of the
+ * buffer. Rows and columns beyond bufW * bufH are dropped and the
+ * buffer outside the image is left alone; fontrender_measure() tells
+ * the size needed. No image sized memory is allocated. Not for mono
+ * fonts. Returns -1 when out of memory.
+ */
+int fontrender_render(fontrender_font* font, const char* text, int textLen,
+                      unsigned char* buffer, int pitch, int bufW, int bufH);
+
+/*
+ * Render a UTF-8 string and encode it into out with opt, replacing its
+ * contents. Mono fonts give 1-bit images (see encode_image_mono()).
+ * Returns -1 when out of memory.
+ */
+int fontrender_encode(fontrender_font* font, const char* text, int textLen,
+                      const image_options* opt, mem_buffer* out);
+
+/*
+ * Render a UTF-8 string and write it encoded to out stripRows rows at a
+ * time (see render_text_strips()). Not for mono fonts. Returns -1 when
+ * out of memory or writing fails.
+ */
+int fontrender_stream(fontrender_font* font, const char* text, int textLen,
+                      const image_options* opt, int stripRows, FILE* out);
+
+/*
+ * fontrender_encode() for caller-owned objects; see render_text(). When
+ * shapes->stats is set, compositing and encoding are timed into it too.
+ */
+int fontrender_encode_text(hb_font_t* font, FT_Face ftFace, hb_buffer_t* buffer,
+                           shape_cache* shapes, glyph_cache* cache,
+                           const char* text, int textLen, composite_mode mode,
+                           pixel_color color, const image_options* opt, int verbose,
+                           mem_buffer* out);
+
+/*
+ * fontrender_encode_text() for text split into runs by font, see
+ * render_text_runs(). Stats are taken from the shape cache of the first
+ * run.
+ */
+int fontrender_encode_runs(hb_buffer_t* buffer, const text_run* runs, int runCount,
+                           const char* text, composite_mode mode, pixel_color color,
+                           const image_options* opt, int verbose, mem_buffer* out);
+
+/*
+ * Encode a FreeType 8-bit gray bitmap (e.g. a rendered glyph slot) drawn
+ * in color into out. Returns -1 when out of memory.
+ */
+int fontrender_encode_bitmap(const FT_Bitmap* bitmap, pixel_color color,
+                             const image_options* opt, mem_buffer* out);
+
+#endif
@@ -0,0 +1,391 @@
+/*
+ * Bakes glyph atlases ahead of time.
+ *
+ * Usage:
+ * fontrender_bake [-p pageSize] [-n maxPages] [-i imagePrefix [-f format]]
+ *                 fontPath charset.txt sizes out.fab
+ *
+ * Every character of charset.txt (UTF-8; line breaks and other control
+ * characters are skipped) is rendered at every pixel size of sizes, a
+ * comma separated list like 16,24,32, and packed into atlas pages the
+ * way glyph_atlas packs them at run time. The pages and the glyph
+ * metrics are written to out.fab (see baked_atlas.h), which
+ * ft2_char_gl -b maps at startup instead of rasterizing. Characters the
+ * font lacks are counted and left out.
+ *
+ * -p and -n give the page size (1024 by default, which ft2_char_gl
+ * needs) and the most pages to fill. -i also writes every page as an
+ * image, imagePrefixN.png (or the extension of the -f format), to look
+ * at.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_ADVANCES_H
+
+#include "glyph_atlas.h"
+#include "baked_atlas.h"
+#include "image_writer.h"
+#include "text_render.h"
+#include "font_file.h"
+
+#define DEFAULT_PAGE_SIZE 1024
+#define DEFAULT_MAX_PAGES 64
+#define MAX_SIZES 64
+
+typedef unsigned int uint;
+
+void print_usage()
+{
+  fprintf(stderr, "USAGE: fontrender_bake [-p pageSize] [-n maxPages] [-i imagePrefix [-f format]]\n");
+  fprintf(stderr, "                       fontPath charset.txt sizes out.fab\n");
+  fprintf(stderr, "  -p pageSize   atlas page width and height (default %d)\n", DEFAULT_PAGE_SIZE);
+  fprintf(stderr, "  -n maxPages   most pages to fill (default %d)\n", DEFAULT_MAX_PAGES);
+  fprintf(stderr, "  -i prefix     also write every page as an image\n");
+  fprintf(stderr, "  -f format     format of the page images:\n");
+  fputs(IMAGE_OPTIONS_HELP, stderr);
+  fprintf(stderr, "  sizes         comma separated pixel sizes, e.g. 16,24,32\n");
+}
+
+int compare_uint(const void* a, const void* b)
+{
+  uint x = *(const uint*)a;
+  uint y = *(const uint*)b;
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * Read the distinct characters of a UTF-8 file, sorted. Returns the
+ * number of characters, or -1 on failure.
+ */
+int read_charset(const char* path, uint** outChars)
+{
+  FILE* f = fopen(path, "rb");
+  char* text = NULL;
+  uint* chars = NULL;
+  long len = 0;
+  int count = 0;
+  long pos = 0;
+  int i, j;
+
+  if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0
+      || fseek(f, 0, SEEK_SET) != 0)
+    {
+      fprintf(stderr, "ERROR: cannot read charset %s\n", path);
+      if (f != NULL)
+        fclose(f);
+      return -1;
+    }
+  text = malloc(len + 1);
+  chars = malloc(sizeof(uint) * (len + 1));
+  if (text == NULL || chars == NULL || fread(text, 1, len, f) != (size_t)len)
+    {
+      fprintf(stderr, "ERROR: cannot read charset %s\n", path);
+      fclose(f);
+      free(text);
+      free(chars);
+      return -1;
+    }
+  fclose(f);
+
+  while(pos < len)
+    {
+      unsigned char lead = text[pos];
+      int charLen = lead < 0x80 ? 1 : lead < 0xe0 ? 2 : lead < 0xf0 ? 3 : 4;
+      uint c = first_utf8_char(text + pos, len - pos);
+
+      if (c == 0)
+        {
+          fprintf(stderr, "WARNING: malformed UTF-8 at byte %ld of the charset\n", pos);
+          charLen = 1;
+        }
+      else if (c >= 0x20 && c != 0x7f && c != 0xfeff)
+        {
+          chars[count++] = c;
+        }
+      pos += charLen;
+    }
+  free(text);
+
+  qsort(chars, count, sizeof(uint), compare_uint);
+  for(i = 0, j = 0; i < count; i++)
+    {
+      if (j == 0 || chars[j - 1] != chars[i])
+        chars[j++] = chars[i];
+    }
+  *outChars = chars;
+  return j;
+}
+
+/* parse "16,24,32" into sorted pixel sizes; returns the count or -1 */
+int parse_sizes(const char* spec, int* sizes)
+{
+  int count = 0;
+  const char* p = spec;
+
+  while(*p != '\0')
+    {
+      char* end;
+      long size = strtol(p, &end, 10);
+      if (end == p || size <= 0 || size > 4096 || count == MAX_SIZES
+          || (*end != ',' && *end != '\0'))
+        {
+          fprintf(stderr, "ERROR: sizes should look like 16,24,32\n");
+          return -1;
+        }
+      sizes[count++] = size;
+      p = *end == ',' ? end + 1 : end;
+    }
+  qsort(sizes, count, sizeof(int), compare_uint);
+  return count;
+}
+
+/* write the pages as images named prefixN.ext */
+int write_page_images(glyph_atlas* atlas, const char* prefix, const image_options* opt)
+{
+  pixel_color black = {0, 0, 0};
+  mem_buffer mb = {NULL, 0, 0};
+  int i;
+
+  for(i = 0; i < atlas->pageCount; i++)
+    {
+      char path[4096];
+      FILE* f;
+
+      snprintf(path, sizeof(path), "%s%d.%s", prefix, i, image_format_extension(opt->format));
+      if (encode_image(opt, atlas->pages[i].pixels, atlas->pageSize, atlas->pageSize,
+                       black, &mb) != 0)
+        {
+          fprintf(stderr, "ERROR: out of memory\n");
+          free(mb.data);
+          return -1;
+        }
+      f = fopen(path, "wb");
+      if (f == NULL || fwrite(mb.data, 1, mb.len, f) != mb.len)
+        {
+          fprintf(stderr, "ERROR: cannot write %s\n", path);
+          if (f != NULL)
+            fclose(f);
+          free(mb.data);
+          return -1;
+        }
+      fclose(f);
+    }
+  free(mb.data);
+  return 0;
+}
+
+int write_baked(const char* path, FT_Face face, glyph_atlas* atlas,
+                const baked_atlas_size* sizes, int sizeCount,
+                const baked_atlas_glyph* glyphs, int glyphCount)
+{
+  baked_atlas_header h;
+  static const unsigned char zeros[BAKED_ATLAS_PIXEL_ALIGN];
+  size_t tmpLen = strlen(path) + 5;
+  char* tmpPath = malloc(tmpLen);
+  size_t pageBytes = (size_t)atlas->pageSize * atlas->pageSize;
+  size_t pad;
+  FILE* f;
+  int ok;
+  int i;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, BAKED_ATLAS_MAGIC, 4);
+  h.version = BAKED_ATLAS_VERSION;
+  h.fontGlyphs = face->num_glyphs;
+  h.pageSize = atlas->pageSize;
+  h.pageCount = atlas->pageCount;
+  h.sizeCount = sizeCount;
+  h.glyphCount = glyphCount;
+  h.sizesOffset = sizeof(h);
+  h.glyphsOffset = h.sizesOffset + sizeof(baked_atlas_size) * sizeCount;
+  h.pixelsOffset = h.glyphsOffset + sizeof(baked_atlas_glyph) * glyphCount;
+  pad = (BAKED_ATLAS_PIXEL_ALIGN - h.pixelsOffset % BAKED_ATLAS_PIXEL_ALIGN)
+    % BAKED_ATLAS_PIXEL_ALIGN;
+  h.pixelsOffset += pad;
+
+  if (tmpPath == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return -1;
+    }
+  /* written next to the target and renamed, so readers never see half a file */
+  snprintf(tmpPath, tmpLen, "%s.tmp", path);
+  f = fopen(tmpPath, "wb");
+  if (f == NULL)
+    {
+      fprintf(stderr, "ERROR: cannot open %s\n", tmpPath);
+      free(tmpPath);
+      return -1;
+    }
+  ok = fwrite(&h, sizeof(h), 1, f) == 1
+    && fwrite(sizes, sizeof(baked_atlas_size), sizeCount, f) == (size_t)sizeCount
+    && fwrite(glyphs, sizeof(baked_atlas_glyph), glyphCount, f) == (size_t)glyphCount
+    && fwrite(zeros, 1, pad, f) == pad;
+  for(i = 0; i < atlas->pageCount && ok; i++)
+    {
+      ok = fwrite(atlas->pages[i].pixels, 1, pageBytes, f) == pageBytes;
+    }
+  if (fclose(f) != 0 || !ok || rename(tmpPath, path) != 0)
+    {
+      fprintf(stderr, "ERROR: cannot write %s\n", path);
+      remove(tmpPath);
+      free(tmpPath);
+      return -1;
+    }
+  free(tmpPath);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  int pageSize = DEFAULT_PAGE_SIZE;
+  int maxPages = DEFAULT_MAX_PAGES;
+  const char* imagePrefix = NULL;
+  image_options imageOptions = IMAGE_OPTIONS_DEFAULT;
+  int sizes[MAX_SIZES];
+  int sizeCount;
+  uint* chars;
+  int charCount;
+  FT_Library lib;
+  FT_Face face;
+  glyph_atlas* atlas;
+  baked_atlas_size* bakedSizes;
+  baked_atlas_glyph* glyphs;
+  int glyphCount = 0;
+  unsigned long missing = 0;
+  int ret = 0;
+  int argi, i, j;
+
+  for(argi = 1; argi + 1 < argc && argv[argi][0] == '-'; argi += 2)
+    {
+      if (strcmp(argv[argi], "-p") == 0)
+        pageSize = atoi(argv[argi + 1]);
+      else if (strcmp(argv[argi], "-n") == 0)
+        maxPages = atoi(argv[argi + 1]);
+      else if (strcmp(argv[argi], "-i") == 0)
+        imagePrefix = argv[argi + 1];
+      else if (strcmp(argv[argi], "-f") == 0)
+        {
+          if (image_options_parse(argv[argi + 1], &imageOptions) != 0)
+            return -1;
+        }
+      else
+        break;
+    }
+  if (argc - argi != 4)
+    {
+      print_usage();
+      return 0;
+    }
+  if (pageSize <= 2 || pageSize > 65535)
+    {
+      fprintf(stderr, "ERROR: page size should be between 3 and 65535\n");
+      return -1;
+    }
+  sizeCount = parse_sizes(argv[argi + 2], sizes);
+  if (sizeCount < 0)
+    return -1;
+  charCount = read_charset(argv[argi + 1], &chars);
+  if (charCount < 0)
+    return -1;
+
+  if (FT_Init_FreeType(&lib))
+    {
+      fprintf(stderr, "ERROR: init library\n");
+      free(chars);
+      return -1;
+    }
+  if (font_file_new_face(lib, argv[argi], 0, &face))
+    {
+      fprintf(stderr, "ERROR: when loading font\n");
+      FT_Done_FreeType(lib);
+      free(chars);
+      return -1;
+    }
+  atlas = glyph_atlas_new_offline(pageSize, maxPages);
+  bakedSizes = calloc(sizeCount, sizeof(baked_atlas_size));
+  glyphs = calloc((size_t)sizeCount * (charCount > 0 ? charCount : 1), sizeof(baked_atlas_glyph));
+  if (atlas == NULL || bakedSizes == NULL || glyphs == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      ret = -1;
+    }
+
+  /* the entries of an offline atlas stay valid, so they are copied at the end */
+  for(i = 0; i < sizeCount && ret == 0; i++)
+    {
+      baked_atlas_size* s = &bakedSizes[i];
+
+      FT_Set_Pixel_Sizes(face, 0, sizes[i]);
+      s->pixelSize = sizes[i];
+      s->firstGlyph = glyphCount;
+      s->ascender = face->size->metrics.ascender;
+      s->descender = face->size->metrics.descender;
+      s->height = face->size->metrics.height;
+      for(j = 0; j < charCount; j++)
+        {
+          uint glyphIndex = FT_Get_Char_Index(face, chars[j]);
+          baked_atlas_glyph* g = &glyphs[glyphCount];
+          const glyph_atlas_entry* e;
+          FT_Fixed advance = 0;
+
+          if (glyphIndex == 0)
+            {
+              missing++;
+              continue;
+            }
+          e = glyph_atlas_get(atlas, face, glyphIndex);
+          if (e == NULL)
+            {
+              fprintf(stderr, "ERROR: U+%04X at %d pixels does not fit; use more or larger pages\n",
+                      chars[j], sizes[i]);
+              ret = -1;
+              break;
+            }
+          /* scaled advances are 16.16 pixels */
+          FT_Get_Advance(face, glyphIndex, FT_LOAD_NO_HINTING, &advance);
+          g->codepoint = chars[j];
+          g->glyphIndex = glyphIndex;
+          g->advance = advance >> 10;
+          g->left = e->left;
+          g->top = e->top;
+          g->width = e->width;
+          g->rows = e->rows;
+          g->page = e->page;
+          g->x = e->x;
+          g->y = e->y;
+          g->u0 = e->u0;
+          g->v0 = e->v0;
+          g->u1 = e->u1;
+          g->v1 = e->v1;
+          glyphCount++;
+        }
+      s->glyphCount = glyphCount - s->firstGlyph;
+    }
+
+  if (ret == 0)
+    ret = write_baked(argv[argi + 3], face, atlas, bakedSizes, sizeCount, glyphs, glyphCount);
+  if (ret == 0 && imagePrefix != NULL)
+    ret = write_page_images(atlas, imagePrefix, &imageOptions);
+  if (ret == 0)
+    fprintf(stderr, "%d characters, %d sizes: %d glyphs on %d pages, %lu missing from the font.\n",
+            charCount, sizeCount, glyphCount, atlas->pageCount, missing);
+
+  glyph_atlas_free(atlas);
+  free(bakedSizes);
+  free(glyphs);
+  free(chars);
+  FT_Done_Face(face);
+  FT_Done_FreeType(lib);
+  return ret;
+}
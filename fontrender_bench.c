@@ -0,0 +1,725 @@
+/*
+ * Per-stage benchmark of the rendering pipeline.
+ *
+ * Usage:
+ * fontrender_bench [-n iterations] [-p pixelSize] [-f format] [-c corpus.txt]...
+ *                  fontPath... > results.json
+ *
+ * Every font is measured with every corpus (a text file, one string per
+ * line, or a built-in sample when no -c is given). Each stage is timed
+ * on its own, over the whole corpus, iterations times:
+ *
+ * face_load_ft    FT_New_Face() and FT_Done_Face() on the file path
+ * face_load_mmap  mmap, hb_blob_create(), hb_face_create() and
+ *                 FT_New_Memory_Face() on the mapping, as font_pool does
+ * shape           hb_shape() of every line, without the shape cache
+ * glyph_load      FT_Load_Glyph() of every distinct glyph of the corpus
+ * glyph_render    the same glyphs rasterized into an emptied glyph_cache
+ * composite       render_text() with warm shape and glyph caches, so
+ *                 cache lookups, layout and blending
+ * convert         convert_coverage_rgba() of every rendered line
+ * encode          encode_image() of every rendered line, in the -f format
+ * encode_cairo    convert_coverage_argb32() and
+ *                 cairo_surface_write_to_png_stream() of every line
+ *
+ * Results are written to stdout as JSON. For every font, corpus and
+ * stage they give the operations timed, ns per operation, glyphs per
+ * second, MB per second and allocations per operation. The MB/s figure
+ * counts the font file for the face loads, the UTF-8 text for shaping
+ * and coverage pixels (one byte each) for the later stages. FreeType
+ * allocates from an ft_arena and the allocations are read from its
+ * counters. Memory allocated by harfbuzz, libpng or cairo is not
+ * counted.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <hb.h>
+#include <hb-ot.h>
+#include <cairo.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "font_pool.h"
+#include "glyph_cache.h"
+#include "shape_cache.h"
+#include "text_render.h"
+#include "pixel_convert.h"
+#include "image_writer.h"
+#include "ft_arena.h"
+
+typedef unsigned char uchar;
+typedef unsigned int uint;
+
+/* glyph cache of the composite stage; large enough to never evict */
+#define BENCH_GLYPH_CACHE_BYTES (64 * 1024 * 1024)
+#define BENCH_SHAPE_CACHE_BYTES (16 * 1024 * 1024)
+
+static const char builtinCorpus[] =
+  "The quick brown fox jumps over the lazy dog.\n"
+  "Pack my box with five dozen liquor jugs!\n"
+  "0123456789 +-*/=%()[]{}<>.,:;'\"\n"
+  "Sphinx of black quartz, judge my vow.\n"
+  "AV To Wa fi ffl office waffle\n";
+
+typedef struct bench_corpus
+{
+  const char* name;
+  char* data;
+  size_t bytes;
+  const char** lines;
+  int* lineLens;
+  int lineCount;
+} bench_corpus;
+
+/* a font opened the way the harfbuzz-ft2 worker threads do */
+typedef struct bench_font
+{
+  const char* path;
+  uchar* data;
+  int dataSize;
+  hb_blob_t* blob;
+  hb_face_t* face;
+  hb_font_t* font;
+  FT_Face ftFace;
+} bench_font;
+
+/* shaped and rendered corpus, input of the later stages */
+typedef struct bench_prepared
+{
+  uint* glyphs; /* distinct glyph indices */
+  int glyphCount;
+  unsigned long shapedGlyphs; /* glyphs of all lines, counting repeats */
+  uchar** images;
+  int* widths;
+  int* heights;
+  size_t pixels;
+  size_t maxPixels;
+} bench_prepared;
+
+typedef struct bench_result
+{
+  unsigned long ops;
+  unsigned long glyphs;
+  double bytes;
+  double seconds;
+  unsigned long allocs;
+} bench_result;
+
+/* FreeType of the whole run; its counters give the allocations */
+ft_arena* arena = NULL;
+FT_Library lib = NULL;
+
+int iterations = 10;
+int pixelSize = 32;
+image_options imageOptions = IMAGE_OPTIONS_DEFAULT;
+const char* formatSpec = "png";
+/* a comma is needed before every result but the first */
+int resultCount = 0;
+
+double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* start timing a stage */
+void bench_start(bench_result* r)
+{
+  memset(r, 0, sizeof(bench_result));
+  r->allocs = arena->allocs;
+  r->seconds = now_seconds();
+}
+
+void bench_stop(bench_result* r)
+{
+  r->seconds = now_seconds() - r->seconds;
+  r->allocs = arena->allocs - r->allocs;
+}
+
+void print_json_string(const char* s)
+{
+  putchar('"');
+  for(; *s != '\0'; s++)
+    {
+      if (*s == '"' || *s == '\\')
+        printf("\\%c", *s);
+      else if ((uchar)*s < 0x20)
+        printf("\\u%04x", (uchar)*s);
+      else
+        putchar(*s);
+    }
+  putchar('"');
+}
+
+void print_result(const bench_font* font, const bench_corpus* corpus,
+                  const char* stage, const bench_result* r)
+{
+  double ops = r->ops > 0 ? r->ops : 1;
+  double seconds = r->seconds > 0 ? r->seconds : 1e-9;
+
+  printf("%s\n    {\"font\": ", resultCount++ > 0 ? "," : "");
+  print_json_string(font->path);
+  printf(", \"corpus\": ");
+  print_json_string(corpus->name);
+  printf(", \"stage\": \"%s\", \"ops\": %lu, \"ns_per_op\": %.1f, "
+         "\"glyphs_per_s\": %.0f, \"mb_per_s\": %.3f, \"allocs_per_op\": %.2f}",
+         stage, r->ops, seconds * 1e9 / ops, r->glyphs / seconds,
+         r->bytes / (1024.0 * 1024.0) / seconds, r->allocs / ops);
+  fprintf(stderr, "%-16s %12.1f ns/op\n", stage, seconds * 1e9 / ops);
+}
+
+/* split data into lines, in place; empty lines are dropped */
+int corpus_split(bench_corpus* corpus)
+{
+  size_t start = 0;
+  size_t i;
+
+  corpus->lines = malloc(sizeof(const char*) * (corpus->bytes + 1));
+  corpus->lineLens = malloc(sizeof(int) * (corpus->bytes + 1));
+  if (corpus->lines == NULL || corpus->lineLens == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return -1;
+    }
+  for(i = 0; i <= corpus->bytes; i++)
+    {
+      if (i == corpus->bytes || corpus->data[i] == '\n')
+        {
+          size_t end = i;
+          if (end > start && corpus->data[end - 1] == '\r')
+            end--;
+          if (end > start)
+            {
+              corpus->lines[corpus->lineCount] = &corpus->data[start];
+              corpus->lineLens[corpus->lineCount] = end - start;
+              corpus->lineCount++;
+            }
+          start = i + 1;
+        }
+    }
+  return 0;
+}
+
+int corpus_load(bench_corpus* corpus, const char* path)
+{
+  FILE* f;
+  long size;
+
+  memset(corpus, 0, sizeof(bench_corpus));
+  corpus->name = path;
+  if (path == NULL)
+    {
+      corpus->name = "builtin";
+      corpus->bytes = sizeof(builtinCorpus) - 1;
+      corpus->data = malloc(corpus->bytes);
+      if (corpus->data == NULL)
+        {
+          fprintf(stderr, "ERROR: out of memory\n");
+          return -1;
+        }
+      memcpy(corpus->data, builtinCorpus, corpus->bytes);
+      return corpus_split(corpus);
+    }
+
+  f = fopen(path, "rb");
+  if (f == NULL)
+    {
+      fprintf(stderr, "ERROR: cannot open corpus %s\n", path);
+      return -1;
+    }
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  corpus->data = malloc(size > 0 ? size : 1);
+  if (corpus->data == NULL || size < 0
+      || fread(corpus->data, 1, size, f) != (size_t)size)
+    {
+      fprintf(stderr, "ERROR: cannot read corpus %s\n", path);
+      fclose(f);
+      return -1;
+    }
+  fclose(f);
+  corpus->bytes = size;
+  return corpus_split(corpus);
+}
+
+void corpus_free(bench_corpus* corpus)
+{
+  free(corpus->data);
+  free(corpus->lines);
+  free(corpus->lineLens);
+}
+
+int font_open(bench_font* font, const char* path)
+{
+  FT_F26Dot6 scale = (FT_F26Dot6)pixelSize * 64;
+
+  memset(font, 0, sizeof(bench_font));
+  font->path = path;
+  font->data = font_file_map(path, &font->dataSize);
+  if (font->data == NULL)
+    {
+      fprintf(stderr, "ERROR: cannot read font file %s\n", path);
+      return -1;
+    }
+  if (FT_New_Memory_Face(lib, font->data, font->dataSize, 0, &font->ftFace))
+    {
+      fprintf(stderr, "ERROR: when loading font %s\n", path);
+      font_file_unmap(font->data, font->dataSize);
+      return -1;
+    }
+  FT_Set_Char_Size(font->ftFace, scale, scale, 0, 0);
+  font->blob = hb_blob_create((const char*)font->data, font->dataSize,
+                              HB_MEMORY_MODE_READONLY, NULL, NULL);
+  font->face = hb_face_create(font->blob, 0);
+  font->font = hb_font_create(font->face);
+  hb_font_set_scale(font->font, scale, scale);
+  hb_ot_font_set_funcs(font->font);
+  return 0;
+}
+
+void font_close(bench_font* font)
+{
+  hb_font_destroy(font->font);
+  hb_face_destroy(font->face);
+  hb_blob_destroy(font->blob);
+  FT_Done_Face(font->ftFace);
+  font_file_unmap(font->data, font->dataSize);
+}
+
+void prepared_free(bench_prepared* p, int lineCount)
+{
+  int i;
+  for(i = 0; i < lineCount && p->images != NULL; i++)
+    {
+      free(p->images[i]);
+    }
+  free(p->images);
+  free(p->widths);
+  free(p->heights);
+  free(p->glyphs);
+}
+
+int compare_uint(const void* a, const void* b)
+{
+  uint x = *(const uint*)a;
+  uint y = *(const uint*)b;
+  return x < y ? -1 : (x > y);
+}
+
+/*
+ * Shape every line to collect the distinct glyphs, and render every line
+ * for the pixel stages.
+ */
+int prepare(bench_font* font, const bench_corpus* corpus, hb_buffer_t* buffer,
+            shape_cache* shapes, glyph_cache* cache, bench_prepared* p)
+{
+  int cap = 256;
+  int i, j;
+
+  memset(p, 0, sizeof(bench_prepared));
+  p->glyphs = malloc(sizeof(uint) * cap);
+  p->images = calloc(corpus->lineCount + 1, sizeof(uchar*));
+  p->widths = calloc(corpus->lineCount + 1, sizeof(int));
+  p->heights = calloc(corpus->lineCount + 1, sizeof(int));
+  if (p->glyphs == NULL || p->images == NULL || p->widths == NULL || p->heights == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return -1;
+    }
+
+  for(i = 0; i < corpus->lineCount; i++)
+    {
+      hb_glyph_info_t* info;
+      uint len;
+
+      hb_buffer_reset(buffer);
+      hb_buffer_add_utf8(buffer, corpus->lines[i], corpus->lineLens[i], 0, corpus->lineLens[i]);
+      hb_buffer_guess_segment_properties(buffer);
+      hb_shape(font->font, buffer, NULL, 0);
+      info = hb_buffer_get_glyph_infos(buffer, &len);
+      p->shapedGlyphs += len;
+      for(j = 0; j < (int)len; j++)
+        {
+          if (p->glyphCount == cap)
+            {
+              uint* newGlyphs = realloc(p->glyphs, sizeof(uint) * cap * 2);
+              if (newGlyphs == NULL)
+                {
+                  fprintf(stderr, "ERROR: out of memory\n");
+                  return -1;
+                }
+              p->glyphs = newGlyphs;
+              cap *= 2;
+            }
+          p->glyphs[p->glyphCount++] = info[j].codepoint;
+        }
+
+      p->images[i] = render_text(font->font, font->ftFace, buffer, shapes, cache,
+                                 corpus->lines[i], corpus->lineLens[i], COMPOSITE_MAX,
+                                 0, &p->widths[i], &p->heights[i]);
+      if (p->images[i] == NULL)
+        {
+          fprintf(stderr, "ERROR: out of memory\n");
+          return -1;
+        }
+      p->pixels += (size_t)p->widths[i] * p->heights[i];
+      if ((size_t)p->widths[i] * p->heights[i] > p->maxPixels)
+        p->maxPixels = (size_t)p->widths[i] * p->heights[i];
+    }
+
+  /* keep each glyph once */
+  qsort(p->glyphs, p->glyphCount, sizeof(uint), compare_uint);
+  for(i = 0, j = 0; i < p->glyphCount; i++)
+    {
+      if (j == 0 || p->glyphs[j - 1] != p->glyphs[i])
+        p->glyphs[j++] = p->glyphs[i];
+    }
+  p->glyphCount = j;
+  return 0;
+}
+
+void bench_face_load(bench_font* font, bench_corpus* corpus)
+{
+  bench_result r;
+  int i;
+
+  bench_start(&r);
+  for(i = 0; i < iterations; i++)
+    {
+      FT_Face face;
+      if (FT_New_Face(lib, font->path, 0, &face) == 0)
+        FT_Done_Face(face);
+      r.ops++;
+      r.bytes += font->dataSize;
+    }
+  bench_stop(&r);
+  print_result(font, corpus, "face_load_ft", &r);
+
+  bench_start(&r);
+  for(i = 0; i < iterations; i++)
+    {
+      int size;
+      uchar* data = font_file_map(font->path, &size);
+      hb_blob_t* blob;
+      hb_face_t* face;
+      FT_Face ftFace;
+
+      if (data == NULL)
+        continue;
+      blob = hb_blob_create((const char*)data, size, HB_MEMORY_MODE_READONLY, NULL, NULL);
+      face = hb_face_create(blob, 0);
+      hb_face_get_upem(face);
+      if (FT_New_Memory_Face(lib, data, size, 0, &ftFace) == 0)
+        FT_Done_Face(ftFace);
+      hb_face_destroy(face);
+      hb_blob_destroy(blob);
+      font_file_unmap(data, size);
+      r.ops++;
+      r.bytes += size;
+    }
+  bench_stop(&r);
+  print_result(font, corpus, "face_load_mmap", &r);
+}
+
+void bench_shape(bench_font* font, bench_corpus* corpus, hb_buffer_t* buffer)
+{
+  bench_result r;
+  int i, j;
+
+  bench_start(&r);
+  for(i = 0; i < iterations; i++)
+    {
+      for(j = 0; j < corpus->lineCount; j++)
+        {
+          hb_buffer_reset(buffer);
+          hb_buffer_add_utf8(buffer, corpus->lines[j], corpus->lineLens[j], 0, corpus->lineLens[j]);
+          hb_buffer_guess_segment_properties(buffer);
+          hb_shape(font->font, buffer, NULL, 0);
+          r.ops++;
+          r.glyphs += hb_buffer_get_length(buffer);
+          r.bytes += corpus->lineLens[j];
+        }
+    }
+  bench_stop(&r);
+  print_result(font, corpus, "shape", &r);
+}
+
+void bench_glyphs(bench_font* font, bench_corpus* corpus, const bench_prepared* p)
+{
+  bench_result r;
+  glyph_cache* cache;
+  int i, j;
+
+  bench_start(&r);
+  for(i = 0; i < iterations; i++)
+    {
+      for(j = 0; j < p->glyphCount; j++)
+        {
+          FT_Load_Glyph(font->ftFace, p->glyphs[j], FT_LOAD_DEFAULT);
+          r.ops++;
+          r.glyphs++;
+        }
+    }
+  bench_stop(&r);
+  print_result(font, corpus, "glyph_load", &r);
+
+  bench_start(&r);
+  for(i = 0; i < iterations; i++)
+    {
+      const glyph_cache_entry* e;
+
+      /* a fresh cache, so every glyph is loaded and rasterized */
+      cache = glyph_cache_new(BENCH_GLYPH_CACHE_BYTES);
+      if (cache == NULL)
+        {
+          fprintf(stderr, "ERROR: out of memory\n");
+          break;
+        }
+      for(j = 0; j < p->glyphCount; j++)
+        {
+          e = glyph_cache_get(cache, font->ftFace, p->glyphs[j], 0);
+          r.ops++;
+          r.glyphs++;
+          if (e != NULL)
+            r.bytes += (double)e->width * e->rows;
+        }
+      glyph_cache_free(cache);
+    }
+  bench_stop(&r);
+  print_result(font, corpus, "glyph_render", &r);
+}
+
+void bench_composite(bench_font* font, bench_corpus* corpus, hb_buffer_t* buffer,
+                     shape_cache* shapes, glyph_cache* cache, const bench_prepared* p)
+{
+  bench_result r;
+  int i, j;
+
+  bench_start(&r);
+  for(i = 0; i < iterations; i++)
+    {
+      for(j = 0; j < corpus->lineCount; j++)
+        {
+          int w, h;
+          uchar* cov = render_text(font->font, font->ftFace, buffer, shapes, cache,
+                                   corpus->lines[j], corpus->lineLens[j], COMPOSITE_MAX,
+                                   0, &w, &h);
+          free(cov);
+          r.ops++;
+          r.bytes += (double)w * h;
+        }
+      r.glyphs += p->shapedGlyphs;
+    }
+  bench_stop(&r);
+  print_result(font, corpus, "composite", &r);
+}
+
+cairo_status_t count_writer(void* closure, const uchar* data, uint length)
+{
+  *(size_t*)closure += length;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+void bench_pixels(bench_font* font, bench_corpus* corpus, const bench_prepared* p)
+{
+  bench_result r;
+  uchar* scratch = malloc(p->maxPixels * 4);
+  pixel_color color = {0, 0, 0};
+  mem_buffer mb = {NULL, 0, 0};
+  int i, j;
+
+  if (scratch == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return;
+    }
+
+  bench_start(&r);
+  for(i = 0; i < iterations; i++)
+    {
+      for(j = 0; j < corpus->lineCount; j++)
+        {
+          convert_coverage_rgba(scratch, p->images[j], (size_t)p->widths[j] * p->heights[j], color);
+          r.ops++;
+        }
+      r.glyphs += p->shapedGlyphs;
+      r.bytes += p->pixels;
+    }
+  bench_stop(&r);
+  print_result(font, corpus, "convert", &r);
+
+  bench_start(&r);
+  for(i = 0; i < iterations; i++)
+    {
+      for(j = 0; j < corpus->lineCount; j++)
+        {
+          if (encode_image(&imageOptions, p->images[j], p->widths[j], p->heights[j],
+                           color, &mb) != 0)
+            {
+              fprintf(stderr, "ERROR: out of memory\n");
+            }
+          r.ops++;
+        }
+      r.glyphs += p->shapedGlyphs;
+      r.bytes += p->pixels;
+    }
+  bench_stop(&r);
+  print_result(font, corpus, "encode", &r);
+
+  bench_start(&r);
+  for(i = 0; i < iterations; i++)
+    {
+      for(j = 0; j < corpus->lineCount; j++)
+        {
+          cairo_surface_t* img;
+          size_t written = 0;
+
+          convert_coverage_argb32((uint32_t*)scratch, p->images[j],
+                                  (size_t)p->widths[j] * p->heights[j], color);
+          img = cairo_image_surface_create_for_data(scratch, CAIRO_FORMAT_ARGB32,
+                                                    p->widths[j], p->heights[j],
+                                                    p->widths[j] * 4);
+          cairo_surface_write_to_png_stream(img, count_writer, &written);
+          cairo_surface_destroy(img);
+          r.ops++;
+        }
+      r.glyphs += p->shapedGlyphs;
+      r.bytes += p->pixels;
+    }
+  bench_stop(&r);
+  print_result(font, corpus, "encode_cairo", &r);
+
+  free(mb.data);
+  free(scratch);
+}
+
+int bench_font_corpus(bench_font* font, bench_corpus* corpus)
+{
+  hb_buffer_t* buffer = hb_buffer_create();
+  shape_cache* shapes = shape_cache_new(BENCH_SHAPE_CACHE_BYTES);
+  glyph_cache* cache = glyph_cache_new(BENCH_GLYPH_CACHE_BYTES);
+  bench_prepared p;
+  int ret = -1;
+
+  memset(&p, 0, sizeof(p));
+  fprintf(stderr, "%s, %s (%d lines):\n", font->path, corpus->name, corpus->lineCount);
+  if (shapes == NULL || cache == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+    }
+  else if (prepare(font, corpus, buffer, shapes, cache, &p) == 0)
+    {
+      bench_face_load(font, corpus);
+      bench_shape(font, corpus, buffer);
+      bench_glyphs(font, corpus, &p);
+      bench_composite(font, corpus, buffer, shapes, cache, &p);
+      bench_pixels(font, corpus, &p);
+      ret = 0;
+    }
+  prepared_free(&p, corpus->lineCount);
+  glyph_cache_free(cache);
+  shape_cache_free(shapes);
+  hb_buffer_destroy(buffer);
+  return ret;
+}
+
+int main(int argc, char** argv)
+{
+  bench_corpus* corpora;
+  int corpusCount = 0;
+  int failed = 0;
+  int i, j;
+
+  corpora = calloc(argc + 1, sizeof(bench_corpus));
+  if (corpora == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return 1;
+    }
+  for(i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+      if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+          iterations = atoi(argv[++i]);
+        }
+      else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+        {
+          pixelSize = atoi(argv[++i]);
+        }
+      else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+        {
+          formatSpec = argv[++i];
+          if (image_options_parse(formatSpec, &imageOptions) != 0)
+            return 1;
+        }
+      else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+          if (corpus_load(&corpora[corpusCount++], argv[++i]) != 0)
+            return 1;
+        }
+      else
+        {
+          break;
+        }
+    }
+  if (i == argc || iterations < 1 || pixelSize < 1)
+    {
+      fprintf(stderr, "USAGE: %s [-n iterations] [-p pixelSize] [-f format] [-c corpus.txt]... fontPath...\n", argv[0]);
+      fprintf(stderr, "  -n iterations  passes over the corpus for every stage, default %d\n", iterations);
+      fprintf(stderr, "  -p pixelSize   font size, default %d\n", pixelSize);
+      fprintf(stderr, "  -f format      format of the encode stage, default %s:\n" IMAGE_OPTIONS_HELP, formatSpec);
+      fprintf(stderr, "  -c corpus.txt  text to render, one string per line; may be repeated\n");
+      return 1;
+    }
+  if (corpusCount == 0 && corpus_load(&corpora[corpusCount++], NULL) != 0)
+    return 1;
+
+  arena = ft_arena_new();
+  if (arena == NULL || ft_arena_new_library(arena, &lib))
+    {
+      fprintf(stderr, "ERROR: init library\n");
+      return 1;
+    }
+
+  printf("{\n  \"iterations\": %d,\n  \"pixel_size\": %d,\n  \"format\": ", iterations, pixelSize);
+  print_json_string(formatSpec);
+  printf(",\n  \"composite_kernel\": \"%s\",\n  \"results\": [", composite_kernel_name());
+  for(; i < argc; i++)
+    {
+      bench_font font;
+      if (font_open(&font, argv[i]) != 0)
+        {
+          failed = 1;
+          continue;
+        }
+      for(j = 0; j < corpusCount; j++)
+        {
+          if (bench_font_corpus(&font, &corpora[j]) != 0)
+            failed = 1;
+        }
+      font_close(&font);
+    }
+  printf("\n  ]\n}\n");
+
+  for(j = 0; j < corpusCount; j++)
+    {
+      corpus_free(&corpora[j]);
+    }
+  free(corpora);
+  FT_Done_Library(lib);
+  ft_arena_free(arena);
+  return failed;
+}
@@ -0,0 +1,202 @@
+/*
+ * Client for fontrenderd. Sends a render request and writes the resulting
+ * PNG image into stdout.
+ *
+ * Usage:
+ * fontrender_client [-s socketPath] [-p pixelSize] [-c RRGGBB] [-1] [-o] [-n count]
+ *                   fontPath text > output.png
+ *
+ * -1 renders only the first character, without shaping.
+ * -o composites overlapping glyphs with source-over instead of max.
+ * -n sends the same request count times over one connection and reports
+ * the average round trip time on stderr.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "render_protocol.h"
+
+typedef unsigned char uchar;
+typedef unsigned int uint;
+
+int read_full(int fd, void* buf, size_t len)
+{
+  uchar* p = buf;
+  while(len > 0)
+    {
+      ssize_t n = read(fd, p, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return -1;
+      p += n;
+      len -= n;
+    }
+  return 0;
+}
+
+int write_full(int fd, const void* buf, size_t len)
+{
+  const uchar* p = buf;
+  while(len > 0)
+    {
+      ssize_t n = write(fd, p, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return -1;
+      p += n;
+      len -= n;
+    }
+  return 0;
+}
+
+int connect_to(const char* socketPath)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(socketPath) >= sizeof(addr.sun_path))
+    {
+      fprintf(stderr, "ERROR: socket path too long\n");
+      return -1;
+    }
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    {
+      perror("ERROR: socket");
+      return -1;
+    }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socketPath);
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+      perror("ERROR: connect");
+      close(fd);
+      return -1;
+    }
+  return fd;
+}
+
+double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv)
+{
+  const char* socketPath = RENDER_DEFAULT_SOCKET;
+  uint pixelSize = 64;
+  uint color = 0x000000;
+  uint flags = 0;
+  int count = 1;
+  const char* fontPath;
+  const char* text;
+  uchar* request;
+  size_t requestLen;
+  uchar* reply = NULL;
+  uint replyLen = 0;
+  uint status = 0;
+  double start;
+  int fd;
+  int i;
+
+  for(i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+      if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        socketPath = argv[++i];
+      else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+        pixelSize = atoi(argv[++i]);
+      else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        color = strtoul(argv[++i], NULL, 16);
+      else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        count = atoi(argv[++i]);
+      else if (strcmp(argv[i], "-1") == 0)
+        flags |= RENDER_FLAG_SINGLE_CHAR;
+      else if (strcmp(argv[i], "-o") == 0)
+        flags |= RENDER_FLAG_BLEND_OVER;
+      else
+        break;
+    }
+  if (argc - i != 2 || count < 1)
+    {
+      fprintf(stderr, "USAGE: %s [-s socketPath] [-p pixelSize] [-c RRGGBB] [-1] [-o] [-n count] fontPath text\n", argv[0]);
+      return 0;
+    }
+  fontPath = argv[i];
+  text = argv[i + 1];
+
+  requestLen = RENDER_REQUEST_HEADER_WORDS * 4 + strlen(fontPath) + strlen(text);
+  request = malloc(requestLen);
+  render_put_u32(request, RENDER_REQUEST_MAGIC);
+  render_put_u32(request + 4, flags);
+  render_put_u32(request + 8, pixelSize);
+  render_put_u32(request + 12, color);
+  render_put_u32(request + 16, strlen(fontPath));
+  render_put_u32(request + 20, strlen(text));
+  memcpy(request + 24, fontPath, strlen(fontPath));
+  memcpy(request + 24 + strlen(fontPath), text, strlen(text));
+
+  fd = connect_to(socketPath);
+  if (fd < 0)
+    return -1;
+
+  start = now_seconds();
+  for(i = 0; i < count; i++)
+    {
+      uchar hdr[8];
+      if (write_full(fd, request, requestLen) != 0 || read_full(fd, hdr, 8) != 0)
+        {
+          fprintf(stderr, "ERROR: connection lost\n");
+          return -1;
+        }
+      status = render_get_u32(hdr);
+      replyLen = render_get_u32(hdr + 4);
+      free(reply);
+      reply = malloc(replyLen + 1);
+      if (reply == NULL || read_full(fd, reply, replyLen) != 0)
+        {
+          fprintf(stderr, "ERROR: connection lost\n");
+          return -1;
+        }
+    }
+  if (count > 1)
+    {
+      fprintf(stderr, "%d requests, %.1f us per request.\n",
+              count, (now_seconds() - start) * 1e6 / count);
+    }
+  close(fd);
+
+  if (status != RENDER_STATUS_OK)
+    {
+      reply[replyLen] = '\0';
+      fprintf(stderr, "ERROR: (from server, status %u) %s\n", status, reply);
+      return -1;
+    }
+  if (fwrite(reply, 1, replyLen, stdout) != replyLen)
+    {
+      fprintf(stderr, "WARNING: incomplete writing action.\n");
+    }
+  free(reply);
+  free(request);
+  return 0;
+}
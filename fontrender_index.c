@@ -0,0 +1,101 @@
+/*
+ * Builds and queries the font index used for font fallback.
+ *
+ * Usage:
+ * fontrender_index [-v] index fontDir...
+ * fontrender_index -q index text
+ *
+ * The first form scans the font directories, recursively, and writes the
+ * Unicode coverage of every face to index (see font_index.h). Earlier
+ * directories have priority. Rebuild it whenever fonts are installed or
+ * removed; harfbuzz-ft2 -F and ft2_char_* -F only read it.
+ *
+ * -q prints, for every character of text, the first face covering it.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "font_index.h"
+#include "text_render.h"
+
+void print_usage()
+{
+  fprintf(stderr, "USAGE: fontrender_index [-v] index fontDir...\n");
+  fprintf(stderr, "       fontrender_index -q index text\n");
+  fprintf(stderr, "  -v           list every face indexed\n");
+  fprintf(stderr, "  -q           print the face used for every character of text\n");
+}
+
+int query(const char* indexPath, const char* text)
+{
+  font_index* index = font_index_open(indexPath);
+  int len = strlen(text);
+  int pos = 0;
+
+  if (index == NULL)
+    return -1;
+  printf("%u faces, %u coverage pages.\n", index->header->faceCount, index->header->pageCount);
+  while(pos < len)
+    {
+      unsigned char lead = text[pos];
+      int charLen = lead < 0x80 ? 1 : lead < 0xe0 ? 2 : lead < 0xf0 ? 3 : 4;
+      unsigned int c = first_utf8_char(text + pos, len - pos);
+      int face;
+
+      if (c == 0)
+        {
+          fprintf(stderr, "ERROR: malformed UTF-8 at byte %d\n", pos);
+          font_index_close(index);
+          return -1;
+        }
+      face = font_index_lookup(index, c);
+      if (face < 0)
+        {
+          printf("U+%04X: no face\n", c);
+        }
+      else
+        {
+          int faceIndex;
+          const char* path = font_index_face_path(index, face, &faceIndex);
+          printf("U+%04X: %s (face %d)\n", c, path, faceIndex);
+        }
+      pos += charLen;
+    }
+  font_index_close(index);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  int verbose = 0;
+  int argi = 1;
+  int faces;
+
+  if (argc == 4 && strcmp(argv[1], "-q") == 0)
+    return query(argv[2], argv[3]);
+  if (argc > 1 && strcmp(argv[1], "-v") == 0)
+    {
+      verbose = 1;
+      argi++;
+    }
+  if (argc - argi < 2)
+    {
+      print_usage();
+      return 0;
+    }
+
+  faces = font_index_build((const char* const*)&argv[argi + 1], argc - argi - 1,
+                           argv[argi], verbose);
+  if (faces < 0)
+    return -1;
+  fprintf(stderr, "%d faces indexed into %s.\n", faces, argv[argi]);
+  return 0;
+}
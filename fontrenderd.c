@@ -0,0 +1,529 @@
+/*
+ * Render daemon. Listens on a Unix domain socket and renders text into
+ * PNG images, keeping opened fonts in a pool between requests.
+ *
+ * Usage:
+ * fontrenderd [-s socketPath] [-m maxFonts] [-f format] [-j workers] [-t seconds]
+ *
+ * Connections are served by a fixed set of worker threads, each with its
+ * own FreeType library and font pool (of up to maxFonts fonts), one
+ * connection per worker at a time. Connections waiting for a worker are
+ * queued. A connection that sends nothing for -t seconds (default 30, 0
+ * for never) is closed, so idle clients cannot hold workers.
+ *
+ * FreeType memory comes from an ft_arena per worker; allocations and
+ * peak bytes per request are printed on exit.
+ *
+ * -f picks the image format of every response and the PNG encoder
+ * settings, see IMAGE_OPTIONS_HELP in image_writer.h.
+ *
+ * See render_protocol.h for the wire format, and fontrender_client for a
+ * matching client.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <hb.h>
+#include <hb-glib.h>
+
+#include "render_protocol.h"
+#include "font_pool.h"
+#include "text_render.h"
+#include "image_writer.h"
+#include "pixel_convert.h"
+#include "ft_arena.h"
+
+#define DEFAULT_MAX_FONTS 16
+#define DEFAULT_IDLE_SECONDS 30
+/* accepted connections waiting for a worker; more are turned away */
+#define CONN_QUEUE_SIZE 64
+
+typedef unsigned char uchar;
+typedef unsigned int uint;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+void on_stop_signal(int sig)
+{
+  stopRequested = 1;
+}
+
+/* read exactly len bytes; returns 0 on success, -1 on EOF, error or timeout */
+int read_full(int fd, void* buf, size_t len)
+{
+  uchar* p = buf;
+  while(len > 0)
+    {
+      ssize_t n = read(fd, p, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return -1;
+      p += n;
+      len -= n;
+    }
+  return 0;
+}
+
+int write_full(int fd, const void* buf, size_t len)
+{
+  const uchar* p = buf;
+  while(len > 0)
+    {
+      ssize_t n = write(fd, p, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return -1;
+      p += n;
+      len -= n;
+    }
+  return 0;
+}
+
+int send_response(int fd, uint status, const void* data, size_t len)
+{
+  uchar hdr[8];
+  render_put_u32(hdr, status);
+  render_put_u32(hdr + 4, len);
+  if (write_full(fd, hdr, 8) != 0)
+    return -1;
+  return write_full(fd, data, len);
+}
+
+int send_error(int fd, uint status, const char* msg)
+{
+  return send_response(fd, status, msg, strlen(msg));
+}
+
+/*
+ * Everything that lives across requests, one per worker.
+ */
+typedef struct server_state
+{
+  ft_arena* arena;
+  FT_Library lib;
+  font_pool* pool;
+  hb_buffer_t* buffer;
+  image_options imageOptions;
+  mem_buffer image;
+  char* path;
+  char* text;
+  size_t textCap;
+  unsigned long requests;
+  /* FreeType memory of the requests, counted from an ft_arena_mark() before each */
+  unsigned long ftAllocs;
+  size_t ftRequestPeak;
+} server_state;
+
+/*
+ * Serve one request. Returns -1 when the connection should be closed.
+ */
+int handle_request(server_state* st, int fd)
+{
+  uchar hdr[RENDER_REQUEST_HEADER_WORDS * 4];
+  uint flags, pixelSize, color, pathLen, textLen;
+  font_entry* fe;
+  pixel_color fill;
+  uchar* cov;
+  int w, h;
+  int ret;
+
+  if (read_full(fd, hdr, sizeof(hdr)) != 0)
+    return -1;
+  if (render_get_u32(hdr) != RENDER_REQUEST_MAGIC)
+    {
+      send_error(fd, RENDER_STATUS_BAD_REQUEST, "bad magic");
+      return -1;
+    }
+  flags = render_get_u32(hdr + 4);
+  pixelSize = render_get_u32(hdr + 8);
+  color = render_get_u32(hdr + 12);
+  pathLen = render_get_u32(hdr + 16);
+  textLen = render_get_u32(hdr + 20);
+  if (pathLen == 0 || pathLen > RENDER_MAX_PATH_LEN || textLen > RENDER_MAX_TEXT_LEN)
+    {
+      /* the payload cannot be skipped safely, so drop the connection */
+      send_error(fd, RENDER_STATUS_BAD_REQUEST, "path or text too long");
+      return -1;
+    }
+
+  if (read_full(fd, st->path, pathLen) != 0)
+    return -1;
+  st->path[pathLen] = '\0';
+  if (textLen + 1 > st->textCap)
+    {
+      char* newText = realloc(st->text, textLen + 1);
+      if (newText == NULL)
+        return -1;
+      st->text = newText;
+      st->textCap = textLen + 1;
+    }
+  if (read_full(fd, st->text, textLen) != 0)
+    return -1;
+  st->text[textLen] = '\0';
+  st->requests++;
+
+  if (pixelSize == 0 || pixelSize > RENDER_MAX_PIXEL_SIZE)
+    return send_error(fd, RENDER_STATUS_BAD_REQUEST, "bad pixel size");
+
+  fe = font_pool_get(st->pool, st->path);
+  if (fe == NULL)
+    return send_error(fd, RENDER_STATUS_FONT_ERROR, "cannot open font");
+  font_entry_set_pixel_size(fe, pixelSize);
+
+  if (flags & RENDER_FLAG_SINGLE_CHAR)
+    {
+      cov = render_char(fe->ftFace, fe->cache, first_utf8_char(st->text, textLen), &w, &h);
+      if (cov == NULL)
+        return send_error(fd, RENDER_STATUS_RENDER_ERROR, "the character cannot be indexed");
+    }
+  else
+    {
+      composite_mode mode = (flags & RENDER_FLAG_BLEND_OVER) ? COMPOSITE_OVER : COMPOSITE_MAX;
+      cov = render_text(fe->font, fe->ftFace, st->buffer, fe->shapes, fe->cache, st->text, textLen,
+                        mode, 0, &w, &h);
+      if (cov == NULL)
+        return send_error(fd, RENDER_STATUS_RENDER_ERROR, "out of memory");
+    }
+
+  fill.r = (color >> 16) & 0xff;
+  fill.g = (color >> 8) & 0xff;
+  fill.b = color & 0xff;
+  ret = encode_image(&st->imageOptions, cov, w, h, fill, &st->image);
+  free(cov);
+  if (ret != 0)
+    return send_error(fd, RENDER_STATUS_RENDER_ERROR, "encoding failed");
+  return send_response(fd, RENDER_STATUS_OK, st->image.data, st->image.len);
+}
+
+/* handle_request(), counting the FreeType memory it takes */
+int serve_request(server_state* st, int fd)
+{
+  int ret;
+
+  ft_arena_mark(st->arena);
+  ret = handle_request(st, fd);
+  st->ftAllocs += ft_arena_request_allocs(st->arena);
+  if (ft_arena_request_peak(st->arena) > st->ftRequestPeak)
+    st->ftRequestPeak = ft_arena_request_peak(st->arena);
+  return ret;
+}
+
+int open_listener(const char* socketPath)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(socketPath) >= sizeof(addr.sun_path))
+    {
+      fprintf(stderr, "ERROR: socket path too long\n");
+      return -1;
+    }
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    {
+      perror("ERROR: socket");
+      return -1;
+    }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socketPath);
+  /* remove a stale socket from an earlier run */
+  unlink(socketPath);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0)
+    {
+      perror("ERROR: bind");
+      close(fd);
+      return -1;
+    }
+  return fd;
+}
+
+int server_state_init(server_state* st, const image_options* imageOptions, int maxFonts,
+                      hb_unicode_funcs_t* unicodeFuncs)
+{
+  memset(st, 0, sizeof(server_state));
+  st->imageOptions = *imageOptions;
+  st->arena = ft_arena_new();
+  if (st->arena == NULL || ft_arena_new_library(st->arena, &st->lib))
+    {
+      fprintf(stderr, "ERROR: init library\n");
+      st->lib = NULL;
+      return -1;
+    }
+  st->pool = font_pool_new(maxFonts);
+  st->buffer = hb_buffer_create();
+  st->path = malloc(RENDER_MAX_PATH_LEN + 1);
+  if (st->pool == NULL || st->path == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return -1;
+    }
+  /* workers run at once, so each opens its fonts on its own library */
+  st->pool->lib = st->lib;
+  hb_buffer_set_unicode_funcs(st->buffer, unicodeFuncs);
+  return 0;
+}
+
+void server_state_free(server_state* st)
+{
+  free(st->path);
+  free(st->text);
+  free(st->image.data);
+  hb_buffer_destroy(st->buffer);
+  font_pool_free(st->pool);
+  if (st->lib != NULL)
+    FT_Done_Library(st->lib);
+  ft_arena_free(st->arena);
+}
+
+/* accepted connections, handed from the accepting thread to the workers */
+typedef struct conn_queue
+{
+  int fds[CONN_QUEUE_SIZE];
+  int head;
+  int count;
+  int quit;
+  pthread_mutex_t lock;
+  pthread_cond_t ready; /* a connection was queued, or quit was set */
+} conn_queue;
+
+typedef struct server_worker
+{
+  pthread_t thread;
+  conn_queue* queue;
+  server_state st;
+  /* connection being served, -1 when idle; under queue->lock */
+  int fd;
+} server_worker;
+
+void* server_worker_main(void* arg)
+{
+  server_worker* wk = arg;
+  conn_queue* q = wk->queue;
+  int fd;
+
+  pthread_mutex_lock(&q->lock);
+  while(1)
+    {
+      while(q->count == 0 && !q->quit)
+        pthread_cond_wait(&q->ready, &q->lock);
+      if (q->quit)
+        break;
+      fd = q->fds[q->head];
+      q->head = (q->head + 1) % CONN_QUEUE_SIZE;
+      q->count--;
+      wk->fd = fd;
+      pthread_mutex_unlock(&q->lock);
+
+      while(!stopRequested && serve_request(&wk->st, fd) == 0);
+
+      /* closed under the lock, so a shutdown() on stop cannot hit a reused fd */
+      pthread_mutex_lock(&q->lock);
+      wk->fd = -1;
+      close(fd);
+    }
+  pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+/* time out reads and writes of a connection, so idle clients let go of workers */
+void set_timeouts(int fd, int seconds)
+{
+  struct timeval tv;
+
+  if (seconds <= 0)
+    return;
+  tv.tv_sec = seconds;
+  tv.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+int main(int argc, char** argv)
+{
+  const char* socketPath = RENDER_DEFAULT_SOCKET;
+  int maxFonts = DEFAULT_MAX_FONTS;
+  int workerCount = 0;
+  int idleSeconds = DEFAULT_IDLE_SECONDS;
+  image_options imageOptions = IMAGE_OPTIONS_DEFAULT;
+  server_worker* workers;
+  conn_queue queue;
+  struct sigaction sa;
+  sigset_t stopSignals, oldMask;
+  unsigned long requests = 0, hits = 0, misses = 0;
+  unsigned long ftAllocs = 0;
+  size_t ftRequestPeak = 0;
+  int started = 0;
+  int status = 0;
+  int listenFd;
+  int i;
+
+  for(i = 1; i < argc; i++)
+    {
+      if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        socketPath = argv[++i];
+      else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+        maxFonts = atoi(argv[++i]);
+      else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        workerCount = atoi(argv[++i]);
+      else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        idleSeconds = atoi(argv[++i]);
+      else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+        {
+          if (image_options_parse(argv[++i], &imageOptions) != 0)
+            return -1;
+        }
+      else
+        {
+          fprintf(stderr, "USAGE: %s [-s socketPath] [-m maxFonts] [-f format] [-j workers] [-t seconds]\n", argv[0]);
+          fprintf(stderr, "  -m maxFonts   fonts kept open by every worker\n");
+          fprintf(stderr, "  -f format     image format of responses:\n");
+          fputs(IMAGE_OPTIONS_HELP, stderr);
+          fprintf(stderr, "  -j workers    connections served at once, 0 (default)\n");
+          fprintf(stderr, "                for one per online CPU\n");
+          fprintf(stderr, "  -t seconds    close connections idle this long, default %d;\n",
+                  DEFAULT_IDLE_SECONDS);
+          fprintf(stderr, "                0 never closes them\n");
+          return 0;
+        }
+    }
+  if (workerCount <= 0)
+    {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      workerCount = cpus > 0 ? cpus : 1;
+    }
+
+  /* a client going away must not kill the server */
+  signal(SIGPIPE, SIG_IGN);
+  /* no SA_RESTART, so accept() returns on SIGINT/SIGTERM */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_stop_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  listenFd = open_listener(socketPath);
+  if (listenFd < 0)
+    return -1;
+
+  memset(&queue, 0, sizeof(queue));
+  pthread_mutex_init(&queue.lock, NULL);
+  pthread_cond_init(&queue.ready, NULL);
+  hb_unicode_funcs_t* unicodeFuncs = hb_glib_get_unicode_funcs();
+  workers = calloc(workerCount, sizeof(server_worker));
+  if (workers == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      stopRequested = 1;
+      status = -1;
+    }
+
+  /* the stop signals go to the accepting thread, which the workers inherit */
+  sigemptyset(&stopSignals);
+  sigaddset(&stopSignals, SIGINT);
+  sigaddset(&stopSignals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stopSignals, &oldMask);
+  for(i = 0; i < workerCount && !stopRequested; i++)
+    {
+      server_worker* wk = &workers[i];
+      wk->queue = &queue;
+      wk->fd = -1;
+      if (server_state_init(&wk->st, &imageOptions, maxFonts, unicodeFuncs) != 0
+          || pthread_create(&wk->thread, NULL, server_worker_main, wk) != 0)
+        {
+          fprintf(stderr, "ERROR: cannot start worker %d\n", i);
+          server_state_free(&wk->st);
+          stopRequested = 1;
+          status = -1;
+          break;
+        }
+      started++;
+    }
+  pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+  if (!stopRequested)
+    fprintf(stderr, "Listening on %s, %d workers\n", socketPath, workerCount);
+
+  /* each connection may carry any number of requests */
+  while(!stopRequested)
+    {
+      int fd = accept(listenFd, NULL, NULL);
+      if (fd < 0)
+        {
+          if (errno != EINTR)
+            perror("WARNING: accept");
+          continue;
+        }
+      set_timeouts(fd, idleSeconds);
+      pthread_mutex_lock(&queue.lock);
+      if (queue.count == CONN_QUEUE_SIZE)
+        {
+          pthread_mutex_unlock(&queue.lock);
+          fprintf(stderr, "WARNING: too many waiting connections, closing one\n");
+          close(fd);
+          continue;
+        }
+      queue.fds[(queue.head + queue.count) % CONN_QUEUE_SIZE] = fd;
+      queue.count++;
+      pthread_cond_signal(&queue.ready);
+      pthread_mutex_unlock(&queue.lock);
+    }
+
+  /* wake workers blocked on their clients, and drop connections still waiting */
+  pthread_mutex_lock(&queue.lock);
+  queue.quit = 1;
+  pthread_cond_broadcast(&queue.ready);
+  for(i = 0; i < started; i++)
+    {
+      if (workers[i].fd >= 0)
+        shutdown(workers[i].fd, SHUT_RDWR);
+    }
+  for(; queue.count > 0; queue.count--)
+    {
+      close(queue.fds[queue.head]);
+      queue.head = (queue.head + 1) % CONN_QUEUE_SIZE;
+    }
+  pthread_mutex_unlock(&queue.lock);
+  for(i = 0; i < started; i++)
+    {
+      pthread_join(workers[i].thread, NULL);
+      requests += workers[i].st.requests;
+      hits += workers[i].st.pool->hits;
+      misses += workers[i].st.pool->misses;
+      ftAllocs += workers[i].st.ftAllocs;
+      if (workers[i].st.ftRequestPeak > ftRequestPeak)
+        ftRequestPeak = workers[i].st.ftRequestPeak;
+      server_state_free(&workers[i].st);
+    }
+
+  fprintf(stderr, "%lu requests served. Font pools: %lu hits, %lu misses.\n",
+          requests, hits, misses);
+  fprintf(stderr, "FreeType memory: %.1f allocations per request, "
+          "at most %lu bytes per request.\n",
+          requests > 0 ? (double)ftAllocs / requests : 0.0, (unsigned long)ftRequestPeak);
+  close(listenFd);
+  unlink(socketPath);
+  free(workers);
+  pthread_cond_destroy(&queue.ready);
+  pthread_mutex_destroy(&queue.lock);
+  hb_unicode_funcs_destroy(unicodeFuncs);
+  return status;
+}
@@ -1,5 +1,16 @@
 /* 
  * Draw a character with OpenGL
+ *
+ * Usage:
+ * ft2_char_gl [-s] [-b baked.fab] [text]
+ *
+ * Without a text, the arrow keys switch between a few characters. -s
+ * draws them from small signed distance fields instead of large
+ * coverage bitmaps.
+ * With a text, the window is filled with copies of the shaped text,
+ * drawn through the glyph atlas in one draw call per frame. -b loads
+ * the glyphs of a fontrender_bake file for the font at the text size,
+ * so they are not rasterized at startup.
  * 
  * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
  * 
@@ -8,12 +19,25 @@
  * as published by Sam Hocevar. See the COPYING file for more details.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <hb.h>
+#include <hb-ft.h>
+
+#include "glyph_atlas.h"
+#include "text_batch.h"
+#include "sdf.h"
+#include "ft_arena.h"
+#include "baked_atlas.h"
+#include "font_file.h"
 
 typedef unsigned int uint;
 typedef unsigned char uchar;
@@ -34,9 +58,23 @@ typedef unsigned char uchar;
 #define DEFAULT_HEIGHT 480
 #define FONTPATH ("/usr/share/fonts/dejavu/DejaVuSans.ttf")
 #define CHARCOUNT (3)
+#define ATLAS_PAGE_SIZE 1024
+#define ATLAS_MAX_PAGES 4
+#define TEXT_PIXEL_SIZE 24
+/* distance fields: pixel size they are built at, and their range */
+#define SDF_PIXEL_SIZE 48
+#define SDF_SPREAD 6
 uint chars[CHARCOUNT] = {TA, THA, CANCER};
-GLuint charTextures[CHARCOUNT];
+uint charGlyphs[CHARCOUNT];
 int curTextureIdx = 0;
+/* FreeType memory comes from a pool, see ft_arena.h */
+ft_arena* ftArena;
+FT_Library lib;
+FT_Face face;
+glyph_atlas* atlas;
+int useSdf = 0;
+/* set with -b, closed once its glyphs are in the atlas */
+baked_atlas* baked = NULL;
 
 /* fragment shader */
 const char* vertexShader = "#version 120\n"
@@ -61,6 +99,42 @@ const char* fragShader = "#version 120\n"
 "  gl_FragColor = vec4(finalColor, 1.0f);\n"
 "}\n";
 
+/* edges of distance field glyphs stay sharp at any magnification */
+const char* sdfFragShader = "#version 120\n"
+"varying vec2 UV;\n"
+"uniform vec3 backColor;\n"
+"uniform vec3 foreColor;\n"
+"uniform sampler2D myTexture;\n"
+"void main()\n"
+"{\n"
+"  float dist = texture2D(myTexture, UV).r;\n"
+"  float edge = fwidth(dist) * 0.7;\n"
+"  float textureAlpha = smoothstep(0.5 - edge, 0.5 + edge, dist);\n"
+"  gl_FragColor = vec4(mix(backColor, foreColor, textureAlpha), 1.0);\n"
+"}\n";
+
+/* text mode: pixel positions, y down; blending over backColor */
+const char* textVertexShader = "#version 120\n"
+"attribute vec2 vertexPosition;\n"
+"attribute vec2 vertexUV;\n"
+"uniform vec2 viewSize;\n"
+"varying vec2 UV;\n"
+"void main()\n"
+"{\n"
+"  gl_Position = vec4(vertexPosition.x / viewSize.x * 2.0 - 1.0,\n"
+"                     1.0 - vertexPosition.y / viewSize.y * 2.0, 0.0, 1.0);\n"
+"  UV = vertexUV;\n"
+"}\n";
+
+const char* textFragShader = "#version 120\n"
+"varying vec2 UV;\n"
+"uniform vec3 foreColor;\n"
+"uniform sampler2D myTexture;\n"
+"void main()\n"
+"{\n"
+"  gl_FragColor = vec4(foreColor, texture2D(myTexture, UV).r);\n"
+"}\n";
+
 float vertices[] = 
   {
     -1.0f, -1.0f, 0.0f,
@@ -93,52 +167,6 @@ int min(int a, int b)
   return a < b? a : b;
 }
 
-int get_appropriate_power_of_two(int v)
-{
-  int i;
-  for(i = 1; i < v; i *= 2);
-  return i;
-}
-
-GLuint load_char_texture(FT_Face face, uint utf32)
-{
-  uchar* buffer;
-  int w;
-  int h;
-  int texDim;
-  FT_Bitmap bmp;
-  int x;
-  int y;
-  int i;
-  GLuint textureHandle;
-
-  FT_Load_Char(face, utf32, FT_LOAD_RENDER);
-  bmp = face->glyph->bitmap;
-  w = bmp.width;
-  h = bmp.rows;
-  texDim = get_appropriate_power_of_two(max(w, h));
-  buffer = malloc(texDim * texDim);
-  memset(buffer, 0, texDim * texDim);
-  
-  x = (texDim - w) / 2;
-  y = (texDim - h) / 2;
-  for(i = 0; i < h; i++)
-    {
-      memcpy(&buffer[texDim * (i + y) + x], &bmp.buffer[w * i], w);
-    }
-  
-  glGenTextures(1, &textureHandle);
-  glBindTexture(GL_TEXTURE_2D, textureHandle);
-  glTexImage2D(GL_TEXTURE_2D, 0,
-               GL_RED, texDim, texDim,
-               0, GL_RED, GL_UNSIGNED_BYTE, buffer);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-  glGenerateMipmap(GL_TEXTURE_2D);
-  free(buffer);
-  return textureHandle;
-}
-
 void show_gl_shader_compilation_error(GLuint shaderHandle)
 {
   int errorLogLength;
@@ -161,6 +189,10 @@ void show_gl_linking_error(GLuint programHandle)
 
 void clean_up(GLFWwindow* win)
 {
+  glyph_atlas_free(atlas);
+  if (ftArena != NULL)
+    FT_Done_Library(lib);
+  ft_arena_free(ftArena);
   glfwDestroyWindow(win);
   glfwTerminate();
 }
@@ -170,24 +202,105 @@ void init_glew()
   glewInit();
 }
 
-void create_texture_for_chars()
+/*
+ * Distance fields for all characters, built on every CPU and then
+ * uploaded into the atlas.
+ */
+void create_sdf_for_chars()
+{
+  sdf_glyph sdf[CHARCOUNT];
+  int i;
+
+  FT_Set_Pixel_Sizes(face, 0, SDF_PIXEL_SIZE);
+  for(i = 0; i < CHARCOUNT; i++)
+    {
+      charGlyphs[i] = FT_Get_Char_Index(face, chars[i]);
+    }
+  if (sdf_render_glyphs(face, charGlyphs, CHARCOUNT, SDF_SPREAD,
+                        sysconf(_SC_NPROCESSORS_ONLN), sdf) != 0)
+    {
+      return;
+    }
+  for(i = 0; i < CHARCOUNT; i++)
+    {
+      glyph_atlas_put(atlas, face, sdf[i].glyphIndex, sdf[i].buffer, sdf[i].width,
+                      sdf[i].width, sdf[i].rows, sdf[i].left, sdf[i].top);
+    }
+  sdf_glyphs_free(sdf, CHARCOUNT);
+}
+
+/*
+ * All characters share the atlas textures; the face stays open because
+ * the atlas is keyed by it. Returns -1 when FreeType or the font cannot
+ * be set up.
+ */
+int create_texture_for_chars()
 {
-  FT_Library lib;
-  FT_Face face;
+  int bakedSize;
   int i;
   
-  FT_Init_FreeType(&lib);
-  FT_New_Face( lib, FONTPATH, 0, &face);
+  ftArena = ft_arena_new();
+  if (ftArena == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return -1;
+    }
+  if (ft_arena_new_library(ftArena, &lib))
+    {
+      fprintf(stderr, "ERROR: init library\n");
+      ft_arena_free(ftArena);
+      ftArena = NULL;
+      return -1;
+    }
+  if (font_file_new_face(lib, FONTPATH, 0, &face))
+    {
+      fprintf(stderr, "ERROR: cannot load font %s\n", FONTPATH);
+      return -1;
+    }
+  /* baked pages of the text size come on top of the pages filled at run time */
+  bakedSize = baked != NULL ? baked_atlas_find_size(baked, TEXT_PIXEL_SIZE) : -1;
+  atlas = glyph_atlas_new(ATLAS_PAGE_SIZE, ATLAS_MAX_PAGES
+                          + (bakedSize >= 0 ? baked_atlas_size_pages(baked, bakedSize) : 0));
+  if (useSdf)
+    {
+      create_sdf_for_chars();
+      return 0;
+    }
   FT_Set_Char_Size(face, 0, 256*64, 100, 100);
   for(i = 0; i < CHARCOUNT; i++)
     {
-      charTextures[i] = load_char_texture(face, chars[i]);
+      charGlyphs[i] = FT_Get_Char_Index(face, chars[i]);
+      glyph_atlas_get(atlas, face, charGlyphs[i]);
     }
-  FT_Done_FreeType(lib);
+  return 0;
+}
+
+/*
+ * Fit the quad to the glyph's aspect ratio and point its UVs at the
+ * glyph's rectangle in the atlas.
+ */
+void update_quad(const glyph_atlas_entry* g, GLuint vbHandle, GLuint uvHandle)
+{
+  float dim = max(g->width, g->rows);
+  float halfW = g->width / dim;
+  float halfH = g->rows / dim;
+
+  vertices[0] = -halfW; vertices[1] = -halfH;
+  vertices[3] = -halfW; vertices[4] = halfH;
+  vertices[6] = halfW; vertices[7] = -halfH;
+  vertices[9] = halfW; vertices[10] = halfH;
+  uv[0] = g->u0; uv[1] = g->v1;
+  uv[2] = g->u0; uv[3] = g->v0;
+  uv[4] = g->u1; uv[5] = g->v1;
+  uv[6] = g->u1; uv[7] = g->v0;
+  glBindBuffer(GL_ARRAY_BUFFER, vbHandle);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+  glBindBuffer(GL_ARRAY_BUFFER, uvHandle);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(uv), uv);
 }
 
 /* returns shader program id*/
-GLuint setup_shaders()
+GLuint setup_shaders(const char* vsSource, const char* fsSource)
 {
   GLuint programHandle;
   GLuint vsHandle;
@@ -195,7 +308,7 @@ GLuint setup_shaders()
   int compilationStatus;
 
   vsHandle = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vsHandle, 1, &vertexShader, NULL);
+  glShaderSource(vsHandle, 1, &vsSource, NULL);
   glCompileShader(vsHandle);
   glGetShaderiv(vsHandle, GL_COMPILE_STATUS, &compilationStatus);
   if (compilationStatus != GL_TRUE)
@@ -205,7 +318,7 @@ GLuint setup_shaders()
     }
 
   fgHandle = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fgHandle, 1, &fragShader, NULL);
+  glShaderSource(fgHandle, 1, &fsSource, NULL);
   glCompileShader(fgHandle);
   glGetShaderiv(fgHandle, GL_COMPILE_STATUS, &compilationStatus);
   if (compilationStatus != GL_TRUE)
@@ -236,7 +349,7 @@ void setup_gl(GLuint* vbHandle, GLuint* uvHandle, GLuint* idxHandle,
   GLuint programHandle;
   GLuint backColorVar, foreColorVar;
   
-  programHandle = setup_shaders();
+  programHandle = setup_shaders(vertexShader, useSdf ? sdfFragShader : fragShader);
   glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
   
   *vbVar = glGetAttribLocation(programHandle, "vertexPosition");
@@ -250,12 +363,12 @@ void setup_gl(GLuint* vbHandle, GLuint* uvHandle, GLuint* idxHandle,
   /* Vertex buffer */
   glGenBuffers(1, vbHandle);
   glBindBuffer(GL_ARRAY_BUFFER, *vbHandle);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
 
   /* UV buffer*/
   glGenBuffers(1, uvHandle);
   glBindBuffer(GL_ARRAY_BUFFER, *uvHandle);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(uv), uv, GL_STATIC_DRAW);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(uv), uv, GL_DYNAMIC_DRAW);
   
   /* Index buffer*/
   glGenBuffers(1, idxHandle);
@@ -281,6 +394,107 @@ void key_event(GLFWwindow* win, int key, int scan, int action, int mods)
     }
 }
 
+/*
+ * Put the glyphs baked at the face's current size into the atlas.
+ */
+void load_baked_glyphs(int pixelSize)
+{
+  int size = baked_atlas_find_size(baked, pixelSize);
+  int added;
+
+  if (size < 0)
+    {
+      fprintf(stderr, "WARNING: no glyphs baked at %d pixels\n", pixelSize);
+      return;
+    }
+  if (baked->header->fontGlyphs != (uint32_t)face->num_glyphs)
+    {
+      fprintf(stderr, "WARNING: the baked atlas is of another font\n");
+      return;
+    }
+  added = glyph_atlas_add_baked(atlas, face, baked, size);
+  if (added >= 0)
+    fprintf(stderr, "%d baked glyphs on %d pages.\n", added, baked_atlas_size_pages(baked, size));
+}
+
+/*
+ * Fill the window with copies of text. All of them go into one text
+ * batch, so a frame is normally a single draw call.
+ */
+void run_text_mode(GLFWwindow* win, const char* text)
+{
+  GLuint programHandle;
+  GLint viewSizeVar;
+  text_batch* batch;
+  hb_font_t* font;
+  hb_buffer_t* buffer;
+  int curW = DEFAULT_WIDTH;
+  int curH = DEFAULT_HEIGHT;
+  int lastW = 0;
+  int lastH = 0;
+  unsigned long frames = 0;
+  float lineHeight;
+  float x, y;
+
+  FT_Set_Pixel_Sizes(face, 0, TEXT_PIXEL_SIZE);
+  if (baked != NULL)
+    {
+      load_baked_glyphs(TEXT_PIXEL_SIZE);
+      baked_atlas_close(baked);
+      baked = NULL;
+    }
+  lineHeight = face->size->metrics.height / 64.0f;
+  font = hb_ft_font_create(face, NULL);
+  buffer = hb_buffer_create();
+  hb_buffer_add_utf8(buffer, text, -1, 0, -1);
+  hb_buffer_guess_segment_properties(buffer);
+  hb_shape(font, buffer, NULL, 0);
+
+  programHandle = setup_shaders(textVertexShader, textFragShader);
+  viewSizeVar = glGetUniformLocation(programHandle, "viewSize");
+  glUniform1i(glGetUniformLocation(programHandle, "myTexture"), 0);
+  glUniform3f(glGetUniformLocation(programHandle, "foreColor"),
+              FORE_R / 255.0f, FORE_G / 255.0f, FORE_B / 255.0f);
+  glClearColor(BACK_R / 255.0f, BACK_G / 255.0f, BACK_B / 255.0f, 1.0f);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  batch = text_batch_new(glGetAttribLocation(programHandle, "vertexPosition"),
+                         glGetAttribLocation(programHandle, "vertexUV"));
+
+  while(!glfwWindowShouldClose(win))
+    {
+      glfwGetWindowSize(win, &curW, &curH);
+      if(curW != lastW || curH != lastH)
+        {
+          lastW = curW;
+          lastH = curH;
+          glViewport(0, 0, curW, curH);
+          glUniform2f(viewSizeVar, curW, curH);
+        }
+
+      glClear(GL_COLOR_BUFFER_BIT);
+      for(y = lineHeight; y < curH + lineHeight; y += lineHeight)
+        {
+          /* the gap also guarantees progress for blank text */
+          for(x = 0; x < curW; x += lineHeight)
+            {
+              x += text_batch_add_run(batch, atlas, face, buffer, x, y);
+            }
+        }
+      text_batch_flush(batch, atlas);
+      frames++;
+
+      glfwSwapBuffers(win);
+      glfwPollEvents();
+    }
+
+  fprintf(stderr, "%lu frames, %lu glyphs in %lu draw calls.\n",
+          frames, batch->quads, batch->drawCalls);
+  text_batch_free(batch);
+  hb_buffer_destroy(buffer);
+  hb_font_destroy(font);
+}
+
 GLFWwindow* create_window()
 {
   GLFWwindow* win;
@@ -292,7 +506,7 @@ GLFWwindow* create_window()
   return win;
 }
 
-int main()
+int main(int argc, char** argv)
 {
   GLFWwindow* win;
   int curW = DEFAULT_WIDTH;
@@ -300,12 +514,39 @@ int main()
   int lastW = 0;
   int lastH = 0;
   int minDim = 0;
+  int lastTextureIdx = -1;
+  unsigned long lastEvictions = 0;
+  const glyph_atlas_entry* g;
   uint vbHandle, uvHandle, idxHandle;
   uint vbVar, uvVar,  texVar;
+  int argi = 1;
+
+  if (argi < argc && strcmp(argv[argi], "-s") == 0)
+    {
+      useSdf = 1;
+      argi++;
+    }
+  if (argi + 1 < argc && strcmp(argv[argi], "-b") == 0)
+    {
+      baked = baked_atlas_open(argv[argi + 1]);
+      if (baked == NULL)
+        return -1;
+      argi += 2;
+    }
 
   win = create_window();
   init_glew();
-  create_texture_for_chars();
+  if (create_texture_for_chars() != 0)
+    {
+      clean_up(win);
+      return -1;
+    }
+  if (argi < argc)
+    {
+      run_text_mode(win, argv[argi]);
+      clean_up(win);
+      return 0;
+    }
   setup_gl(&vbHandle, &uvHandle, &idxHandle, 
            &vbVar, &uvVar, &texVar);
 
@@ -324,6 +565,20 @@ int main()
         }
 
       glClear(GL_COLOR_BUFFER_BIT);
+
+      /*
+       * A hit for glyphs already in the atlas, so this is cheap. The quad
+       * only changes with the character, or when the glyph has moved
+       * because a page was emptied. Blank glyphs have no page.
+       */
+      g = glyph_atlas_get(atlas, face, charGlyphs[curTextureIdx]);
+      if (g != NULL && g->page >= 0
+          && (curTextureIdx != lastTextureIdx || atlas->evictions != lastEvictions))
+        {
+          update_quad(g, vbHandle, uvHandle);
+          lastTextureIdx = curTextureIdx;
+          lastEvictions = atlas->evictions;
+        }
       
       glBindBuffer(GL_ARRAY_BUFFER, vbHandle);
       glVertexAttribPointer(vbVar, 3, GL_FLOAT,
@@ -334,10 +589,13 @@ int main()
                             GL_FALSE, 0, NULL);
       
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, idxHandle);
-      glBindTexture(GL_TEXTURE_2D, charTextures[curTextureIdx]);
       
       glUniform1i(texVar, 0);
-      glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
+      if (g != NULL && g->page >= 0)
+        {
+          glBindTexture(GL_TEXTURE_2D, atlas->pages[g->page].texture);
+          glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
+        }
 
       glFlush();
 
@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ft_arena.h"
+
+#define SMALLEST_CLASS 16
+#define LARGE_CLASS FT_ARENA_CLASSES
+
+/* in front of every block; 16 bytes keeps blocks aligned like malloc */
+typedef struct block_header
+{
+  size_t size;
+  size_t sizeClass;
+} block_header;
+
+/* in front of the header of large blocks */
+typedef struct large_link
+{
+  struct large_link* prev;
+  struct large_link* next;
+} large_link;
+
+/* at the start of every chunk */
+typedef struct chunk_header
+{
+  unsigned char* next;
+  size_t pad;
+} chunk_header;
+
+static int size_class(size_t size)
+{
+  int c = 0;
+  size_t classSize = SMALLEST_CLASS;
+
+  while(classSize < size && c < LARGE_CLASS)
+    {
+      classSize *= 2;
+      c++;
+    }
+  return c;
+}
+
+static void count_peak(ft_arena* arena)
+{
+  if (arena->bytes > arena->peak)
+    arena->peak = arena->bytes;
+  if (arena->bytes > arena->markPeak)
+    arena->markPeak = arena->bytes;
+}
+
+static void count_alloc(ft_arena* arena, size_t size)
+{
+  arena->allocs++;
+  arena->bytes += size;
+  count_peak(arena);
+}
+
+static int add_chunk(ft_arena* arena)
+{
+  unsigned char* chunk = malloc(FT_ARENA_CHUNK_SIZE);
+  if (chunk == NULL)
+    return -1;
+  ((chunk_header*)chunk)->next = arena->chunks;
+  arena->chunks = chunk;
+  arena->chunkUsed = sizeof(chunk_header);
+  arena->chunkCount++;
+  return 0;
+}
+
+static void* alloc_large(ft_arena* arena, size_t size)
+{
+  large_link* link = malloc(sizeof(large_link) + sizeof(block_header) + size);
+  block_header* h;
+
+  if (link == NULL)
+    return NULL;
+  link->prev = NULL;
+  link->next = arena->large;
+  if (link->next != NULL)
+    link->next->prev = link;
+  arena->large = link;
+  h = (block_header*)(link + 1);
+  h->size = size;
+  h->sizeClass = LARGE_CLASS;
+  return h + 1;
+}
+
+void* ft_arena_alloc(ft_arena* arena, size_t size)
+{
+  int c = size_class(size);
+  size_t blockSize;
+  block_header* h;
+
+  if (c == LARGE_CLASS)
+    {
+      void* block = alloc_large(arena, size);
+      if (block != NULL)
+        count_alloc(arena, size);
+      return block;
+    }
+
+  if (arena->freeLists[c] != NULL)
+    {
+      h = (block_header*)arena->freeLists[c] - 1;
+      arena->freeLists[c] = *(void**)arena->freeLists[c];
+    }
+  else
+    {
+      blockSize = sizeof(block_header) + ((size_t)SMALLEST_CLASS << c);
+      if (arena->chunks == NULL || arena->chunkUsed + blockSize > FT_ARENA_CHUNK_SIZE)
+        {
+          /* the rest of the old chunk is left unused */
+          if (add_chunk(arena) != 0)
+            return NULL;
+        }
+      h = (block_header*)(arena->chunks + arena->chunkUsed);
+      arena->chunkUsed += blockSize;
+      h->sizeClass = c;
+    }
+  h->size = size;
+  count_alloc(arena, size);
+  return h + 1;
+}
+
+void ft_arena_release(ft_arena* arena, void* block)
+{
+  block_header* h;
+
+  if (block == NULL)
+    return;
+  h = (block_header*)block - 1;
+  arena->frees++;
+  arena->bytes -= h->size;
+  if (h->sizeClass == LARGE_CLASS)
+    {
+      large_link* link = (large_link*)h - 1;
+      if (link->prev != NULL)
+        link->prev->next = link->next;
+      else
+        arena->large = link->next;
+      if (link->next != NULL)
+        link->next->prev = link->prev;
+      free(link);
+      return;
+    }
+  *(void**)block = arena->freeLists[h->sizeClass];
+  arena->freeLists[h->sizeClass] = block;
+}
+
+void* ft_arena_realloc(ft_arena* arena, void* block, size_t size)
+{
+  block_header* h;
+  void* newBlock;
+
+  if (block == NULL)
+    return ft_arena_alloc(arena, size);
+  h = (block_header*)block - 1;
+  if (h->sizeClass != LARGE_CLASS && size <= ((size_t)SMALLEST_CLASS << h->sizeClass))
+    {
+      /* still fits its class */
+      arena->bytes = arena->bytes - h->size + size;
+      count_peak(arena);
+      h->size = size;
+      return block;
+    }
+  newBlock = ft_arena_alloc(arena, size);
+  if (newBlock == NULL)
+    return NULL;
+  memcpy(newBlock, block, h->size < size ? h->size : size);
+  ft_arena_release(arena, block);
+  return newBlock;
+}
+
+/* FT_Memory callbacks */
+static void* ft_alloc(FT_Memory memory, long size)
+{
+  return ft_arena_alloc(memory->user, size);
+}
+
+static void ft_free(FT_Memory memory, void* block)
+{
+  ft_arena_release(memory->user, block);
+}
+
+static void* ft_realloc(FT_Memory memory, long curSize, long newSize, void* block)
+{
+  /* the block header knows the size */
+  (void)curSize;
+  return ft_arena_realloc(memory->user, block, newSize);
+}
+
+ft_arena* ft_arena_new(void)
+{
+  ft_arena* arena = calloc(1, sizeof(ft_arena));
+  if (arena == NULL)
+    {
+      return NULL;
+    }
+  arena->memory.user = arena;
+  arena->memory.alloc = ft_alloc;
+  arena->memory.free = ft_free;
+  arena->memory.realloc = ft_realloc;
+  return arena;
+}
+
+void ft_arena_mark(ft_arena* arena)
+{
+  arena->markAllocs = arena->allocs;
+  arena->markBytes = arena->bytes;
+  arena->markPeak = arena->bytes;
+}
+
+unsigned long ft_arena_request_allocs(const ft_arena* arena)
+{
+  return arena->allocs - arena->markAllocs;
+}
+
+size_t ft_arena_request_peak(const ft_arena* arena)
+{
+  return arena->markPeak - arena->markBytes;
+}
+
+void ft_arena_free(ft_arena* arena)
+{
+  large_link* link;
+  unsigned char* chunk;
+
+  if (arena == NULL)
+    return;
+  link = arena->large;
+  while(link != NULL)
+    {
+      large_link* next = link->next;
+      free(link);
+      link = next;
+    }
+  chunk = arena->chunks;
+  while(chunk != NULL)
+    {
+      unsigned char* next = ((chunk_header*)chunk)->next;
+      free(chunk);
+      chunk = next;
+    }
+  free(arena);
+}
+
+FT_Error ft_arena_new_library(ft_arena* arena, FT_Library* library)
+{
+  FT_Error err = FT_New_Library(&arena->memory, library);
+  if (err)
+    {
+      return err;
+    }
+  FT_Add_Default_Modules(*library);
+  FT_Set_Default_Properties(*library);
+  return 0;
+}
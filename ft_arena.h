@@ -0,0 +1,86 @@
+/*
+ * Pool allocator for FreeType and per-request temporaries.
+ *
+ * FreeType allocates many small, short-lived blocks while loading and
+ * rasterizing glyphs. An ft_arena serves them from 64 KB chunks, in
+ * power of two size classes from 16 bytes to 4 KB; freed blocks go onto
+ * a free list of their class and are reused, so malloc is only called
+ * for new chunks and for larger blocks. The arena's FT_Memory hands
+ * this to a FreeType library created with ft_arena_new_library().
+ *
+ * Request code may take its own temporaries from the same arena.
+ * Counters of allocations, live bytes and peak bytes are kept, in
+ * total and since the last ft_arena_mark(), which callers serving many
+ * requests on one library call at the start of each.
+ *
+ * An arena is not thread-safe; give every thread its own.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef FT_ARENA_H
+#define FT_ARENA_H
+
+#include <stddef.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_SYSTEM_H
+#include FT_MODULE_H
+
+#define FT_ARENA_CHUNK_SIZE (64 * 1024)
+/* size classes 16, 32, ..., 4096 bytes; larger blocks use malloc */
+#define FT_ARENA_CLASSES 9
+
+typedef struct ft_arena
+{
+  /* memory.user points back to the arena */
+  struct FT_MemoryRec_ memory;
+
+  /* chunks, newest first; blocks are cut from the head chunk */
+  unsigned char* chunks;
+  size_t chunkUsed;
+  void* freeLists[FT_ARENA_CLASSES];
+  /* blocks above the largest class, for ft_arena_free() */
+  void* large;
+
+  unsigned long allocs;
+  unsigned long frees;
+  unsigned long chunkCount;
+  size_t bytes; /* requested bytes in live blocks */
+  size_t peak;
+
+  /* at the last ft_arena_mark() */
+  unsigned long markAllocs;
+  size_t markBytes;
+  size_t markPeak; /* most live bytes since then */
+} ft_arena;
+
+ft_arena* ft_arena_new(void);
+void ft_arena_free(ft_arena* arena);
+
+/*
+ * Start counting one request. Faces and caches outlive requests, so
+ * their blocks stay; only the counters below start over.
+ */
+void ft_arena_mark(ft_arena* arena);
+/* allocations since the last ft_arena_mark() */
+unsigned long ft_arena_request_allocs(const ft_arena* arena);
+/* most bytes live at once since the last ft_arena_mark(), beyond those live then */
+size_t ft_arena_request_peak(const ft_arena* arena);
+
+/* blocks for request code; contents are undefined. NULL when out of memory */
+void* ft_arena_alloc(ft_arena* arena, size_t size);
+void ft_arena_release(ft_arena* arena, void* block);
+void* ft_arena_realloc(ft_arena* arena, void* block, size_t size);
+
+/*
+ * Create a FreeType library with the default modules whose memory comes
+ * from arena. Free it with FT_Done_Library(), before the arena.
+ */
+FT_Error ft_arena_new_library(ft_arena* arena, FT_Library* library);
+
+#endif
@@ -0,0 +1,637 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "glyph_atlas.h"
+#include "span_render.h"
+
+#define INITIAL_BUCKET_COUNT 256
+/* empty pixels around every glyph */
+#define GLYPH_BORDER 1
+
+glyph_atlas* glyph_atlas_new(int pageSize, int maxPages)
+{
+  glyph_atlas* atlas;
+
+  if (pageSize <= 2 * GLYPH_BORDER || maxPages <= 0)
+    {
+      fprintf(stderr, "ERROR: bad atlas size\n");
+      return NULL;
+    }
+  atlas = calloc(1, sizeof(glyph_atlas));
+  if (atlas == NULL)
+    {
+      return NULL;
+    }
+  atlas->pageSize = pageSize;
+  atlas->maxPages = maxPages;
+  atlas->pages = calloc(maxPages, sizeof(glyph_atlas_page));
+  atlas->bucketCount = INITIAL_BUCKET_COUNT;
+  atlas->buckets = calloc(atlas->bucketCount, sizeof(glyph_atlas_entry*));
+  if (atlas->pages == NULL || atlas->buckets == NULL)
+    {
+      free(atlas->pages);
+      free(atlas->buckets);
+      free(atlas);
+      return NULL;
+    }
+  return atlas;
+}
+
+glyph_atlas* glyph_atlas_new_offline(int pageSize, int maxPages)
+{
+  glyph_atlas* atlas = glyph_atlas_new(pageSize, maxPages);
+  if (atlas != NULL)
+    atlas->offline = 1;
+  return atlas;
+}
+
+static void free_entries(glyph_atlas_entry* e)
+{
+  glyph_atlas_entry* next;
+  for(; e != NULL; e = next)
+    {
+      next = e->pageNext;
+      free(e);
+    }
+}
+
+void glyph_atlas_free(glyph_atlas* atlas)
+{
+  unsigned int b;
+  int i;
+
+  if (atlas == NULL)
+    return;
+  /* blank glyphs are only reachable through the table */
+  for(b = 0; b < atlas->bucketCount; b++)
+    {
+      glyph_atlas_entry* e;
+      glyph_atlas_entry* next;
+      for(e = atlas->buckets[b]; e != NULL; e = next)
+        {
+          next = e->hashNext;
+          if (e->page < 0)
+            free(e);
+        }
+    }
+  for(i = 0; i < atlas->pageCount; i++)
+    {
+      if (atlas->offline)
+        free(atlas->pages[i].pixels);
+      else
+        glDeleteTextures(1, &atlas->pages[i].texture);
+      free(atlas->pages[i].skyline);
+      free_entries(atlas->pages[i].entries);
+    }
+  free(atlas->pages);
+  free(atlas->buckets);
+  free(atlas->scratch);
+  free(atlas);
+}
+
+static unsigned int hash_key(FT_Face face, unsigned int glyphIndex,
+                             FT_Fixed xScale, FT_Fixed yScale)
+{
+  uint32_t h = 2166136261u;
+  h = (h ^ (uint32_t)(uintptr_t)face) * 16777619u;
+  h = (h ^ glyphIndex) * 16777619u;
+  h = (h ^ (uint32_t)xScale) * 16777619u;
+  h = (h ^ (uint32_t)yScale) * 16777619u;
+  return h;
+}
+
+static void hash_insert(glyph_atlas* atlas, glyph_atlas_entry* e)
+{
+  unsigned int b = hash_key(e->face, e->glyphIndex, e->xScale, e->yScale)
+    & (atlas->bucketCount - 1);
+  e->hashNext = atlas->buckets[b];
+  atlas->buckets[b] = e;
+  atlas->count++;
+}
+
+static void hash_remove(glyph_atlas* atlas, glyph_atlas_entry* e)
+{
+  unsigned int b = hash_key(e->face, e->glyphIndex, e->xScale, e->yScale)
+    & (atlas->bucketCount - 1);
+  glyph_atlas_entry** p = &atlas->buckets[b];
+  while(*p != NULL && *p != e)
+    {
+      p = &(*p)->hashNext;
+    }
+  if (*p == e)
+    {
+      *p = e->hashNext;
+      atlas->count--;
+    }
+}
+
+static void grow_buckets(glyph_atlas* atlas)
+{
+  unsigned int newCount = atlas->bucketCount * 2;
+  glyph_atlas_entry** newBuckets = calloc(newCount, sizeof(glyph_atlas_entry*));
+  unsigned int i;
+
+  /* keep the old table if we are short of memory; lookups still work */
+  if (newBuckets == NULL)
+    return;
+  for(i = 0; i < atlas->bucketCount; i++)
+    {
+      glyph_atlas_entry* e;
+      glyph_atlas_entry* next;
+      for(e = atlas->buckets[i]; e != NULL; e = next)
+        {
+          unsigned int b = hash_key(e->face, e->glyphIndex, e->xScale, e->yScale)
+            & (newCount - 1);
+          next = e->hashNext;
+          e->hashNext = newBuckets[b];
+          newBuckets[b] = e;
+        }
+    }
+  free(atlas->buckets);
+  atlas->buckets = newBuckets;
+  atlas->bucketCount = newCount;
+}
+
+/*
+ * Skyline packing
+ * The skyline is the top edge of the used area of a page, stored as
+ * horizontal segments sorted by x. A rectangle is placed on the segment
+ * where its top ends lowest (ties go to the narrower segment), then the
+ * segments it covers are cut away.
+ */
+static void skyline_reset(glyph_atlas* atlas, glyph_atlas_page* page)
+{
+  page->skyline[0].x = 0;
+  page->skyline[0].y = 0;
+  page->skyline[0].width = atlas->pageSize;
+  page->nodeCount = 1;
+}
+
+/* y at which a w*h rectangle starting at node i rests, or -1 */
+static int skyline_fit(glyph_atlas* atlas, glyph_atlas_page* page, int i, int w, int h)
+{
+  int x = page->skyline[i].x;
+  int y = 0;
+  int left = w;
+
+  if (x + w > atlas->pageSize)
+    return -1;
+  while(left > 0)
+    {
+      if (page->skyline[i].y > y)
+        y = page->skyline[i].y;
+      if (y + h > atlas->pageSize)
+        return -1;
+      left -= page->skyline[i].width;
+      i++;
+    }
+  return y;
+}
+
+/* find a place for a w*h rectangle; returns 0 and sets *outX, *outY */
+static int skyline_pack(glyph_atlas* atlas, glyph_atlas_page* page, int w, int h,
+                        int* outX, int* outY)
+{
+  skyline_node* nodes = page->skyline;
+  int best = -1;
+  int bestTop = 0;
+  int bestWidth = 0;
+  int i, j;
+
+  for(i = 0; i < page->nodeCount; i++)
+    {
+      int y = skyline_fit(atlas, page, i, w, h);
+      if (y < 0)
+        continue;
+      if (best < 0 || y + h < bestTop || (y + h == bestTop && nodes[i].width < bestWidth))
+        {
+          best = i;
+          bestTop = y + h;
+          bestWidth = nodes[i].width;
+        }
+    }
+  if (best < 0)
+    return -1;
+
+  /* the new segment, then shrink or drop the ones below it */
+  *outX = nodes[best].x;
+  *outY = bestTop - h;
+  memmove(&nodes[best + 1], &nodes[best], (page->nodeCount - best) * sizeof(skyline_node));
+  nodes[best].x = *outX;
+  nodes[best].y = bestTop;
+  nodes[best].width = w;
+  page->nodeCount++;
+
+  for(i = best + 1; i < page->nodeCount; i++)
+    {
+      int end = nodes[best].x + nodes[best].width;
+      if (nodes[i].x >= end)
+        break;
+      if (nodes[i].x + nodes[i].width <= end)
+        {
+          memmove(&nodes[i], &nodes[i + 1], (page->nodeCount - i - 1) * sizeof(skyline_node));
+          page->nodeCount--;
+          i--;
+        }
+      else
+        {
+          nodes[i].width -= end - nodes[i].x;
+          nodes[i].x = end;
+          break;
+        }
+    }
+
+  /* merge neighbours at the same height */
+  for(i = 0, j = 1; j < page->nodeCount; j++)
+    {
+      if (nodes[i].y == nodes[j].y)
+        nodes[i].width += nodes[j].width;
+      else
+        nodes[++i] = nodes[j];
+    }
+  page->nodeCount = i + 1;
+  return 0;
+}
+
+static int add_page(glyph_atlas* atlas)
+{
+  glyph_atlas_page* page = &atlas->pages[atlas->pageCount];
+  unsigned char* zeros;
+
+  /* a skyline never has more segments than pixels in a row */
+  page->skyline = malloc(sizeof(skyline_node) * (atlas->pageSize + 1));
+  zeros = calloc(1, (size_t)atlas->pageSize * atlas->pageSize);
+  if (page->skyline == NULL || zeros == NULL)
+    {
+      free(page->skyline);
+      free(zeros);
+      page->skyline = NULL;
+      return -1;
+    }
+  skyline_reset(atlas, page);
+  if (atlas->offline)
+    {
+      page->pixels = zeros;
+      return atlas->pageCount++;
+    }
+
+  glGenTextures(1, &page->texture);
+  glBindTexture(GL_TEXTURE_2D, page->texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0,
+               GL_R8, atlas->pageSize, atlas->pageSize,
+               0, GL_RED, GL_UNSIGNED_BYTE, zeros);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  free(zeros);
+  return atlas->pageCount++;
+}
+
+/*
+ * Drop every glyph of a page. The texture is not cleared: each glyph is
+ * uploaded together with its border, so stale pixels are never sampled.
+ */
+static void empty_page(glyph_atlas* atlas, glyph_atlas_page* page)
+{
+  glyph_atlas_entry* e;
+  for(e = page->entries; e != NULL; e = e->pageNext)
+    {
+      hash_remove(atlas, e);
+    }
+  free_entries(page->entries);
+  page->entries = NULL;
+  skyline_reset(atlas, page);
+  atlas->evictions++;
+}
+
+/* place a w*h rectangle (border included) somewhere; returns the page */
+static int place(glyph_atlas* atlas, int w, int h, int* x, int* y)
+{
+  int i;
+  int lru = 0;
+
+  for(i = 0; i < atlas->pageCount; i++)
+    {
+      if (skyline_pack(atlas, &atlas->pages[i], w, h, x, y) == 0)
+        return i;
+    }
+  if (atlas->pageCount < atlas->maxPages)
+    {
+      i = add_page(atlas);
+      if (i < 0)
+        return -1;
+      return skyline_pack(atlas, &atlas->pages[i], w, h, x, y) == 0 ? i : -1;
+    }
+  if (atlas->offline)
+    return -1;
+  for(i = 1; i < atlas->pageCount; i++)
+    {
+      if (atlas->pages[i].lastUse < atlas->pages[lru].lastUse)
+        lru = i;
+    }
+  empty_page(atlas, &atlas->pages[lru]);
+  return skyline_pack(atlas, &atlas->pages[lru], w, h, x, y) == 0 ? lru : -1;
+}
+
+/*
+ * Copy a bitmap into the scratch upload area, or when outline is given,
+ * rasterize it right there instead.
+ */
+static int upload_glyph(glyph_atlas* atlas, glyph_atlas_entry* e,
+                        const unsigned char* buffer, int pitch,
+                        FT_Library library, FT_Outline* outline)
+{
+  int w = e->width + 2 * GLYPH_BORDER;
+  int h = e->rows + 2 * GLYPH_BORDER;
+  int x, y, i;
+
+  e->page = place(atlas, w, h, &x, &y);
+  if (e->page < 0)
+    {
+      return -1;
+    }
+  if ((size_t)w * h > atlas->scratchSize)
+    {
+      unsigned char* newScratch = realloc(atlas->scratch, (size_t)w * h);
+      if (newScratch == NULL)
+        return -1;
+      atlas->scratch = newScratch;
+      atlas->scratchSize = (size_t)w * h;
+    }
+  memset(atlas->scratch, 0, (size_t)w * h);
+  if (outline != NULL)
+    {
+      span_target target;
+      target.buffer = atlas->scratch + GLYPH_BORDER * w + GLYPH_BORDER;
+      target.pitch = w;
+      target.width = e->width;
+      target.rows = e->rows;
+      target.originX = -e->left;
+      target.originY = e->top;
+      if (span_render_outline(library, outline, &target) != 0)
+        return -1;
+    }
+  else
+    {
+      /* pitch may be padded or negative (bottom-up) */
+      for(i = 0; i < e->rows; i++)
+        {
+          const unsigned char* src = pitch >= 0
+            ? buffer + i * pitch
+            : buffer + (e->rows - 1 - i) * -pitch;
+          memcpy(atlas->scratch + (i + GLYPH_BORDER) * w + GLYPH_BORDER, src, e->width);
+        }
+    }
+  if (atlas->offline)
+    {
+      for(i = 0; i < h; i++)
+        {
+          memcpy(atlas->pages[e->page].pixels + (size_t)(y + i) * atlas->pageSize + x,
+                 atlas->scratch + (size_t)i * w, w);
+        }
+    }
+  else
+    {
+      glBindTexture(GL_TEXTURE_2D, atlas->pages[e->page].texture);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RED, GL_UNSIGNED_BYTE, atlas->scratch);
+    }
+
+  e->x = x + GLYPH_BORDER;
+  e->y = y + GLYPH_BORDER;
+  e->u0 = (float)e->x / atlas->pageSize;
+  e->v0 = (float)e->y / atlas->pageSize;
+  e->u1 = (float)(e->x + e->width) / atlas->pageSize;
+  e->v1 = (float)(e->y + e->rows) / atlas->pageSize;
+  return 0;
+}
+
+const glyph_atlas_entry* glyph_atlas_find(glyph_atlas* atlas, FT_Face face,
+                                          unsigned int glyphIndex)
+{
+  FT_Fixed xScale = face->size->metrics.x_scale;
+  FT_Fixed yScale = face->size->metrics.y_scale;
+  unsigned int h = hash_key(face, glyphIndex, xScale, yScale);
+  glyph_atlas_entry* e;
+
+  atlas->clock++;
+  for(e = atlas->buckets[h & (atlas->bucketCount - 1)]; e != NULL; e = e->hashNext)
+    {
+      if (e->face == face && e->glyphIndex == glyphIndex
+          && e->xScale == xScale && e->yScale == yScale)
+        {
+          atlas->hits++;
+          if (e->page >= 0)
+            atlas->pages[e->page].lastUse = atlas->clock;
+          return e;
+        }
+    }
+  return NULL;
+}
+
+static const glyph_atlas_entry* add_entry(glyph_atlas* atlas, FT_Face face,
+                                          unsigned int glyphIndex,
+                                          const unsigned char* buffer, int pitch,
+                                          FT_Library library, FT_Outline* outline,
+                                          int width, int rows, int left, int top)
+{
+  const glyph_atlas_entry* found;
+  glyph_atlas_entry* e;
+
+  found = glyph_atlas_find(atlas, face, glyphIndex);
+  if (found != NULL)
+    {
+      return found;
+    }
+  if (width + 2 * GLYPH_BORDER > atlas->pageSize || rows + 2 * GLYPH_BORDER > atlas->pageSize)
+    {
+      fprintf(stderr, "ERROR: glyph %u does not fit into the atlas\n", glyphIndex);
+      return NULL;
+    }
+
+  e = calloc(1, sizeof(glyph_atlas_entry));
+  if (e == NULL)
+    {
+      return NULL;
+    }
+  e->face = face;
+  e->glyphIndex = glyphIndex;
+  e->xScale = face->size->metrics.x_scale;
+  e->yScale = face->size->metrics.y_scale;
+  e->left = left;
+  e->top = top;
+  e->width = width;
+  e->rows = rows;
+  e->page = -1;
+  if (e->width > 0 && e->rows > 0)
+    {
+      if (upload_glyph(atlas, e, buffer, pitch, library, outline) != 0)
+        {
+          free(e);
+          return NULL;
+        }
+      e->pageNext = atlas->pages[e->page].entries;
+      atlas->pages[e->page].entries = e;
+      atlas->pages[e->page].lastUse = atlas->clock;
+    }
+
+  if (atlas->count >= atlas->bucketCount * 2)
+    grow_buckets(atlas);
+  hash_insert(atlas, e);
+  return e;
+}
+
+const glyph_atlas_entry* glyph_atlas_put(glyph_atlas* atlas, FT_Face face,
+                                         unsigned int glyphIndex,
+                                         const unsigned char* buffer, int pitch,
+                                         int width, int rows, int left, int top)
+{
+  return add_entry(atlas, face, glyphIndex, buffer, pitch, NULL, NULL,
+                   width, rows, left, top);
+}
+
+const glyph_atlas_entry* glyph_atlas_get(glyph_atlas* atlas, FT_Face face,
+                                         unsigned int glyphIndex)
+{
+  const glyph_atlas_entry* found;
+  FT_GlyphSlot slot;
+
+  found = glyph_atlas_find(atlas, face, glyphIndex);
+  if (found != NULL)
+    {
+      return found;
+    }
+
+  atlas->misses++;
+  if (FT_Load_Glyph(face, glyphIndex, FT_LOAD_DEFAULT))
+    {
+      return NULL;
+    }
+  slot = face->glyph;
+  if (slot->format == FT_GLYPH_FORMAT_OUTLINE)
+    {
+      /* rasterized straight into the upload area, no slot bitmap */
+      int left, top, width, rows;
+      span_outline_box(&slot->outline, 0, &left, &top, &width, &rows);
+      return add_entry(atlas, face, glyphIndex, NULL, 0, slot->library, &slot->outline,
+                       width, rows, left, top);
+    }
+  if (FT_Render_Glyph(slot, FT_RENDER_MODE_NORMAL))
+    {
+      return NULL;
+    }
+  return glyph_atlas_put(atlas, face, glyphIndex, slot->bitmap.buffer, slot->bitmap.pitch,
+                         slot->bitmap.width, slot->bitmap.rows,
+                         slot->bitmap_left, slot->bitmap_top);
+}
+
+int glyph_atlas_add_baked(glyph_atlas* atlas, FT_Face face, const baked_atlas* baked, int size)
+{
+  const baked_atlas_size* s = &baked->sizes[size];
+  /* atlas page of every baked page, -1 for pages of other sizes */
+  int* pageMap;
+  uint32_t i;
+  int added = 0;
+
+  if (baked->header->pageSize != (uint32_t)atlas->pageSize || atlas->offline
+      || atlas->pageCount + baked_atlas_size_pages(baked, size) > atlas->maxPages)
+    {
+      fprintf(stderr, "ERROR: baked atlas does not fit into the atlas\n");
+      return -1;
+    }
+  pageMap = malloc(sizeof(int) * (baked->header->pageCount + 1));
+  if (pageMap == NULL)
+    return -1;
+  for(i = 0; i < baked->header->pageCount; i++)
+    {
+      pageMap[i] = -1;
+    }
+  for(i = s->firstGlyph; i < s->firstGlyph + s->glyphCount; i++)
+    {
+      int bakedPage = baked->glyphs[i].page;
+      glyph_atlas_page* page;
+
+      if (bakedPage < 0 || pageMap[bakedPage] >= 0)
+        continue;
+      page = &atlas->pages[atlas->pageCount];
+      page->skyline = malloc(sizeof(skyline_node) * (atlas->pageSize + 1));
+      if (page->skyline == NULL)
+        {
+          free(pageMap);
+          return -1;
+        }
+      /* a full page until it is emptied */
+      page->skyline[0].x = 0;
+      page->skyline[0].y = atlas->pageSize;
+      page->skyline[0].width = atlas->pageSize;
+      page->nodeCount = 1;
+      page->lastUse = atlas->clock;
+
+      /* uploaded from the mapping, with no copy */
+      glGenTextures(1, &page->texture);
+      glBindTexture(GL_TEXTURE_2D, page->texture);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      glTexImage2D(GL_TEXTURE_2D, 0,
+                   GL_R8, atlas->pageSize, atlas->pageSize,
+                   0, GL_RED, GL_UNSIGNED_BYTE, baked_atlas_page(baked, bakedPage));
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      pageMap[bakedPage] = atlas->pageCount++;
+    }
+
+  for(i = s->firstGlyph; i < s->firstGlyph + s->glyphCount; i++)
+    {
+      const baked_atlas_glyph* g = &baked->glyphs[i];
+      glyph_atlas_entry* e;
+
+      /* code points sharing a glyph are baked once per code point */
+      if (glyph_atlas_find(atlas, face, g->glyphIndex) != NULL)
+        continue;
+      e = calloc(1, sizeof(glyph_atlas_entry));
+      if (e == NULL)
+        {
+          free(pageMap);
+          return -1;
+        }
+      e->face = face;
+      e->glyphIndex = g->glyphIndex;
+      e->xScale = face->size->metrics.x_scale;
+      e->yScale = face->size->metrics.y_scale;
+      e->page = g->page < 0 ? -1 : pageMap[g->page];
+      e->x = g->x;
+      e->y = g->y;
+      e->width = g->width;
+      e->rows = g->rows;
+      e->left = g->left;
+      e->top = g->top;
+      e->u0 = g->u0;
+      e->v0 = g->v0;
+      e->u1 = g->u1;
+      e->v1 = g->v1;
+      if (e->page >= 0)
+        {
+          e->pageNext = atlas->pages[e->page].entries;
+          atlas->pages[e->page].entries = e;
+        }
+      if (atlas->count >= atlas->bucketCount * 2)
+        grow_buckets(atlas);
+      hash_insert(atlas, e);
+      added++;
+    }
+  free(pageMap);
+  return added;
+}
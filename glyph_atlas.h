@@ -0,0 +1,159 @@
+/*
+ * Glyph texture atlas for OpenGL.
+ *
+ * Glyph coverage bitmaps are packed into a few large single channel
+ * (GL_R8) textures, called pages, with a skyline packer. Each glyph gets
+ * a 1 pixel empty border so linear filtering does not bleed between
+ * neighbours. Placed glyphs are found through a hash table keyed by
+ * (face, glyph index, size).
+ *
+ * When no page has room for a new glyph and the page limit is reached,
+ * the least recently used page is emptied and all of its glyphs are
+ * dropped from the table.
+ *
+ * An offline atlas (glyph_atlas_new_offline()) packs the same way into
+ * pages kept in memory, without GL, and never evicts; it is used to
+ * bake atlases ahead of time (see baked_atlas.h). Baked pages are
+ * loaded back with glyph_atlas_add_baked().
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef GLYPH_ATLAS_H
+#define GLYPH_ATLAS_H
+
+#include <GL/glew.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "baked_atlas.h"
+
+typedef struct glyph_atlas_entry
+{
+  /* key */
+  FT_Face face;
+  unsigned int glyphIndex;
+  FT_Fixed xScale;
+  FT_Fixed yScale;
+
+  /* page index, or -1 for blank glyphs which take no space */
+  int page;
+  /* glyph rectangle in the page, in pixels, without the border */
+  int x;
+  int y;
+  int width;
+  int rows;
+  /* bitmap_left and bitmap_top of the glyph */
+  int left;
+  int top;
+  /* texture coordinates; v0 is the top row of the glyph */
+  float u0, v0, u1, v1;
+
+  struct glyph_atlas_entry* hashNext;
+  struct glyph_atlas_entry* pageNext;
+} glyph_atlas_entry;
+
+typedef struct skyline_node
+{
+  int x;
+  int y;
+  int width;
+} skyline_node;
+
+typedef struct glyph_atlas_page
+{
+  GLuint texture;
+  /* pageSize * pageSize pixels of an offline atlas, else NULL */
+  unsigned char* pixels;
+  skyline_node* skyline;
+  int nodeCount;
+  glyph_atlas_entry* entries;
+  unsigned long lastUse;
+} glyph_atlas_page;
+
+typedef struct glyph_atlas
+{
+  int pageSize;
+  int maxPages;
+  int pageCount;
+  glyph_atlas_page* pages;
+  /* pages are in memory, see glyph_atlas_new_offline() */
+  int offline;
+
+  glyph_atlas_entry** buckets;
+  unsigned int bucketCount;
+  unsigned int count;
+
+  /* bordered bitmap being uploaded */
+  unsigned char* scratch;
+  size_t scratchSize;
+  unsigned long clock;
+
+  unsigned long hits;
+  unsigned long misses;
+  /* pages emptied to make room */
+  unsigned long evictions;
+} glyph_atlas;
+
+/*
+ * Create an atlas of up to maxPages square textures, pageSize pixels
+ * wide. Pages are created on demand. Needs a current GL context.
+ */
+glyph_atlas* glyph_atlas_new(int pageSize, int maxPages);
+/*
+ * Same, with the pages in memory (glyph_atlas_page.pixels) and no GL
+ * calls. When all pages are full, glyphs fail to be added instead of a
+ * page being emptied, so entries stay valid until the atlas is freed.
+ */
+glyph_atlas* glyph_atlas_new_offline(int pageSize, int maxPages);
+void glyph_atlas_free(glyph_atlas* atlas);
+
+/*
+ * Look up a glyph, rendering and uploading it on a miss. The size is
+ * taken from face->size. Outlines are rasterized directly into the
+ * upload area. Uploading changes the GL_TEXTURE_2D binding.
+ *
+ * A miss may empty a page, which frees the entries placed in it, so
+ * entries stay valid only until the next call that increases
+ * atlas->evictions. Returns NULL when the glyph cannot be rendered or
+ * does not fit into a page.
+ */
+const glyph_atlas_entry* glyph_atlas_get(glyph_atlas* atlas, FT_Face face,
+                                         unsigned int glyphIndex);
+
+/*
+ * Add a bitmap rendered elsewhere (for example a distance field) under
+ * the given key; the size part of the key is taken from face->size.
+ * pitch may be negative for bottom-up bitmaps. If the key is already
+ * present, the existing entry is returned. Eviction works as in
+ * glyph_atlas_get().
+ */
+const glyph_atlas_entry* glyph_atlas_put(glyph_atlas* atlas, FT_Face face,
+                                         unsigned int glyphIndex,
+                                         const unsigned char* buffer, int pitch,
+                                         int width, int rows, int left, int top);
+
+/*
+ * Like glyph_atlas_get(), but returns NULL instead of rendering on a
+ * miss. Never evicts, so callers with pending draws that sample the
+ * atlas can flush them before calling glyph_atlas_get() on a miss.
+ */
+const glyph_atlas_entry* glyph_atlas_find(glyph_atlas* atlas, FT_Face face,
+                                          unsigned int glyphIndex);
+
+/*
+ * Add the glyphs a baked atlas has at size (an index), keyed by face,
+ * which must be the baked font set to that size, and upload the pages
+ * they are on straight from the mapping; pages of other sizes are left
+ * alone. Baked pages take atlas pages and are full for new glyphs; they
+ * are evicted like any other page. The atlas must have the baked page
+ * size and room for baked_atlas_size_pages() more pages. Returns the
+ * number of glyphs added, or -1 on failure.
+ */
+int glyph_atlas_add_baked(glyph_atlas* atlas, FT_Face face, const baked_atlas* baked, int size);
+
+#endif
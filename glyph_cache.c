@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "glyph_cache.h"
+#include "span_render.h"
+
+#define INITIAL_BUCKET_COUNT 256
+
+glyph_cache* glyph_cache_new(size_t maxBytes)
+{
+  glyph_cache* cache = calloc(1, sizeof(glyph_cache));
+  if (cache == NULL)
+    {
+      return NULL;
+    }
+  cache->bucketCount = INITIAL_BUCKET_COUNT;
+  cache->buckets = calloc(cache->bucketCount, sizeof(glyph_cache_entry*));
+  if (cache->buckets == NULL)
+    {
+      free(cache);
+      return NULL;
+    }
+  cache->maxBytes = maxBytes;
+  return cache;
+}
+
+glyph_cache* glyph_cache_new_mono(size_t maxBytes)
+{
+  glyph_cache* cache = glyph_cache_new(maxBytes);
+  if (cache != NULL)
+    cache->mono = 1;
+  return cache;
+}
+
+void glyph_cache_free(glyph_cache* cache)
+{
+  glyph_cache_entry* e;
+  glyph_cache_entry* next;
+
+  if (cache == NULL)
+    return;
+  for(e = cache->lruHead; e != NULL; e = next)
+    {
+      next = e->lruNext;
+      free(e->buffer);
+      free(e);
+    }
+  free(cache->buckets);
+  free(cache);
+}
+
+void glyph_cache_split_position(int x26_6, int* pixel, int* phase)
+{
+  /* floor, also for negative positions */
+  int p = x26_6 >= 0 ? x26_6 / 64 : -((-x26_6 + 63) / 64);
+  *pixel = p;
+  *phase = (x26_6 - p * 64) * GLYPH_CACHE_SUBPIXEL_STEPS / 64;
+}
+
+static unsigned int hash_key(FT_Face face, unsigned int glyphIndex,
+                             FT_Fixed xScale, FT_Fixed yScale, int phase)
+{
+  uint32_t h = 2166136261u;
+  h = (h ^ (uint32_t)(uintptr_t)face) * 16777619u;
+  h = (h ^ glyphIndex) * 16777619u;
+  h = (h ^ (uint32_t)xScale) * 16777619u;
+  h = (h ^ (uint32_t)yScale) * 16777619u;
+  h = (h ^ (uint32_t)phase) * 16777619u;
+  return h;
+}
+
+static void lru_unlink(glyph_cache* cache, glyph_cache_entry* e)
+{
+  if (e->lruPrev != NULL)
+    e->lruPrev->lruNext = e->lruNext;
+  else
+    cache->lruHead = e->lruNext;
+  if (e->lruNext != NULL)
+    e->lruNext->lruPrev = e->lruPrev;
+  else
+    cache->lruTail = e->lruPrev;
+  e->lruPrev = NULL;
+  e->lruNext = NULL;
+}
+
+static void lru_push_front(glyph_cache* cache, glyph_cache_entry* e)
+{
+  e->lruPrev = NULL;
+  e->lruNext = cache->lruHead;
+  if (cache->lruHead != NULL)
+    cache->lruHead->lruPrev = e;
+  cache->lruHead = e;
+  if (cache->lruTail == NULL)
+    cache->lruTail = e;
+}
+
+static void hash_remove(glyph_cache* cache, glyph_cache_entry* e)
+{
+  unsigned int b = hash_key(e->face, e->glyphIndex, e->xScale, e->yScale, e->phase)
+    & (cache->bucketCount - 1);
+  glyph_cache_entry** p = &cache->buckets[b];
+  while(*p != NULL && *p != e)
+    {
+      p = &(*p)->hashNext;
+    }
+  if (*p == e)
+    *p = e->hashNext;
+}
+
+static void grow_buckets(glyph_cache* cache)
+{
+  unsigned int newCount = cache->bucketCount * 2;
+  glyph_cache_entry** newBuckets = calloc(newCount, sizeof(glyph_cache_entry*));
+  glyph_cache_entry* e;
+
+  /* keep the old table if we are short of memory; lookups still work */
+  if (newBuckets == NULL)
+    return;
+  for(e = cache->lruHead; e != NULL; e = e->lruNext)
+    {
+      unsigned int b = hash_key(e->face, e->glyphIndex, e->xScale, e->yScale, e->phase)
+        & (newCount - 1);
+      e->hashNext = newBuckets[b];
+      newBuckets[b] = e;
+    }
+  free(cache->buckets);
+  cache->buckets = newBuckets;
+  cache->bucketCount = newCount;
+}
+
+static void evict_until(glyph_cache* cache, size_t limit)
+{
+  while(cache->bytes > limit && cache->lruTail != NULL)
+    {
+      glyph_cache_entry* victim = cache->lruTail;
+      lru_unlink(cache, victim);
+      hash_remove(cache, victim);
+      cache->bytes -= victim->bytes;
+      cache->count--;
+      cache->evictions++;
+      free(victim->buffer);
+      free(victim);
+    }
+}
+
+/*
+ * Load and render a glyph shifted right by the given phase into a new
+ * entry. Outlines are rasterized straight into the entry's buffer;
+ * mono glyphs and bitmap strikes go through the glyph slot and are
+ * copied out of it.
+ */
+static glyph_cache_entry* render_entry(FT_Face face, unsigned int glyphIndex, int phase,
+                                       int mono)
+{
+  FT_GlyphSlot slot;
+  FT_Bitmap* bmp;
+  glyph_cache_entry* e;
+  int i;
+
+  if (FT_Load_Glyph(face, glyphIndex, mono ? FT_LOAD_TARGET_MONO : FT_LOAD_DEFAULT))
+    {
+      return NULL;
+    }
+  slot = face->glyph;
+  e = calloc(1, sizeof(glyph_cache_entry));
+  if (e == NULL)
+    {
+      return NULL;
+    }
+
+  if (!mono && slot->format == FT_GLYPH_FORMAT_OUTLINE)
+    {
+      FT_Pos shift = phase * 64 / GLYPH_CACHE_SUBPIXEL_STEPS;
+      span_target target;
+
+      span_outline_box(&slot->outline, shift, &e->left, &e->top, &e->width, &e->rows);
+      e->pitch = e->width;
+      if (e->width > 0 && e->rows > 0)
+        {
+          e->buffer = calloc((size_t)e->width * e->rows, 1);
+          if (e->buffer == NULL)
+            {
+              free(e);
+              return NULL;
+            }
+          if (shift != 0)
+            FT_Outline_Translate(&slot->outline, shift, 0);
+          target.buffer = e->buffer;
+          target.pitch = e->pitch;
+          target.width = e->width;
+          target.rows = e->rows;
+          target.originX = -e->left;
+          target.originY = e->top;
+          if (span_render_outline(slot->library, &slot->outline, &target) != 0)
+            {
+              free(e->buffer);
+              free(e);
+              return NULL;
+            }
+        }
+      e->bytes = sizeof(glyph_cache_entry) + (size_t)e->pitch * e->rows;
+      return e;
+    }
+
+  if (FT_Render_Glyph(slot, mono ? FT_RENDER_MODE_MONO : FT_RENDER_MODE_NORMAL))
+    {
+      free(e);
+      return NULL;
+    }
+  bmp = &slot->bitmap;
+  e->left = slot->bitmap_left;
+  e->top = slot->bitmap_top;
+  e->width = bmp->width;
+  e->rows = bmp->rows;
+  e->pitch = mono ? (e->width + 7) / 8 : e->width;
+  if (e->width > 0 && e->rows > 0)
+    {
+      e->buffer = malloc((size_t)e->pitch * e->rows);
+      if (e->buffer == NULL)
+        {
+          free(e);
+          return NULL;
+        }
+      /* pitch may be padded or negative (bottom-up) */
+      for(i = 0; i < e->rows; i++)
+        {
+          const unsigned char* src = bmp->pitch >= 0
+            ? bmp->buffer + i * bmp->pitch
+            : bmp->buffer + (e->rows - 1 - i) * -bmp->pitch;
+          memcpy(e->buffer + i * e->pitch, src, e->pitch);
+        }
+    }
+  e->bytes = sizeof(glyph_cache_entry) + (size_t)e->pitch * e->rows;
+  return e;
+}
+
+static glyph_cache_entry* find_entry(glyph_cache* cache, FT_Face face, unsigned int glyphIndex,
+                                     FT_Fixed xScale, FT_Fixed yScale, int phase, unsigned int h)
+{
+  glyph_cache_entry* e;
+
+  for(e = cache->buckets[h & (cache->bucketCount - 1)]; e != NULL; e = e->hashNext)
+    {
+      if (e->face == face && e->glyphIndex == glyphIndex
+          && e->xScale == xScale && e->yScale == yScale && e->phase == phase)
+        {
+          return e;
+        }
+    }
+  return NULL;
+}
+
+const glyph_cache_entry* glyph_cache_get(glyph_cache* cache, FT_Face face,
+                                         unsigned int glyphIndex, int phase)
+{
+  FT_Fixed xScale = face->size->metrics.x_scale;
+  FT_Fixed yScale = face->size->metrics.y_scale;
+  unsigned int h;
+  glyph_cache_entry* e;
+
+  if (cache->mono)
+    phase = 0;
+  h = hash_key(face, glyphIndex, xScale, yScale, phase);
+  e = find_entry(cache, face, glyphIndex, xScale, yScale, phase, h);
+  if (e != NULL)
+    {
+      cache->hits++;
+      lru_unlink(cache, e);
+      lru_push_front(cache, e);
+      return e;
+    }
+
+  cache->misses++;
+  if (cache->stats != NULL)
+    {
+      double start = render_stats_now();
+      e = render_entry(face, glyphIndex, phase, cache->mono);
+      render_stats_add(cache->stats, RENDER_STAGE_GLYPH, render_stats_now() - start);
+    }
+  else
+    {
+      e = render_entry(face, glyphIndex, phase, cache->mono);
+    }
+  if (e == NULL)
+    {
+      return NULL;
+    }
+  e->face = face;
+  e->glyphIndex = glyphIndex;
+  e->xScale = xScale;
+  e->yScale = yScale;
+  e->phase = phase;
+
+  /* make room first, so the new entry itself is never evicted here */
+  if (e->bytes < cache->maxBytes)
+    evict_until(cache, cache->maxBytes - e->bytes);
+  else
+    evict_until(cache, 0);
+
+  if (cache->count >= cache->bucketCount * 2)
+    grow_buckets(cache);
+  h &= cache->bucketCount - 1;
+  e->hashNext = cache->buckets[h];
+  cache->buckets[h] = e;
+  lru_push_front(cache, e);
+  cache->bytes += e->bytes;
+  cache->count++;
+  return e;
+}
+
+int glyph_cache_get_box(glyph_cache* cache, FT_Face face, unsigned int glyphIndex,
+                        int phase, int* left, int* top, int* width, int* rows)
+{
+  FT_Fixed xScale = face->size->metrics.x_scale;
+  FT_Fixed yScale = face->size->metrics.y_scale;
+  unsigned int h;
+  const glyph_cache_entry* e;
+  FT_GlyphSlot slot;
+
+  if (cache->mono)
+    phase = 0;
+  h = hash_key(face, glyphIndex, xScale, yScale, phase);
+  e = find_entry(cache, face, glyphIndex, xScale, yScale, phase, h);
+  if (e == NULL && cache->mono)
+    {
+      e = glyph_cache_get(cache, face, glyphIndex, phase);
+      if (e == NULL)
+        return -1;
+    }
+  if (e != NULL)
+    {
+      *left = e->left;
+      *top = e->top;
+      *width = e->width;
+      *rows = e->rows;
+      return 0;
+    }
+
+  if (FT_Load_Glyph(face, glyphIndex, FT_LOAD_DEFAULT))
+    {
+      return -1;
+    }
+  slot = face->glyph;
+  if (slot->format == FT_GLYPH_FORMAT_OUTLINE)
+    {
+      /* the smooth rasterizer renders into the pixel-aligned control box */
+      span_outline_box(&slot->outline, phase * 64 / GLYPH_CACHE_SUBPIXEL_STEPS,
+                       left, top, width, rows);
+    }
+  else
+    {
+      /* bitmap strikes are already rendered */
+      *left = slot->bitmap_left;
+      *top = slot->bitmap_top;
+      *width = slot->bitmap.width;
+      *rows = slot->bitmap.rows;
+    }
+  return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Cache of rendered glyph coverage bitmaps.
+ *
+ * Entries are keyed by (face, glyph index, size, sub-pixel phase) and
+ * kept in LRU order. When the total size of cached bitmaps exceeds the
+ * configured limit, the least recently used entries are dropped.
+ * Outline glyphs are rasterized straight into the entry bitmap (see
+ * span_render.h).
+ *
+ * A mono cache (glyph_cache_new_mono()) holds 1-bit bitmaps instead,
+ * loaded with mono hinting and rendered with FT_RENDER_MODE_MONO.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include <stddef.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "render_stats.h"
+
+/*
+ * Horizontal pen positions are quantized into this many phases per
+ * pixel. 4 phases means glyphs are rendered at 0, 1/4, 2/4 and 3/4 pixel
+ * offsets.
+ */
+#define GLYPH_CACHE_SUBPIXEL_STEPS 4
+
+typedef struct glyph_cache_entry
+{
+  /* key */
+  FT_Face face;
+  unsigned int glyphIndex;
+  FT_Fixed xScale;
+  FT_Fixed yScale;
+  int phase;
+
+  /*
+   * value: 8-bit coverage, rows are width bytes long (no padding). In
+   * mono caches 1 bit per pixel, most significant bit first, rows are
+   * pitch bytes long and unused bits are 0.
+   */
+  int left;
+  int top;
+  int width;
+  int rows;
+  int pitch;
+  unsigned char* buffer;
+
+  /* bookkeeping */
+  size_t bytes;
+  struct glyph_cache_entry* hashNext;
+  struct glyph_cache_entry* lruPrev;
+  struct glyph_cache_entry* lruNext;
+} glyph_cache_entry;
+
+typedef struct glyph_cache
+{
+  glyph_cache_entry** buckets;
+  unsigned int bucketCount;
+  unsigned int count;
+  size_t bytes;
+  size_t maxBytes;
+  int mono;
+  /* most recently used at head */
+  glyph_cache_entry* lruHead;
+  glyph_cache_entry* lruTail;
+
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  /* when set, every miss is timed as RENDER_STAGE_GLYPH */
+  render_stats* stats;
+} glyph_cache;
+
+glyph_cache* glyph_cache_new(size_t maxBytes);
+/*
+ * Cache of 1-bit glyphs. Hinted mono glyphs are meant to sit on whole
+ * pixels, so the phase argument is ignored and always 0.
+ */
+glyph_cache* glyph_cache_new_mono(size_t maxBytes);
+void glyph_cache_free(glyph_cache* cache);
+
+/*
+ * Split a 26.6 horizontal pen position into an integer pixel position and
+ * a sub-pixel phase usable with glyph_cache_get().
+ */
+void glyph_cache_split_position(int x26_6, int* pixel, int* phase);
+
+/*
+ * Look up a glyph, rendering it with FreeType on a miss. The size is taken
+ * from face->size, so set the char size before calling this.
+ *
+ * The returned entry is owned by the cache and stays valid until the next
+ * call to glyph_cache_get() or glyph_cache_free(). NULL is returned when
+ * the glyph cannot be loaded or rendered.
+ */
+const glyph_cache_entry* glyph_cache_get(glyph_cache* cache, FT_Face face,
+                                         unsigned int glyphIndex, int phase);
+
+/*
+ * Bitmap box (bitmap_left, bitmap_top, width, rows) the glyph will have
+ * when rendered by glyph_cache_get(), without rasterizing it. Cached
+ * entries answer directly; otherwise the outline control box is used.
+ * Does not change the LRU order. Returns -1 if the glyph cannot be
+ * loaded.
+ *
+ * The mono rasterizer rounds the box in its own way, so a mono cache
+ * renders and caches the glyph instead, as glyph_cache_get() would.
+ */
+int glyph_cache_get_box(glyph_cache* cache, FT_Face face, unsigned int glyphIndex,
+                        int phase, int* left, int* top, int* width, int* rows);
+
+#endif
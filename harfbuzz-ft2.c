@@ -6,229 +6,849 @@
  * as published by Sam Hocevar. See the COPYING file for more details.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <hb.h>
 #include <hb-glib.h>
 #include <hb-ft.h>
+#include <hb-ot.h>
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
 #include <png.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <sys/mman.h>
+#include <pthread.h>
+
+#include "glyph_cache.h"
+#include "shape_cache.h"
+#include "image_writer.h"
+#include "pixel_convert.h"
+#include "text_render.h"
+#include "font_pool.h"
+#include "work_queue.h"
+#include "ft_arena.h"
+#include "fontrender.h"
+#include "render_stats.h"
+#include "font_fallback.h"
+
+/* records handed to the worker threads at once, in threaded batch mode */
+#define BATCH_CHUNK_SIZE 1024
 
 typedef unsigned char uchar;
 typedef unsigned int uint;
 
-void my_write(png_structp ps, png_bytep data, png_size_t sz)
+/* how overlapping glyphs combine, set with -m */
+composite_mode blendMode = COMPOSITE_MAX;
+
+/* output format and PNG encoder settings, set with -f */
+image_options imageOptions = IMAGE_OPTIONS_DEFAULT;
+
+/* 1-bit glyphs and output, set with -1 */
+int monoOutput = 0;
+
+/* shape and cache a word at a time, set with -w */
+int wordShaping = 0;
+
+/* rows per strip when streaming a single image, set with -s */
+int stripRows = 0;
+
+/* stderr details of a single image; 2 with -v adds every glyph */
+int verbose = 1;
+
+/* font index for characters the font lacks, set with -F */
+const char* fallbackIndexPath = NULL;
+
+/* stage timings, printed as JSON on stderr at exit with --stats */
+int statsOutput = 0;
+render_stats stats;
+
+/* FreeType of the main thread; threaded batch workers have their own */
+ft_arena* ftArena = NULL;
+FT_Library ftLib = NULL;
+
+shape_cache* new_shape_cache()
+{
+  shape_cache* shapes = shape_cache_new(FONTRENDER_SHAPE_CACHE_BYTES);
+  if (shapes != NULL)
+    shapes->splitWords = wordShaping;
+  return shapes;
+}
+
+glyph_cache* new_glyph_cache()
+{
+  if (monoOutput)
+    return glyph_cache_new_mono(FONTRENDER_GLYPH_CACHE_BYTES);
+  return glyph_cache_new(FONTRENDER_GLYPH_CACHE_BYTES);
+}
+
+/*
+ * Render text and encode it into mb with imageOptions. The image is
+ * black, only alpha carries the text; with -1 it is black on white.
+ * Returns 0 on success.
+ */
+int encode_text(hb_font_t* font, FT_Face ftFace, hb_buffer_t* buffer, shape_cache* shapes,
+                glyph_cache* cache, const char* text, int textLen, int verbose, mem_buffer* mb)
+{
+  pixel_color black = {0, 0, 0};
+  return fontrender_encode_text(font, ftFace, buffer, shapes, cache, text, textLen, blendMode,
+                                black, &imageOptions, verbose, mb);
+}
+
+/*
+ * Batch mode
+ *
+ * Records are read from stdin (or a manifest file), one text per record.
+ * Newline delimited input is the default; with -l every record is a 4 byte
+ * big-endian length followed by that many bytes of UTF-8.
+ *
+ * Without -o, images are written to stdout as a stream of frames, each a
+ * 4 byte big-endian length followed by the image data. With -o dir, record
+ * n (counting from 0) is written to dir/NNNNNN.png (or the extension of the
+ * -f format) and nothing goes to stdout.
+ *
+ * With -j, records are rendered by worker threads; the output is the same
+ * and in the same order.
+ */
+typedef struct batch_options
+{
+  const char* fontPath;
+  const char* manifestPath;
+  const char* outputDir;
+  int lengthDelimited;
+  int threads;
+} batch_options;
+
+/*
+ * Read next record into *buf (grown as needed). Returns record length, or
+ * -1 at end of input.
+ */
+int read_record(FILE* in, int lengthDelimited, char** buf, size_t* cap)
+{
+  size_t len = 0;
+
+  if (lengthDelimited)
+    {
+      uchar hdr[4];
+      if (fread(hdr, 1, 4, in) != 4)
+        return -1;
+      len = ((size_t)hdr[0] << 24) | (hdr[1] << 16) | (hdr[2] << 8) | hdr[3];
+      if (len + 1 > *cap)
+        {
+          char* newBuf = realloc(*buf, len + 1);
+          if (newBuf == NULL)
+            {
+              fprintf(stderr, "ERROR: record too large (%lu bytes)\n", (unsigned long)len);
+              return -1;
+            }
+          *buf = newBuf;
+          *cap = len + 1;
+        }
+      if (fread(*buf, 1, len, in) != len)
+        {
+          fprintf(stderr, "WARNING: truncated record\n");
+          return -1;
+        }
+      (*buf)[len] = '\0';
+      return len;
+    }
+
+  while(1)
+    {
+      int c = fgetc(in);
+      if (c == EOF)
+        {
+          if (len == 0)
+            return -1;
+          break;
+        }
+      if (c == '\n')
+        break;
+      if (len + 2 > *cap)
+        {
+          size_t newCap = *cap == 0 ? 256 : *cap * 2;
+          char* newBuf = realloc(*buf, newCap);
+          if (newBuf == NULL)
+            {
+              fprintf(stderr, "ERROR: record too large\n");
+              return -1;
+            }
+          *buf = newBuf;
+          *cap = newCap;
+        }
+      (*buf)[len++] = c;
+    }
+  if (len > 0 && (*buf)[len - 1] == '\r')
+    len--;
+  (*buf)[len] = '\0';
+  return len;
+}
+
+int write_frame(FILE* out, mem_buffer* mb)
+{
+  uchar hdr[4];
+  hdr[0] = (mb->len >> 24) & 0xff;
+  hdr[1] = (mb->len >> 16) & 0xff;
+  hdr[2] = (mb->len >> 8) & 0xff;
+  hdr[3] = mb->len & 0xff;
+  if (fwrite(hdr, 1, 4, out) != 4 || fwrite(mb->data, 1, mb->len, out) != mb->len)
+    {
+      fprintf(stderr, "WARNING: incomplete writing action.\n");
+      return -1;
+    }
+  return 0;
+}
+
+/*
+ * Write one encoded record to its destination. Returns 0 on success.
+ */
+int emit_record(batch_options* opt, uint record, mem_buffer* mb)
 {
-  fwrite(data, 1, sz, stdout);
+  if (opt->outputDir == NULL)
+    {
+      if (write_frame(stdout, mb) != 0)
+        return -1;
+      stats.bytesWritten += 4 + mb->len;
+      return 0;
+    }
+  else
+    {
+      char path[4096];
+      FILE* f;
+      int ret = 0;
+      snprintf(path, sizeof(path), "%s/%06u.%s", opt->outputDir, record,
+               image_format_extension(imageOptions.format));
+      f = fopen(path, "wb");
+      if (f == NULL)
+        {
+          fprintf(stderr, "ERROR: cannot open %s\n", path);
+          return -1;
+        }
+      if (fwrite(mb->data, 1, mb->len, f) != mb->len)
+        {
+          fprintf(stderr, "WARNING: incomplete writing action.\n");
+          ret = -1;
+        }
+      else
+        {
+          stats.bytesWritten += mb->len;
+        }
+      fclose(f);
+      return ret;
+    }
+}
+
+/* FreeType memory of the records, counted from an ft_arena_mark() before each */
+void print_ft_memory(unsigned long allocs, size_t recordPeak, uint records)
+{
+  fprintf(stderr, "FreeType memory: %lu allocations, %.1f per record, "
+          "at most %lu bytes per record.\n",
+          allocs, records > 0 ? (double)allocs / records : 0.0, (unsigned long)recordPeak);
+}
+
+FILE* open_batch_input(batch_options* opt)
+{
+  FILE* in = stdin;
+  if (opt->manifestPath != NULL)
+    {
+      in = fopen(opt->manifestPath, "rb");
+      if (in == NULL)
+        {
+          fprintf(stderr, "ERROR: cannot open manifest %s\n", opt->manifestPath);
+        }
+    }
+  return in;
 }
 
-void my_flush(png_structp ps)
+int run_batch(fontrender_font* font, batch_options* opt)
 {
+  shape_cache* shapes = font->entry->shapes;
+  glyph_cache* cache = font->entry->cache;
+  FILE* in;
+  char* text = NULL;
+  size_t textCap = 0;
+  mem_buffer mb = {NULL, 0, 0};
+  uint record = 0;
+  int failed = 0;
+  unsigned long ftAllocs = 0;
+  size_t ftRecordPeak = 0;
+  int textLen;
+
+  in = open_batch_input(opt);
+  if (in == NULL)
+    return -1;
+
+  while((textLen = read_record(in, opt->lengthDelimited, &text, &textCap)) >= 0)
+    {
+      int ret;
+
+      ft_arena_mark(ftArena);
+      ret = fontrender_encode(font, text, textLen, &imageOptions, &mb);
+      ftAllocs += ft_arena_request_allocs(ftArena);
+      if (ft_arena_request_peak(ftArena) > ftRecordPeak)
+        ftRecordPeak = ft_arena_request_peak(ftArena);
+      if (ret != 0)
+        {
+          fprintf(stderr, "ERROR: record %u: render failed\n", record);
+          failed++;
+        }
+      else if (emit_record(opt, record, &mb) != 0)
+        {
+          failed++;
+        }
+      record++;
+    }
   fflush(stdout);
+
+  fprintf(stderr, "%u records, %d failed.\n", record, failed);
+  fprintf(stderr, "Shape cache: %lu hits, %lu misses, %lu evictions.\n",
+          shapes->hits, shapes->misses, shapes->evictions);
+  fprintf(stderr, "Glyph cache: %lu hits, %lu misses, %lu evictions.\n",
+          cache->hits, cache->misses, cache->evictions);
+  print_ft_memory(ftAllocs, ftRecordPeak, record);
+  if (in != stdin)
+    fclose(in);
+  free(text);
+  free(mb.data);
+  return failed == 0 ? 0 : -1;
 }
 
-void write_png(uchar* data, int w, int h)
+/*
+ * Threaded batch mode
+ *
+ * All workers share the mmapped font through one hb_face_t. FreeType
+ * faces are not thread-safe, so every worker owns its FT_Library and a
+ * memory FT_Face on the same mapping, plus its own hb_font_t, buffer and
+ * glyph cache. Shaping uses hb-ot font funcs, which only read the shared
+ * face; glyphs are rasterized from the worker's FT_Face.
+ *
+ * Records are read in chunks. Each chunk is spread over the workers'
+ * deques, workers steal from each other when they run dry, and the main
+ * thread writes the chunk out in order once every worker is idle again.
+ */
+typedef struct batch_job
 {
-  png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-  png_infop info = png_create_info_struct(png);
-  /* depth parameter means depth-per-channel*/
-  png_set_IHDR(png, info, w, h, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE
-               , PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-  png_set_write_fn(png, NULL, my_write, my_flush);
+  char* text;
+  size_t textCap;
+  int textLen;
+  mem_buffer image;
+  int failed;
+} batch_job;
 
-  uchar** rows = malloc(sizeof(uchar*) * h);
-  int i;
-  for(i = 0; i < h; i++)
+typedef struct batch_pool
+{
+  work_queue* queue;
+  batch_job* jobs;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t done;
+  int generation; /* bumped whenever a chunk is queued */
+  int busy;       /* workers not yet done with the current chunk */
+  int quit;
+} batch_pool;
+
+typedef struct batch_worker
+{
+  int id;
+  pthread_t thread;
+  batch_pool* pool;
+  ft_arena* arena;
+  FT_Library lib;
+  FT_Face ftFace;
+  hb_font_t* font;
+  hb_buffer_t* buffer;
+  shape_cache* shapes;
+  glyph_cache* cache;
+  /* NULL without -F */
+  font_fallback* fallback;
+  /* merged into stats when the worker is done */
+  render_stats stats;
+  /* FreeType memory of the worker's records, see print_ft_memory() */
+  unsigned long ftAllocs;
+  size_t ftRecordPeak;
+} batch_worker;
+
+/* encode_text(), falling back to other faces with -F */
+int batch_worker_encode(batch_worker* wk, batch_job* job)
+{
+  pixel_color black = {0, 0, 0};
+  text_run main = {wk->font, wk->ftFace, wk->shapes, wk->cache, 0, job->textLen};
+  const text_run* runs;
+  int runCount;
+
+  if (wk->fallback == NULL || wk->cache->mono)
+    return encode_text(wk->font, wk->ftFace, wk->buffer, wk->shapes, wk->cache,
+                       job->text, job->textLen, 0, &job->image);
+  runCount = font_fallback_split(wk->fallback, &main, job->text, job->textLen, &runs);
+  if (runCount < 0)
+    return -1;
+  return fontrender_encode_runs(wk->buffer, runs, runCount, job->text, blendMode, black,
+                                &imageOptions, 0, &job->image);
+}
+
+void* batch_worker_main(void* arg)
+{
+  batch_worker* wk = arg;
+  batch_pool* pool = wk->pool;
+  int seen = 0;
+  int j;
+
+  pthread_mutex_lock(&pool->lock);
+  while(1)
+    {
+      while(pool->generation == seen && !pool->quit)
+        pthread_cond_wait(&pool->wake, &pool->lock);
+      if (pool->quit)
+        break;
+      seen = pool->generation;
+      pthread_mutex_unlock(&pool->lock);
+
+      while(work_queue_pop(pool->queue, wk->id, &j) == 0)
+        {
+          batch_job* job = &pool->jobs[j];
+          ft_arena_mark(wk->arena);
+          job->failed = batch_worker_encode(wk, job) != 0;
+          wk->ftAllocs += ft_arena_request_allocs(wk->arena);
+          if (ft_arena_request_peak(wk->arena) > wk->ftRecordPeak)
+            wk->ftRecordPeak = ft_arena_request_peak(wk->arena);
+        }
+
+      pthread_mutex_lock(&pool->lock);
+      if (--pool->busy == 0)
+        pthread_cond_signal(&pool->done);
+    }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+void batch_worker_done(batch_worker* wk);
+
+/*
+ * Give a worker its own FreeType face and harfbuzz font on the shared
+ * mapping. scale is in 26.6, like the hb font scale.
+ */
+int batch_worker_init(batch_worker* wk, hb_face_t* face, uchar* data, int dataSize,
+                      int scale, hb_unicode_funcs_t* unicodeFuncs)
+{
+  double start = render_stats_now();
+
+  wk->arena = ft_arena_new();
+  if (wk->arena == NULL || ft_arena_new_library(wk->arena, &wk->lib))
     {
-      rows[i] = &data[i * w * 4];
+      fprintf(stderr, "ERROR: init library\n");
+      ft_arena_free(wk->arena);
+      return -1;
     }
+  if (FT_New_Memory_Face(wk->lib, data, dataSize, 0, &wk->ftFace))
+    {
+      fprintf(stderr, "ERROR: when loading font\n");
+      FT_Done_Library(wk->lib);
+      ft_arena_free(wk->arena);
+      return -1;
+    }
+  FT_Set_Char_Size(wk->ftFace, scale, scale, 0, 0);
+  wk->font = hb_font_create(face);
+  hb_font_set_scale(wk->font, scale, scale);
+  hb_ot_font_set_funcs(wk->font);
+  wk->buffer = hb_buffer_create();
+  hb_buffer_set_unicode_funcs(wk->buffer, unicodeFuncs);
+  wk->shapes = new_shape_cache();
+  wk->cache = new_glyph_cache();
+  if (wk->shapes == NULL || wk->cache == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      batch_worker_done(wk);
+      return -1;
+    }
+  if (fallbackIndexPath != NULL)
+    {
+      /* every worker maps the index; the pages are shared */
+      wk->fallback = font_fallback_new(fallbackIndexPath);
+      if (wk->fallback == NULL)
+        {
+          batch_worker_done(wk);
+          return -1;
+        }
+      /* fallback faces are opened from this thread, so on its library */
+      wk->fallback->lib = wk->lib;
+      font_fallback_set_char_size(wk->fallback, scale);
+    }
+  if (statsOutput)
+    {
+      wk->shapes->stats = &wk->stats;
+      wk->cache->stats = &wk->stats;
+      if (wk->fallback != NULL)
+        font_fallback_set_stats(wk->fallback, &wk->stats);
+      render_stats_add(&wk->stats, RENDER_STAGE_FACE_LOAD, render_stats_now() - start);
+    }
+  return 0;
+}
 
-  png_write_info(png, info);
-  png_write_image(png, rows);
-  free(rows);
-  png_destroy_write_struct(&png, &info);
+void batch_worker_done(batch_worker* wk)
+{
+  font_fallback_free(wk->fallback);
+  glyph_cache_free(wk->cache);
+  shape_cache_free(wk->shapes);
+  hb_buffer_destroy(wk->buffer);
+  hb_font_destroy(wk->font);
+  FT_Done_Face(wk->ftFace);
+  FT_Done_Library(wk->lib);
+  ft_arena_free(wk->arena);
 }
 
-uchar* read_all_mmap(char* path, int* fileSize)
+int run_batch_threaded(hb_face_t* face, uchar* data, int dataSize, int scale,
+                       hb_unicode_funcs_t* unicodeFuncs, batch_options* opt)
 {
-  struct stat statBuf;
-  
-  /* Some little check.. */
-  if(stat(path, &statBuf) != 0)
+  FILE* in;
+  batch_pool pool;
+  batch_worker* workers;
+  int workerCount = opt->threads;
+  int started = 0;
+  uint record = 0;
+  int failed = 0;
+  int eof = 0;
+  unsigned long hits = 0, misses = 0;
+  unsigned long shapeHits = 0, shapeMisses = 0;
+  unsigned long ftAllocs = 0;
+  size_t ftRecordPeak = 0;
+  int i;
+
+  in = open_batch_input(opt);
+  if (in == NULL)
+    return -1;
+
+  memset(&pool, 0, sizeof(pool));
+  pool.queue = work_queue_new(workerCount, BATCH_CHUNK_SIZE);
+  pool.jobs = calloc(BATCH_CHUNK_SIZE, sizeof(batch_job));
+  workers = calloc(workerCount, sizeof(batch_worker));
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.wake, NULL);
+  pthread_cond_init(&pool.done, NULL);
+  if (pool.queue == NULL || pool.jobs == NULL || workers == NULL)
     {
-      return NULL;
+      fprintf(stderr, "ERROR: out of memory\n");
+      failed = 1;
+      eof = 1;
+    }
+
+  for(i = 0; i < workerCount && !eof; i++)
+    {
+      workers[i].id = i;
+      workers[i].pool = &pool;
+      if (batch_worker_init(&workers[i], face, data, dataSize, scale, unicodeFuncs) != 0)
+        {
+          failed = 1;
+          eof = 1;
+          break;
+        }
+      if (pthread_create(&workers[i].thread, NULL, batch_worker_main, &workers[i]) != 0)
+        {
+          fprintf(stderr, "ERROR: cannot create thread\n");
+          batch_worker_done(&workers[i]);
+          failed = 1;
+          eof = 1;
+          break;
+        }
+      started++;
+    }
+  if (!eof)
+    fprintf(stderr, "%d worker threads.\n", workerCount);
+
+  while(!eof)
+    {
+      int n = 0;
+      while(n < BATCH_CHUNK_SIZE)
+        {
+          batch_job* job = &pool.jobs[n];
+          job->textLen = read_record(in, opt->lengthDelimited, &job->text, &job->textCap);
+          if (job->textLen < 0)
+            {
+              eof = 1;
+              break;
+            }
+          n++;
+        }
+      if (n == 0)
+        break;
+
+      work_queue_clear(pool.queue);
+      for(i = 0; i < n; i++)
+        {
+          work_queue_push(pool.queue, i % workerCount, i);
+        }
+      pthread_mutex_lock(&pool.lock);
+      pool.busy = workerCount;
+      pool.generation++;
+      pthread_cond_broadcast(&pool.wake);
+      while(pool.busy > 0)
+        pthread_cond_wait(&pool.done, &pool.lock);
+      pthread_mutex_unlock(&pool.lock);
+
+      for(i = 0; i < n; i++, record++)
+        {
+          if (pool.jobs[i].failed)
+            {
+              fprintf(stderr, "ERROR: record %u: render failed\n", record);
+              failed++;
+            }
+          else if (emit_record(opt, record, &pool.jobs[i].image) != 0)
+            {
+              failed++;
+            }
+        }
     }
-  else if(!S_ISREG(statBuf.st_mode))
+  fflush(stdout);
+
+  pthread_mutex_lock(&pool.lock);
+  pool.quit = 1;
+  pthread_cond_broadcast(&pool.wake);
+  pthread_mutex_unlock(&pool.lock);
+  for(i = 0; i < started; i++)
     {
-      fprintf(stderr, "WARNING: not a file\n");
-      return NULL;
+      pthread_join(workers[i].thread, NULL);
+      hits += workers[i].cache->hits;
+      misses += workers[i].cache->misses;
+      shapeHits += workers[i].shapes->hits;
+      shapeMisses += workers[i].shapes->misses;
+      ftAllocs += workers[i].ftAllocs;
+      if (workers[i].ftRecordPeak > ftRecordPeak)
+        ftRecordPeak = workers[i].ftRecordPeak;
+      render_stats_merge(&stats, &workers[i].stats);
+      batch_worker_done(&workers[i]);
     }
-  
-  *fileSize = statBuf.st_size;
-  int fd = open(path, 0);
-  uchar* buf = mmap(NULL, *fileSize, PROT_READ, MAP_SHARED, fd, 0);
-  if (buf == NULL)
+
+  fprintf(stderr, "%u records, %d failed.\n", record, failed);
+  fprintf(stderr, "Shape cache: %lu hits, %lu misses.\n", shapeHits, shapeMisses);
+  fprintf(stderr, "Glyph cache: %lu hits, %lu misses. %lu jobs stolen.\n",
+          hits, misses, pool.queue != NULL ? pool.queue->steals : 0);
+  print_ft_memory(ftAllocs, ftRecordPeak, record);
+  if (in != stdin)
+    fclose(in);
+  for(i = 0; pool.jobs != NULL && i < BATCH_CHUNK_SIZE; i++)
     {
-      fprintf(stderr, "WARNING: mmap failed\n");
-      return NULL;
+      free(pool.jobs[i].text);
+      free(pool.jobs[i].image.data);
     }
-  close(fd);
-  return buf;
+  free(pool.jobs);
+  free(workers);
+  work_queue_free(pool.queue);
+  pthread_cond_destroy(&pool.done);
+  pthread_cond_destroy(&pool.wake);
+  pthread_mutex_destroy(&pool.lock);
+  return failed == 0 ? 0 : -1;
 }
 
-void free_mmap(uchar* buf, int len)
+void print_usage()
 {
-  munmap(buf, len);
+  fprintf(stderr, "USAGE: harfbuzz-ft2 [-m max|over] [-1] [-w] [-f format] [-s rows] [-F index] [-v] [--stats] [fontfile] [text]\n");
+  fprintf(stderr, "       harfbuzz-ft2 -b [-m max|over] [-1] [-w] [-f format] [-l] [-j threads] [-i manifest] [-o outdir] [-F index] [--stats] [fontfile]\n");
+  fprintf(stderr, "  -m mode      how overlapping glyphs combine: max (default)\n");
+  fprintf(stderr, "               or over (source-over)\n");
+  fprintf(stderr, "  -1           mono: 1-bit hinted glyphs, 1-bit black on white\n");
+  fprintf(stderr, "               PNG output\n");
+  fprintf(stderr, "  -w           shape and cache a word at a time; faster on\n");
+  fprintf(stderr, "               repetitive text, but no kerning against spaces\n");
+  fprintf(stderr, "  -f format    output format and PNG settings:\n");
+  fputs(IMAGE_OPTIONS_HELP, stderr);
+  fprintf(stderr, "  -s rows      render and write the image in strips of this\n");
+  fprintf(stderr, "               many rows, for very large images (not with -1)\n");
+  fprintf(stderr, "  -b           batch mode: render one image per input record\n");
+  fprintf(stderr, "  -l           records are length-prefixed (4 byte big-endian)\n");
+  fprintf(stderr, "               instead of newline delimited\n");
+  fprintf(stderr, "  -j threads   render with this many worker threads,\n");
+  fprintf(stderr, "               0 for one per online CPU\n");
+  fprintf(stderr, "  -i manifest  read records from manifest instead of stdin\n");
+  fprintf(stderr, "  -o outdir    write outdir/NNNNNN.png per record instead of\n");
+  fprintf(stderr, "               a length-framed image stream on stdout\n");
+  fprintf(stderr, "  -F index     render characters the font lacks with the faces\n");
+  fprintf(stderr, "               of a fontrender_index file (not with -1 or -s)\n");
+  fprintf(stderr, "  -v           also print every shaped glyph of a single image\n");
+  fprintf(stderr, "  --stats      print stage timings and counters as one JSON\n");
+  fprintf(stderr, "               object on stderr at exit\n");
+  fprintf(stderr, "fontfile may be fd:N, an inherited descriptor (e.g. a memfd). With\n");
+  fprintf(stderr, "%s=dir set, fonts are mapped from shared copies in dir.\n",
+          FONT_FILE_CACHE_ENV);
 }
 
 int main(int argc, char** argv)
 {
-  if (argc < 3)
+  int batch = 0;
+  batch_options opt = {NULL, NULL, NULL, 0, 1};
+  const char* text = NULL;
+  int argi;
+
+  for(argi = 1; argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0'; argi++)
     {
-      fprintf(stderr, "USAGE: harfbuzz-ft2 [fontfile] [text]\n");
+      if (strcmp(argv[argi], "-b") == 0)
+        batch = 1;
+      else if (strcmp(argv[argi], "-l") == 0)
+        opt.lengthDelimited = 1;
+      else if (strcmp(argv[argi], "-m") == 0 && argi + 1 < argc
+               && (strcmp(argv[argi + 1], "max") == 0 || strcmp(argv[argi + 1], "over") == 0))
+        blendMode = strcmp(argv[++argi], "over") == 0 ? COMPOSITE_OVER : COMPOSITE_MAX;
+      else if (strcmp(argv[argi], "-1") == 0)
+        monoOutput = 1;
+      else if (strcmp(argv[argi], "-w") == 0)
+        wordShaping = 1;
+      else if (strcmp(argv[argi], "-v") == 0)
+        verbose = 2;
+      else if (strcmp(argv[argi], "--stats") == 0)
+        statsOutput = 1;
+      else if (strcmp(argv[argi], "-s") == 0 && argi + 1 < argc)
+        stripRows = atoi(argv[++argi]);
+      else if (strcmp(argv[argi], "-f") == 0 && argi + 1 < argc)
+        {
+          if (image_options_parse(argv[++argi], &imageOptions) != 0)
+            return -1;
+        }
+      else if (strcmp(argv[argi], "-j") == 0 && argi + 1 < argc)
+        opt.threads = atoi(argv[++argi]);
+      else if (strcmp(argv[argi], "-i") == 0 && argi + 1 < argc)
+        opt.manifestPath = argv[++argi];
+      else if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc)
+        opt.outputDir = argv[++argi];
+      else if (strcmp(argv[argi], "-F") == 0 && argi + 1 < argc)
+        fallbackIndexPath = argv[++argi];
+      else
+        {
+          print_usage();
+          return -1;
+        }
+    }
+  if ((batch && argc - argi != 1) || (!batch && argc - argi != 2))
+    {
+      print_usage();
       return 0;
     }
+  opt.fontPath = argv[argi];
+  if (!batch)
+    text = argv[argi + 1];
+  if (opt.threads <= 0)
+    {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      opt.threads = cpus > 0 ? cpus : 1;
+    }
 
-  int dataSize;
-  uchar* data = read_all_mmap(argv[1], &dataSize);
-  if (data == NULL)
+  /* setup font */
+  fprintf(stderr, "Loading font: %s\n", opt.fontPath);
+  double loadStart = render_stats_now();
+  ftArena = ft_arena_new();
+  if (ftArena == NULL || ft_arena_new_library(ftArena, &ftLib))
+    {
+      fprintf(stderr, "ERROR: init library\n");
+      ft_arena_free(ftArena);
+      return -1;
+    }
+  fontrender_font* font = fontrender_open_library(ftLib, opt.fontPath);
+  if (font == NULL)
     {
       fprintf(stderr, "There's some problems while reading font file..\n");
+      FT_Done_Library(ftLib);
+      ft_arena_free(ftArena);
       return -1;
     }
-  
-  /* setup font */
-  fprintf(stderr, "Loading font: %s\n", argv[1]);
-  hb_blob_t* blob = hb_blob_create(data, dataSize,
-                                   HB_MEMORY_MODE_READONLY,
-                                   NULL,
-                                   NULL);
-
-  hb_face_t* face = hb_face_create(blob, 0);
-  hb_font_t* font = hb_font_create(face);
-  uint upem = hb_face_get_upem(face);
+  uint upem = hb_face_get_upem(font->entry->face);
   upem *= 5;
   fprintf(stderr, "UPEM of this font: %u\n", upem);
   fprintf(stderr, "Estimated font height (in pixel): %u\n", upem / 64);
-  hb_font_set_scale(font, upem, upem);
-  hb_ft_font_set_funcs (font);
-  
-  /* prepare the buffer */
-  hb_buffer_t* buffer = hb_buffer_create();
-  hb_unicode_funcs_t* unicodeFuncs = hb_glib_get_unicode_funcs();
-  hb_buffer_set_unicode_funcs(buffer, unicodeFuncs);
-  hb_buffer_add_utf8(buffer, argv[2], strlen(argv[2]), 0, strlen(argv[2]));
-  hb_buffer_guess_segment_properties(buffer);
-  
-  /* shaping */
-  uint infoLen, posLen;
-  hb_shape(font, buffer, NULL, 0);
-  hb_glyph_info_t* glyphInfo = hb_buffer_get_glyph_infos(buffer, &infoLen);
-  hb_glyph_position_t* glyphPos = hb_buffer_get_glyph_positions(buffer, &posLen);
-  /*
-   * Problem:
-   * How can I clean glyphInfo and glyphPos??
-   * They will be cleaned when hb_buffer_t destroyed??
-   */
-  
-  /* print shaping result */
-  fprintf(stderr, "%u glyph infos, %u glyph positions.\n", infoLen, posLen);
-  int i;
-  if(infoLen != posLen)
+  fontrender_set_char_size(font, upem);
+  font_fallback* fallback = NULL;
+  if (fallbackIndexPath != NULL && (monoOutput || (!batch && stripRows > 0)))
     {
-      fprintf(stderr, "WARNING: infoLen != posLen!!\n");
+      fprintf(stderr, "WARNING: -F is ignored with -1 and -s\n");
+      fallbackIndexPath = NULL;
     }
-  for(i = 0; i < infoLen; i++)
+  else if (fallbackIndexPath != NULL && !(batch && opt.threads > 1))
     {
-      fprintf(stderr, "Codepoint: %u\n", glyphInfo[i].codepoint);
-      fprintf(stderr, "Cluster: %u\n", glyphInfo[i].cluster);
-      fprintf(stderr, "X advance: %d\n", glyphPos[i].x_advance);
-      fprintf(stderr, "Y advance: %d\n", glyphPos[i].y_advance);
-      fprintf(stderr, "X offset: %d\n", glyphPos[i].x_offset);
-      fprintf(stderr, "Y offset: %d\n\n", glyphPos[i].y_offset);
+      fallback = font_fallback_new(fallbackIndexPath);
+      if (fallback == NULL)
+        {
+          fontrender_close(font);
+          FT_Done_Library(ftLib);
+          ft_arena_free(ftArena);
+          return -1;
+        }
+      fallback->lib = ftLib;
+      fontrender_set_fallback(font, fallback);
+    }
+  if (statsOutput)
+    {
+      render_stats_add(&stats, RENDER_STAGE_FACE_LOAD, render_stats_now() - loadStart);
+      fontrender_set_stats(font, &stats);
     }
-  
+
   /*
-   * bouncing box
-   * In current implementation, \n will be ignored.
-   *
-   * A better way to estimate boundary is do pseudorendering
-   * on all glyphs.
+   * prepare the buffer
+   * In batch mode, font, buffer and cache are shared by all records.
    */
-  FT_Face ftFace = hb_ft_font_get_face(font);
-  int w = 0;
-  int h = ftFace->size->metrics.height / 64 + 2;
-  h *= 1.5; /* make more room for arabic*/
-  int descender = ftFace->size->metrics.descender / 64;
-  if (descender < 0)
+  hb_unicode_funcs_t* unicodeFuncs = hb_glib_get_unicode_funcs();
+  hb_buffer_set_unicode_funcs(font->buffer, unicodeFuncs);
+  font->mode = blendMode;
+  fontrender_set_word_shaping(font, wordShaping);
+  if (fontrender_set_mono(font, monoOutput) != 0)
     {
-      descender = descender * (-1) + 1;
+      fprintf(stderr, "ERROR: out of memory\n");
+      fontrender_close(font);
+      font_fallback_free(fallback);
+      FT_Done_Library(ftLib);
+      ft_arena_free(ftArena);
+      return -1;
     }
-  else
+  glyph_cache* cache = font->entry->cache;
+
+  int ret = 0;
+  if (batch && opt.threads > 1)
     {
-      descender += 1;
+      ret = run_batch_threaded(font->entry->face, font->entry->data, font->entry->dataSize,
+                               upem, unicodeFuncs, &opt);
     }
-  for(i = 0; i < infoLen; i++)
+  else if (batch)
     {
-      w += glyphPos[i].x_advance;
-      /* I'm not using vertical layout.
-       * So I think there will be no y_advance.*/
+      ret = run_batch(font, &opt);
     }
-  w /= 64;
-  fprintf(stderr, "Bound: %u, %u\n", w, h);
-  
-  /*
-   * Rendering
-   * Bug:
-   * Font height is not a good measure for bounding box in arabic.
-   * (May use pseudorendering)
-   */
-  uchar* imgData = calloc(1, w * h * 4);
-  int x26_6 = 0;
-  int y26_6 = (h - descender) * 64;
-  for(i = 0; i < infoLen; i++)
-    {
-      int j, k;
-      FT_Load_Glyph(ftFace, glyphInfo[i].codepoint, FT_LOAD_DEFAULT);
-      FT_Render_Glyph(ftFace->glyph, FT_RENDER_MODE_NORMAL);
-      FT_Bitmap* bmp = &ftFace->glyph->bitmap;
-      int penY = y26_6 - ftFace->glyph->bitmap_top * 64 - glyphPos[i].y_offset;
-      penY = penY / 64;
-      int penX = x26_6 + ftFace->glyph->bitmap_left * 64 + glyphPos[i].x_offset;
-      penX = penX / 64;
-      for(j = 0; j < bmp->rows; j++)
-        {
-          for(k = 0; k < bmp->width; k++)
-            {
-              int imgPos = (w * (j + penY) + penX + k) * 4;
-              int glyphBmpPos = bmp->width * j + k;
-              if (imgPos < 0 || imgPos + 4 > w * h * 4)
-                continue;
-              if (glyphBmpPos < 0 || glyphBmpPos >= bmp->width * bmp->rows)
-                continue;
-              if (imgData[imgPos + 3] < bmp->buffer[glyphBmpPos])
-                  imgData[imgPos + 3] = bmp->buffer[glyphBmpPos];
-            }
+  else if (stripRows > 0 && !monoOutput)
+    {
+      font->verbose = verbose;
+      ft_arena_mark(ftArena);
+      ret = fontrender_stream(font, text, strlen(text), &imageOptions, stripRows, stdout);
+      fprintf(stderr, "Glyph cache: %lu hits, %lu misses, %lu evictions.\n",
+              cache->hits, cache->misses, cache->evictions);
+      print_ft_memory(ft_arena_request_allocs(ftArena), ft_arena_request_peak(ftArena), 1);
+    }
+  else
+    {
+      mem_buffer mb = {NULL, 0, 0};
+      font->verbose = verbose;
+      ft_arena_mark(ftArena);
+      ret = fontrender_encode(font, text, strlen(text), &imageOptions, &mb);
+      fprintf(stderr, "Glyph cache: %lu hits, %lu misses, %lu evictions.\n",
+              cache->hits, cache->misses, cache->evictions);
+      print_ft_memory(ft_arena_request_allocs(ftArena), ft_arena_request_peak(ftArena), 1);
+      if (ret == 0 && fwrite(mb.data, 1, mb.len, stdout) != mb.len)
+        {
+          fprintf(stderr, "WARNING: incomplete writing action.\n");
+          ret = -1;
+        }
+      else if (ret == 0)
+        {
+          stats.bytesWritten += mb.len;
         }
-      x26_6 += glyphPos[i].x_advance;
+      free(mb.data);
     }
-  write_png(imgData, w, h);
-  free(imgData);
-  
+  if (statsOutput)
+    render_stats_print_json(&stats, stderr);
+
+  if (fallback != NULL)
+    fprintf(stderr, "Fallback faces: %lu opened, %lu unusable.\n",
+            fallback->opened, fallback->failures);
+
   /* cleanup */
-  /*
-   * FT_Done_Face is not needed, since harfbuzz will do that.
-   */
   hb_unicode_funcs_destroy(unicodeFuncs);
-  hb_buffer_destroy(buffer);
-  hb_font_destroy(font);
-  hb_face_destroy(face);
-  hb_blob_destroy(blob);
-  free_mmap(data, dataSize);
-  return 0;
+  fontrender_close(font);
+  font_fallback_free(fallback);
+  FT_Done_Library(ftLib);
+  ft_arena_free(ftArena);
+  return ret;
 }
@@ -0,0 +1,832 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+/* sysconf() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "image_writer.h"
+#include "png_parallel.h"
+
+typedef struct named_value
+{
+  const char* name;
+  int value;
+} named_value;
+
+static const named_value pngFilters[] =
+  {
+    {"none", PNG_FILTER_NONE},
+    {"sub", PNG_FILTER_SUB},
+    {"up", PNG_FILTER_UP},
+    {"avg", PNG_FILTER_AVG},
+    {"paeth", PNG_FILTER_PAETH},
+    {"all", PNG_ALL_FILTERS},
+    {NULL, 0}
+  };
+
+static const named_value zlibStrategies[] =
+  {
+    {"default", Z_DEFAULT_STRATEGY},
+    {"filtered", Z_FILTERED},
+    {"huffman", Z_HUFFMAN_ONLY},
+    {"rle", Z_RLE},
+    {NULL, 0}
+  };
+
+static int find_value(const named_value* table, const char* name, int* value)
+{
+  for(; table->name != NULL; table++)
+    {
+      if (strcmp(table->name, name) == 0)
+        {
+          *value = table->value;
+          return 0;
+        }
+    }
+  return -1;
+}
+
+int image_options_parse(const char* spec, image_options* opt)
+{
+  image_options defaults = IMAGE_OPTIONS_DEFAULT;
+  const char* p;
+
+  *opt = defaults;
+  if (strcmp(spec, "raw") == 0)
+    opt->format = IMAGE_FORMAT_RAW;
+  else if (strcmp(spec, "pgm") == 0)
+    opt->format = IMAGE_FORMAT_PGM;
+  else if (strcmp(spec, "qoi") == 0)
+    opt->format = IMAGE_FORMAT_QOI;
+  if (opt->format != IMAGE_FORMAT_PNG)
+    return 0;
+  if (strncmp(spec, "png", 3) != 0 || (spec[3] != '\0' && spec[3] != ':'))
+    {
+      fprintf(stderr, "ERROR: unknown image format %s\n", spec);
+      return -1;
+    }
+
+  for(p = spec[3] == ':' ? spec + 4 : spec + 3; *p != '\0'; )
+    {
+      char item[16];
+      size_t len = strcspn(p, ",");
+      if (len == 0 || len >= sizeof(item))
+        {
+          fprintf(stderr, "ERROR: bad PNG option in %s\n", spec);
+          return -1;
+        }
+      memcpy(item, p, len);
+      item[len] = '\0';
+      p += len;
+      if (*p == ',')
+        p++;
+
+      if (len == 1 && item[0] >= '0' && item[0] <= '9')
+        opt->level = item[0] - '0';
+      else if (strcmp(item, "rgba") == 0)
+        opt->pngColor = IMAGE_PNG_RGBA;
+      else if (strcmp(item, "ga") == 0)
+        opt->pngColor = IMAGE_PNG_GRAY_ALPHA;
+      else if (strcmp(item, "palette") == 0)
+        opt->pngColor = IMAGE_PNG_PALETTE;
+      else if (strcmp(item, "fast") == 0)
+        {
+          opt->level = 1;
+          opt->filter = PNG_FILTER_UP;
+          opt->strategy = Z_RLE;
+        }
+      else if (strcmp(item, "small") == 0)
+        {
+          opt->level = 9;
+          opt->filter = PNG_ALL_FILTERS;
+        }
+      else if (item[0] == 'j' && strspn(item + 1, "0123456789") == len - 1)
+        {
+          long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+          if (len > 4 || (len > 1 && (atoi(item + 1) <= 0
+                                      || atoi(item + 1) > PNG_PARALLEL_MAX_THREADS)))
+            {
+              fprintf(stderr, "ERROR: thread count in %s is not 1 to %d\n", spec,
+                      PNG_PARALLEL_MAX_THREADS);
+              return -1;
+            }
+          if (len > 1)
+            opt->threads = atoi(item + 1);
+          else
+            opt->threads = cpus < 1 ? 1 : cpus > PNG_PARALLEL_MAX_THREADS
+              ? PNG_PARALLEL_MAX_THREADS : cpus;
+        }
+      else if (find_value(pngFilters, item, &opt->filter) != 0
+               && find_value(zlibStrategies, item, &opt->strategy) != 0)
+        {
+          fprintf(stderr, "ERROR: unknown PNG option %s\n", item);
+          return -1;
+        }
+    }
+  return 0;
+}
+
+const char* image_format_extension(image_format format)
+{
+  switch(format)
+    {
+    case IMAGE_FORMAT_RAW:
+      return "cov";
+    case IMAGE_FORMAT_PGM:
+      return "pgm";
+    case IMAGE_FORMAT_QOI:
+      return "qoi";
+    default:
+      return "png";
+    }
+}
+
+void png_apply_options(png_structp png, const image_options* opt)
+{
+  if (opt == NULL)
+    return;
+  if (opt->level >= 0)
+    png_set_compression_level(png, opt->level);
+  if (opt->filter >= 0)
+    png_set_filter(png, PNG_FILTER_TYPE_BASE, opt->filter);
+  if (opt->strategy >= 0)
+    png_set_compression_strategy(png, opt->strategy);
+}
+
+/* make room for need more bytes after len */
+static int mem_reserve(mem_buffer* mb, size_t need)
+{
+  size_t newCap = mb->cap == 0 ? 4096 : mb->cap;
+  unsigned char* newData;
+
+  if (mb->len + need <= mb->cap)
+    return 0;
+  while(newCap < mb->len + need)
+    newCap *= 2;
+  newData = realloc(mb->data, newCap);
+  if (newData == NULL)
+    return -1;
+  mb->data = newData;
+  mb->cap = newCap;
+  return 0;
+}
+
+static void put_be32(unsigned char* p, unsigned int v)
+{
+  p[0] = (v >> 24) & 0xff;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+}
+
+void my_write(png_structp ps, png_bytep data, png_size_t sz)
+{
+  if (fwrite(data, 1, sz, (FILE*)png_get_io_ptr(ps)) != sz)
+    {
+      fprintf(stderr, "WARNING: incomplete writing action.\n");
+    }
+}
+
+void my_flush(png_structp ps)
+{
+  fflush((FILE*)png_get_io_ptr(ps));
+}
+
+void mem_write(png_structp ps, png_bytep data, png_size_t sz)
+{
+  mem_buffer* mb = png_get_io_ptr(ps);
+  if (mem_reserve(mb, sz) != 0)
+    {
+      png_error(ps, "out of memory");
+    }
+  memcpy(mb->data + mb->len, data, sz);
+  mb->len += sz;
+}
+
+void mem_flush(png_structp ps)
+{
+}
+
+int write_png(unsigned char* data, int w, int h, const image_options* opt,
+              png_rw_ptr writeFn, png_flush_ptr flushFn, void* io)
+{
+  png_structp png;
+  png_infop info = NULL;
+  unsigned char** rows;
+  int i;
+
+  rows = malloc(sizeof(unsigned char*) * h);
+  if (rows == NULL)
+    return -1;
+  png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (png != NULL)
+    info = png_create_info_struct(png);
+  if (png == NULL || info == NULL)
+    {
+      png_destroy_write_struct(&png, &info);
+      free(rows);
+      return -1;
+    }
+  /* libpng errors, such as mem_write() out of memory, end up here */
+  if (setjmp(png_jmpbuf(png)))
+    {
+      png_destroy_write_struct(&png, &info);
+      free(rows);
+      return -1;
+    }
+
+  /* depth parameter means depth-per-channel*/
+  png_set_IHDR(png, info, w, h, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE
+               , PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  png_set_write_fn(png, io, writeFn, flushFn);
+  png_apply_options(png, opt);
+
+  for(i = 0; i < h; i++)
+    {
+      rows[i] = &data[(size_t)i * w * 4];
+    }
+
+  png_write_info(png, info);
+  png_write_image(png, rows);
+  png_write_end(png, NULL);
+  free(rows);
+  png_destroy_write_struct(&png, &info);
+  return 0;
+}
+
+/*
+ * Create a png write struct for a coverage image in the layout of
+ * opt->pngColor and write the header. *row gets a buffer for one
+ * converted row (NULL for palette, whose rows are the coverage).
+ * Returns NULL when libpng fails or runs out of memory. The jmpbuf set
+ * here is gone on return, so callers set their own before writing rows.
+ */
+static png_structp png_begin_coverage(int w, int h, pixel_color color,
+                                      const image_options* opt,
+                                      png_rw_ptr writeFn, png_flush_ptr flushFn, void* io,
+                                      png_infop* outInfo, unsigned char** row)
+{
+  png_structp png;
+  png_infop info;
+  int i;
+
+  *row = NULL;
+  if (opt->pngColor != IMAGE_PNG_PALETTE)
+    {
+      *row = malloc((size_t)w * (opt->pngColor == IMAGE_PNG_GRAY_ALPHA ? 2 : 4));
+      if (*row == NULL)
+        return NULL;
+    }
+  png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  info = png != NULL ? png_create_info_struct(png) : NULL;
+  if (png == NULL || info == NULL)
+    {
+      png_destroy_write_struct(&png, &info);
+      free(*row);
+      *row = NULL;
+      return NULL;
+    }
+  /* libpng errors, such as mem_write() out of memory, end up here */
+  if (setjmp(png_jmpbuf(png)))
+    {
+      png_destroy_write_struct(&png, &info);
+      free(*row);
+      *row = NULL;
+      return NULL;
+    }
+
+  if (opt->pngColor == IMAGE_PNG_PALETTE)
+    {
+      png_color palette[256];
+      png_byte alpha[256];
+      for(i = 0; i < 256; i++)
+        {
+          palette[i].red = color.r;
+          palette[i].green = color.g;
+          palette[i].blue = color.b;
+          alpha[i] = i;
+        }
+      png_set_IHDR(png, info, w, h, 8, PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE
+                   , PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+      png_set_PLTE(png, info, palette, 256);
+      png_set_tRNS(png, info, alpha, 256, NULL);
+    }
+  else
+    {
+      png_set_IHDR(png, info, w, h, 8,
+                   opt->pngColor == IMAGE_PNG_GRAY_ALPHA ? PNG_COLOR_TYPE_GRAY_ALPHA
+                   : PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE
+                   , PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    }
+  png_set_write_fn(png, io, writeFn, flushFn);
+  png_apply_options(png, opt);
+
+  png_write_info(png, info);
+  *outInfo = info;
+  return png;
+}
+
+/* convert and write one coverage row; row comes from png_begin_coverage() */
+static void png_write_coverage_row(png_structp png, const unsigned char* src, int w,
+                                   pixel_color color, const image_options* opt,
+                                   unsigned char* row)
+{
+  if (opt->pngColor == IMAGE_PNG_PALETTE)
+    {
+      png_write_row(png, src);
+      return;
+    }
+  if (opt->pngColor == IMAGE_PNG_GRAY_ALPHA)
+    convert_coverage_gray_alpha(row, src, w, pixel_color_gray(color));
+  else
+    convert_coverage_rgba(row, src, w, color);
+  png_write_row(png, row);
+}
+
+int write_png_coverage(const unsigned char* cov, int w, int h, pixel_color color,
+                       const image_options* opt,
+                       png_rw_ptr writeFn, png_flush_ptr flushFn, void* io)
+{
+  png_structp png;
+  png_infop info;
+  unsigned char* row;
+  int i;
+
+  png = png_begin_coverage(w, h, color, opt, writeFn, flushFn, io, &info, &row);
+  if (png == NULL)
+    return -1;
+  if (setjmp(png_jmpbuf(png)))
+    {
+      png_destroy_write_struct(&png, &info);
+      free(row);
+      return -1;
+    }
+  for(i = 0; i < h; i++)
+    {
+      png_write_coverage_row(png, &cov[(size_t)i * w], w, color, opt, row);
+    }
+  png_write_end(png, NULL);
+  png_destroy_write_struct(&png, &info);
+  free(row);
+  return 0;
+}
+
+/*
+ * QOI encoder, see https://qoiformat.org/qoi-specification.pdf
+ * The color is constant, so most pixels are runs, index hits or RGBA
+ * ops that only change alpha.
+ */
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+
+/* worst case bytes for n pixels: an RGBA op each */
+#define QOI_MAX_BYTES(n) ((n) * 5)
+
+static void qoi_init(qoi_state* q)
+{
+  memset(q->index, 0, sizeof(q->index));
+  q->prev[0] = q->prev[1] = q->prev[2] = 0;
+  q->prev[3] = 255;
+  q->run = 0;
+}
+
+static unsigned char* qoi_put_header(unsigned char* p, int w, int h)
+{
+  memcpy(p, "qoif", 4);
+  put_be32(p + 4, w);
+  put_be32(p + 8, h);
+  p[12] = 4; /* RGBA */
+  p[13] = 0; /* sRGB with linear alpha */
+  return p + 14;
+}
+
+/*
+ * Encode n more pixels at p, returns the new end. A pending run is only
+ * written out by qoi_finish(), so pixels may come in any number of calls.
+ */
+static unsigned char* qoi_encode_pixels(qoi_state* q, const unsigned char* cov, size_t n,
+                                        pixel_color color, unsigned char* p)
+{
+  size_t i;
+
+  for(i = 0; i < n; i++)
+    {
+      unsigned char px[4] = {color.r, color.g, color.b, cov[i]};
+      if (memcmp(px, q->prev, 4) == 0)
+        {
+          q->run++;
+          if (q->run == 62)
+            {
+              *p++ = QOI_OP_RUN | (q->run - 1);
+              q->run = 0;
+            }
+          continue;
+        }
+      if (q->run > 0)
+        {
+          *p++ = QOI_OP_RUN | (q->run - 1);
+          q->run = 0;
+        }
+      int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+      if (memcmp(q->index[hash], px, 4) == 0)
+        {
+          *p++ = QOI_OP_INDEX | hash;
+        }
+      else
+        {
+          memcpy(q->index[hash], px, 4);
+          if (px[3] == q->prev[3])
+            {
+              signed char dr = px[0] - q->prev[0];
+              signed char dg = px[1] - q->prev[1];
+              signed char db = px[2] - q->prev[2];
+              signed char drg = dr - dg;
+              signed char dbg = db - dg;
+              if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                {
+                  *p++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                }
+              else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+                {
+                  *p++ = QOI_OP_LUMA | (dg + 32);
+                  *p++ = (drg + 8) << 4 | (dbg + 8);
+                }
+              else
+                {
+                  *p++ = QOI_OP_RGB;
+                  *p++ = px[0];
+                  *p++ = px[1];
+                  *p++ = px[2];
+                }
+            }
+          else
+            {
+              *p++ = QOI_OP_RGBA;
+              memcpy(p, px, 4);
+              p += 4;
+            }
+        }
+      memcpy(q->prev, px, 4);
+    }
+  return p;
+}
+
+/* flush the pending run and write the end marker; needs 9 bytes */
+static unsigned char* qoi_finish(qoi_state* q, unsigned char* p)
+{
+  if (q->run > 0)
+    {
+      *p++ = QOI_OP_RUN | (q->run - 1);
+      q->run = 0;
+    }
+  memcpy(p, "\0\0\0\0\0\0\0\1", 8);
+  return p + 8;
+}
+
+static int encode_qoi(const unsigned char* cov, int w, int h, pixel_color color,
+                      mem_buffer* out)
+{
+  size_t n = (size_t)w * h;
+  qoi_state q;
+  unsigned char* p;
+
+  /* header, worst case, pending run and end marker */
+  if (mem_reserve(out, 14 + QOI_MAX_BYTES(n) + 9) != 0)
+    return -1;
+  qoi_init(&q);
+  p = qoi_put_header(out->data, w, h);
+  p = qoi_encode_pixels(&q, cov, n, color, p);
+  p = qoi_finish(&q, p);
+  out->len = p - out->data;
+  return 0;
+}
+
+/* png_parallel output into a mem_buffer */
+static int mem_parallel_write(void* io, const unsigned char* data, size_t len)
+{
+  mem_buffer* mb = io;
+  if (mem_reserve(mb, len) != 0)
+    return -1;
+  memcpy(mb->data + mb->len, data, len);
+  mb->len += len;
+  return 0;
+}
+
+static int encode_png_parallel(const unsigned char* cov, int w, int h, pixel_color color,
+                               const image_options* opt, mem_buffer* out)
+{
+  png_parallel p;
+  int ret;
+
+  if (png_parallel_begin(&p, w, h, color, opt, mem_parallel_write, out) != 0)
+    return -1;
+  ret = png_parallel_write(&p, cov, h);
+  if (png_parallel_end(&p) != 0)
+    ret = -1;
+  return ret;
+}
+
+int encode_image(const image_options* opt, const unsigned char* cov, int w, int h,
+                 pixel_color color, mem_buffer* out)
+{
+  size_t n = (size_t)w * h;
+  int headerLen;
+
+  out->len = 0;
+  switch(opt->format)
+    {
+    case IMAGE_FORMAT_RAW:
+      if (mem_reserve(out, 12 + n) != 0)
+        return -1;
+      memcpy(out->data, "COV8", 4);
+      put_be32(out->data + 4, w);
+      put_be32(out->data + 8, h);
+      memcpy(out->data + 12, cov, n);
+      out->len = 12 + n;
+      return 0;
+
+    case IMAGE_FORMAT_PGM:
+      if (mem_reserve(out, 32 + n) != 0)
+        return -1;
+      headerLen = snprintf((char*)out->data, 32, "P5\n%d %d\n255\n", w, h);
+      memcpy(out->data + headerLen, cov, n);
+      out->len = headerLen + n;
+      return 0;
+
+    case IMAGE_FORMAT_QOI:
+      return encode_qoi(cov, w, h, color, out);
+
+    default:
+      if (opt->threads > 0)
+        return encode_png_parallel(cov, w, h, color, opt, out);
+      return write_png_coverage(cov, w, h, color, opt, mem_write, mem_flush, out);
+    }
+}
+
+static int write_png_mono(const unsigned char* bits, int stride, int w, int h,
+                          const image_options* opt, mem_buffer* out)
+{
+  png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  png_infop info = png != NULL ? png_create_info_struct(png) : NULL;
+  int i;
+
+  if (png == NULL || info == NULL)
+    {
+      png_destroy_write_struct(&png, &info);
+      return -1;
+    }
+  /* libpng errors, such as mem_write() out of memory, end up here */
+  if (setjmp(png_jmpbuf(png)))
+    {
+      png_destroy_write_struct(&png, &info);
+      return -1;
+    }
+
+  png_set_IHDR(png, info, w, h, 1, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE
+               , PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  png_set_write_fn(png, out, mem_write, mem_flush);
+  png_apply_options(png, opt);
+  png_write_info(png, info);
+  /* ink bits are 1, but in gray 1 is white */
+  png_set_invert_mono(png);
+  for(i = 0; i < h; i++)
+    {
+      png_write_row(png, &bits[(size_t)i * stride]);
+    }
+  png_write_end(png, NULL);
+  png_destroy_write_struct(&png, &info);
+  return 0;
+}
+
+int encode_image_mono(const image_options* opt, const unsigned char* bits, int stride,
+                      int w, int h, pixel_color color, mem_buffer* out)
+{
+  size_t rowBytes = (size_t)(w + 7) / 8;
+  unsigned char* cov;
+  int i, j, ret;
+
+  out->len = 0;
+  switch(opt->format)
+    {
+    case IMAGE_FORMAT_RAW:
+      if (mem_reserve(out, 12 + rowBytes * h) != 0)
+        return -1;
+      memcpy(out->data, "COV1", 4);
+      put_be32(out->data + 4, w);
+      put_be32(out->data + 8, h);
+      for(i = 0; i < h; i++)
+        {
+          memcpy(out->data + 12 + rowBytes * i, &bits[(size_t)i * stride], rowBytes);
+        }
+      out->len = 12 + rowBytes * h;
+      return 0;
+
+    case IMAGE_FORMAT_PGM:
+    case IMAGE_FORMAT_QOI:
+      cov = malloc((size_t)w * h);
+      if (cov == NULL)
+        return -1;
+      for(i = 0; i < h; i++)
+        {
+          const unsigned char* row = &bits[(size_t)i * stride];
+          for(j = 0; j < w; j++)
+            {
+              cov[(size_t)i * w + j] = (row[j >> 3] & (0x80 >> (j & 7))) ? 255 : 0;
+            }
+        }
+      ret = encode_image(opt, cov, w, h, color, out);
+      free(cov);
+      return ret;
+
+    default:
+      return write_png_mono(bits, stride, w, h, opt, out);
+    }
+}
+
+static int stream_put(image_stream* s, const unsigned char* data, size_t len)
+{
+  if (fwrite(data, 1, len, s->out) != len)
+    {
+      fprintf(stderr, "WARNING: incomplete writing action.\n");
+      return -1;
+    }
+  s->bytes += len;
+  return 0;
+}
+
+/* libpng output of an image_stream, counted like the other formats */
+static void stream_png_write(png_structp ps, png_bytep data, png_size_t sz)
+{
+  stream_put((image_stream*)png_get_io_ptr(ps), data, sz);
+}
+
+static void stream_png_flush(png_structp ps)
+{
+  fflush(((image_stream*)png_get_io_ptr(ps))->out);
+}
+
+static int stream_parallel_write(void* io, const unsigned char* data, size_t len)
+{
+  return stream_put(io, data, len);
+}
+
+int image_stream_begin(image_stream* s, const image_options* opt, int w, int h,
+                       pixel_color color, FILE* out)
+{
+  unsigned char header[32];
+  int headerLen;
+
+  memset(s, 0, sizeof(image_stream));
+  s->opt = *opt;
+  s->color = color;
+  s->w = w;
+  s->h = h;
+  s->out = out;
+  switch(opt->format)
+    {
+    case IMAGE_FORMAT_RAW:
+      memcpy(header, "COV8", 4);
+      put_be32(header + 4, w);
+      put_be32(header + 8, h);
+      headerLen = 12;
+      break;
+
+    case IMAGE_FORMAT_PGM:
+      headerLen = snprintf((char*)header, sizeof(header), "P5\n%d %d\n255\n", w, h);
+      break;
+
+    case IMAGE_FORMAT_QOI:
+      qoi_init(&s->qoi);
+      headerLen = qoi_put_header(header, w, h) - header;
+      break;
+
+    default:
+      if (opt->threads > 0)
+        {
+          s->parallel = malloc(sizeof(png_parallel));
+          if (s->parallel == NULL)
+            return -1;
+          if (png_parallel_begin(s->parallel, w, h, color, &s->opt, stream_parallel_write,
+                                 s) != 0)
+            {
+              free(s->parallel);
+              s->parallel = NULL;
+              return -1;
+            }
+          return 0;
+        }
+      s->png = png_begin_coverage(w, h, color, &s->opt, stream_png_write, stream_png_flush,
+                                  s, &s->info, &s->row);
+      return s->png == NULL ? -1 : 0;
+    }
+  return stream_put(s, header, headerLen);
+}
+
+int image_stream_write(image_stream* s, const unsigned char* cov, int n)
+{
+  size_t len = (size_t)s->w * n;
+  unsigned char* p;
+  int i;
+
+  if (n < 0 || s->y + n > s->h)
+    {
+      fprintf(stderr, "ERROR: more rows than the image has\n");
+      return -1;
+    }
+  if (s->failed)
+    return -1;
+  s->y += n;
+  switch(s->opt.format)
+    {
+    case IMAGE_FORMAT_RAW:
+    case IMAGE_FORMAT_PGM:
+      return stream_put(s, cov, len);
+
+    case IMAGE_FORMAT_QOI:
+      /* a run pending from the last call is written before these pixels */
+      if (QOI_MAX_BYTES(len) + 1 > s->chunkCap)
+        {
+          unsigned char* newChunk = realloc(s->chunk, QOI_MAX_BYTES(len) + 1);
+          if (newChunk == NULL)
+            return -1;
+          s->chunk = newChunk;
+          s->chunkCap = QOI_MAX_BYTES(len) + 1;
+        }
+      p = qoi_encode_pixels(&s->qoi, cov, len, s->color, s->chunk);
+      return stream_put(s, s->chunk, p - s->chunk);
+
+    default:
+      if (s->parallel != NULL)
+        return png_parallel_write(s->parallel, cov, n);
+      /* the struct is left alone after an error, image_stream_end() frees it */
+      if (setjmp(png_jmpbuf(s->png)))
+        {
+          s->failed = 1;
+          return -1;
+        }
+      for(i = 0; i < n; i++)
+        {
+          png_write_coverage_row(s->png, &cov[(size_t)i * s->w], s->w, s->color, &s->opt,
+                                 s->row);
+        }
+      return 0;
+    }
+}
+
+int image_stream_end(image_stream* s)
+{
+  unsigned char tail[9];
+  int ret = 0;
+
+  if (s->failed)
+    {
+      ret = -1;
+    }
+  else if (s->y != s->h)
+    {
+      fprintf(stderr, "ERROR: image ended after %d of %d rows\n", s->y, s->h);
+      ret = -1;
+    }
+  if (s->opt.format == IMAGE_FORMAT_QOI && ret == 0)
+    {
+      ret = stream_put(s, tail, qoi_finish(&s->qoi, tail) - tail);
+    }
+  else if (s->png != NULL)
+    {
+      if (ret == 0)
+        {
+          if (setjmp(png_jmpbuf(s->png)))
+            ret = -1;
+          else
+            png_write_end(s->png, NULL);
+        }
+      png_destroy_write_struct(&s->png, &s->info);
+    }
+  else if (s->parallel != NULL)
+    {
+      if (png_parallel_end(s->parallel) != 0)
+        ret = -1;
+      free(s->parallel);
+      s->parallel = NULL;
+    }
+  free(s->row);
+  free(s->chunk);
+  s->row = NULL;
+  s->chunk = NULL;
+  return ret;
+}
@@ -0,0 +1,202 @@
+/*
+ * Image output helpers shared by the text renderers.
+ *
+ * PNG is written as RGBA by default. Since the fill color is constant,
+ * two smaller layouts carry the same image from the coverage bytes:
+ *
+ * ga       gray+alpha, the gray being the luma of the fill color; exact
+ *          for black, white and gray text
+ * palette  8-bit indices into 256 entries of the fill color, with a tRNS
+ *          ramp making index i the alpha i; exact for any color, and the
+ *          coverage rows are written as they are. The two tables cost
+ *          about 1 KB, so single small glyphs do better with ga
+ *
+ * Besides PNG (with a selectable zlib level, filter and strategy, and
+ * optionally deflated on several threads, see png_parallel.h), a few
+ * formats that are much cheaper to produce are available:
+ *
+ * raw  "COV8", width and height as 4 byte big-endian numbers, then
+ *      width * height coverage bytes, row by row. 1-bit images use
+ *      "COV1" and rows of (width + 7) / 8 bytes, most significant bit
+ *      first, 1 for ink
+ * pgm  binary PGM (P5) of the coverage, 0 is no ink
+ * qoi  QOI image (RGBA), fill color with coverage as alpha
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <png.h>
+
+#include "pixel_convert.h"
+
+typedef enum image_format
+{
+  IMAGE_FORMAT_PNG = 0,
+  IMAGE_FORMAT_RAW,
+  IMAGE_FORMAT_PGM,
+  IMAGE_FORMAT_QOI
+} image_format;
+
+typedef enum image_png_color
+{
+  IMAGE_PNG_RGBA = 0,
+  IMAGE_PNG_GRAY_ALPHA,
+  IMAGE_PNG_PALETTE
+} image_png_color;
+
+/*
+ * Output format and PNG encoder settings. -1 leaves the setting to
+ * libpng, which is also what IMAGE_OPTIONS_DEFAULT does.
+ */
+typedef struct image_options
+{
+  image_format format;
+  image_png_color pngColor;
+  int level;    /* zlib level 0-9 */
+  int filter;   /* PNG_FILTER_* mask; one filter disables the heuristic */
+  int strategy; /* Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY or Z_RLE */
+  int threads;  /* > 0: 8-bit PNG by png_parallel on this many threads */
+} image_options;
+
+#define IMAGE_OPTIONS_DEFAULT {IMAGE_FORMAT_PNG, IMAGE_PNG_RGBA, -1, -1, -1, 0}
+
+/* help text for the specs image_options_parse() accepts, for usage output */
+#define IMAGE_OPTIONS_HELP \
+  "               png[:item,...] with items 0-9 (zlib level),\n" \
+  "                 none|sub|up|avg|paeth|all (filters),\n" \
+  "                 default|filtered|huffman|rle (zlib strategy),\n" \
+  "                 rgba|ga|palette (pixel layout),\n" \
+  "                 fast (1,up,rle) or small (9,all),\n" \
+  "                 j[N] (deflate in chunks on N threads, 1-64, default\n" \
+  "                 one per CPU; for large images, not 1-bit ones)\n" \
+  "               raw (COV8 header and coverage), pgm or qoi\n"
+
+/*
+ * Growable memory sink for encoded images. Used where the length of an image
+ * must be known before it is sent, e.g. framed streams and sockets.
+ * Zero-initialize before first use; reset len to reuse the storage.
+ */
+typedef struct mem_buffer
+{
+  unsigned char* data;
+  size_t len;
+  size_t cap;
+} mem_buffer;
+
+/* png write functions; io pointer is a FILE* */
+void my_write(png_structp ps, png_bytep data, png_size_t sz);
+void my_flush(png_structp ps);
+
+/* png write functions; io pointer is a mem_buffer* */
+void mem_write(png_structp ps, png_bytep data, png_size_t sz);
+void mem_flush(png_structp ps);
+
+/*
+ * Parse a format spec such as "png", "png:fast", "png:6,up,rle",
+ * "png:palette,j8" or "qoi". Returns -1 and prints a message when the spec is invalid.
+ */
+int image_options_parse(const char* spec, image_options* opt);
+
+/* file name extension for a format, without the dot */
+const char* image_format_extension(image_format format);
+
+/* apply level, filter and strategy of opt to a png write struct */
+void png_apply_options(png_structp png, const image_options* opt);
+
+/*
+ * Write RGBA data as PNG through the given write function.
+ * io is passed to the write function as png io pointer. opt may be NULL
+ * for libpng defaults. Returns -1 when out of memory or libpng reports
+ * an error.
+ */
+int write_png(unsigned char* data, int w, int h, const image_options* opt,
+              png_rw_ptr writeFn, png_flush_ptr flushFn, void* io);
+
+/*
+ * Write a coverage image (w bytes per row) drawn in color as PNG, in the
+ * pixel layout of opt->pngColor. Rows are converted one at a time, so no
+ * full size RGBA copy is made. Returns -1 when out of memory or libpng
+ * reports an error, e.g. a write function calling png_error().
+ */
+int write_png_coverage(const unsigned char* cov, int w, int h, pixel_color color,
+                       const image_options* opt,
+                       png_rw_ptr writeFn, png_flush_ptr flushFn, void* io);
+
+/*
+ * Encode a coverage image drawn in color into out, replacing its
+ * contents, in the format selected by opt. Returns -1 when out of
+ * memory.
+ */
+int encode_image(const image_options* opt, const unsigned char* cov, int w, int h,
+                 pixel_color color, mem_buffer* out);
+
+/*
+ * Same for a 1-bit image (stride bytes per row, most significant bit
+ * first, 1 for ink). PNG output is 1-bit grayscale with black ink on
+ * white, whatever the color; raw output stays packed. pgm and qoi have
+ * no 1-bit form, so the image is expanded to coverage 0 or 255 first.
+ */
+int encode_image_mono(const image_options* opt, const unsigned char* bits, int stride,
+                      int w, int h, pixel_color color, mem_buffer* out);
+
+/* state of the QOI encoder between rows */
+typedef struct qoi_state
+{
+  unsigned char index[64][4];
+  unsigned char prev[4];
+  int run;
+} qoi_state;
+
+/*
+ * A coverage image written to a file a few rows at a time, so the whole
+ * image never has to be in memory. The bytes are the same as
+ * encode_image() produces. PNG rows go through png_write_row() as they
+ * come, QOI keeps its encoder state between calls.
+ */
+typedef struct image_stream
+{
+  image_options opt;
+  pixel_color color;
+  int w;
+  int h;
+  int y; /* rows written so far */
+  FILE* out;
+
+  png_structp png;
+  png_infop info;
+  struct png_parallel* parallel; /* instead of png with opt.threads */
+  unsigned char* row;   /* one converted PNG row */
+  unsigned char* chunk; /* encoded QOI rows */
+  size_t chunkCap;
+  qoi_state qoi;
+  size_t bytes; /* written to out so far */
+  int failed;   /* libpng reported an error; no more rows are taken */
+} image_stream;
+
+/*
+ * Start writing a w * h coverage image drawn in color to out, in the
+ * format selected by opt. Returns -1 when out of memory or writing fails.
+ */
+int image_stream_begin(image_stream* s, const image_options* opt, int w, int h,
+                       pixel_color color, FILE* out);
+
+/* write the next n rows (w bytes each). Returns -1 on errors */
+int image_stream_write(image_stream* s, const unsigned char* cov, int n);
+
+/*
+ * Finish the image and free the stream's buffers; call it after a
+ * successful image_stream_begin() even when writing failed. Returns -1
+ * when not all rows were written or writing failed.
+ */
+int image_stream_end(image_stream* s);
+
+#endif
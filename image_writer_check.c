@@ -0,0 +1,111 @@
+/*
+ * Checks that image_stream writes the same bytes as encode_image(), with
+ * rows streamed one at a time, in every format.
+ *
+ * The image is a blank row, which leaves a QOI run pending at the end of
+ * the call, then rows of distinct coverage values that miss the QOI
+ * index, so every pixel is an RGBA op and the pending run comes on top
+ * of the worst case of the next call.
+ *
+ * Usage:
+ * image_writer_check
+ *
+ * Exits with 0 when every format matches.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "image_writer.h"
+#include "pixel_convert.h"
+
+#define CHECK_W 40
+#define CHECK_H 4
+
+/* stream cov a row at a time into a temporary file and read it back */
+int stream_rows(const image_options* opt, const unsigned char* cov, pixel_color color,
+                mem_buffer* out)
+{
+  image_stream s;
+  FILE* f = tmpfile();
+  long len;
+  int ret = 0;
+  int y;
+
+  if (f == NULL)
+    return -1;
+  if (image_stream_begin(&s, opt, CHECK_W, CHECK_H, color, f) != 0)
+    {
+      fclose(f);
+      return -1;
+    }
+  for(y = 0; y < CHECK_H && ret == 0; y++)
+    {
+      ret = image_stream_write(&s, cov + y * CHECK_W, 1);
+    }
+  if (image_stream_end(&s) != 0)
+    ret = -1;
+  len = ftell(f);
+  if (ret == 0 && len > 0)
+    out->data = malloc(len);
+  if (ret == 0 && out->data == NULL)
+    ret = -1;
+  if (ret == 0)
+    {
+      out->cap = len;
+      rewind(f);
+      out->len = fread(out->data, 1, len, f);
+      if (out->len != (size_t)len)
+        ret = -1;
+    }
+  fclose(f);
+  return ret;
+}
+
+int main(int argc, char** argv)
+{
+  static const char* specs[] = {"png", "png:palette", "png:j2", "raw", "pgm", "qoi"};
+  unsigned char cov[CHECK_W * CHECK_H];
+  pixel_color color = {0x2c, 0x00, 0x59};
+  int failed = 0;
+  int i, x, y;
+
+  memset(cov, 0, CHECK_W);
+  for(y = 1; y < CHECK_H; y++)
+    {
+      for(x = 0; x < CHECK_W; x++)
+        {
+          cov[y * CHECK_W + x] = 1 + (y - 1) * CHECK_W + x;
+        }
+    }
+
+  for(i = 0; i < (int)(sizeof(specs) / sizeof(specs[0])); i++)
+    {
+      image_options opt;
+      mem_buffer whole = {NULL, 0, 0};
+      mem_buffer streamed = {NULL, 0, 0};
+
+      if (image_options_parse(specs[i], &opt) != 0
+          || encode_image(&opt, cov, CHECK_W, CHECK_H, color, &whole) != 0
+          || stream_rows(&opt, cov, color, &streamed) != 0)
+        {
+          fprintf(stderr, "ERROR: %s: encoding failed\n", specs[i]);
+          failed++;
+        }
+      else if (whole.len != streamed.len || memcmp(whole.data, streamed.data, whole.len) != 0)
+        {
+          fprintf(stderr, "ERROR: %s: streamed rows differ from encode_image()\n", specs[i]);
+          failed++;
+        }
+      free(whole.data);
+      free(streamed.data);
+    }
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+
+#include "pixel_convert.h"
+
+#if defined(__SSE2__)
+# define PIXEL_SSE2 1
+# include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define PIXEL_NEON 1
+# include <arm_neon.h>
+#endif
+
+/* a * b / 255, rounded; the SIMD kernels use the same formula */
+static inline unsigned int mul_div255(unsigned int a, unsigned int b)
+{
+  unsigned int t = a * b + 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+static int hex_digit(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+int pixel_color_parse(const char* str, pixel_color* color)
+{
+  int v[6];
+  int i;
+
+  if (str[0] == '#')
+    str++;
+  for(i = 0; i < 6; i++)
+    {
+      v[i] = hex_digit(str[i]);
+      if (v[i] < 0)
+        return -1;
+    }
+  if (str[6] != '\0')
+    return -1;
+  color->r = v[0] * 16 + v[1];
+  color->g = v[2] * 16 + v[3];
+  color->b = v[4] * 16 + v[5];
+  return 0;
+}
+
+unsigned char pixel_color_gray(pixel_color color)
+{
+  return (color.r * 299 + color.g * 587 + color.b * 114 + 500) / 1000;
+}
+
+void convert_coverage_rgba(unsigned char* dst, const unsigned char* cov, size_t n,
+                           pixel_color color)
+{
+  size_t i = 0;
+
+#if defined(PIXEL_SSE2)
+  /* color in the low three bytes of every pixel, coverage in the top one */
+  __m128i rgb = _mm_set1_epi32(color.r | (color.g << 8) | (color.b << 16));
+  __m128i zero = _mm_setzero_si128();
+  for(; i + 16 <= n; i += 16)
+    {
+      __m128i c = _mm_loadu_si128((const __m128i*)(cov + i));
+      __m128i lo = _mm_unpacklo_epi8(zero, c);
+      __m128i hi = _mm_unpackhi_epi8(zero, c);
+      _mm_storeu_si128((__m128i*)(dst + i * 4), _mm_or_si128(rgb, _mm_unpacklo_epi16(zero, lo)));
+      _mm_storeu_si128((__m128i*)(dst + i * 4 + 16), _mm_or_si128(rgb, _mm_unpackhi_epi16(zero, lo)));
+      _mm_storeu_si128((__m128i*)(dst + i * 4 + 32), _mm_or_si128(rgb, _mm_unpacklo_epi16(zero, hi)));
+      _mm_storeu_si128((__m128i*)(dst + i * 4 + 48), _mm_or_si128(rgb, _mm_unpackhi_epi16(zero, hi)));
+    }
+#elif defined(PIXEL_NEON)
+  uint8x16x4_t px;
+  px.val[0] = vdupq_n_u8(color.r);
+  px.val[1] = vdupq_n_u8(color.g);
+  px.val[2] = vdupq_n_u8(color.b);
+  for(; i + 16 <= n; i += 16)
+    {
+      px.val[3] = vld1q_u8(cov + i);
+      vst4q_u8(dst + i * 4, px);
+    }
+#endif
+
+  for(; i < n; i++)
+    {
+      dst[i * 4] = color.r;
+      dst[i * 4 + 1] = color.g;
+      dst[i * 4 + 2] = color.b;
+      dst[i * 4 + 3] = cov[i];
+    }
+}
+
+#if defined(PIXEL_SSE2)
+static inline __m128i mul_div255_sse2(__m128i a, __m128i b)
+{
+  __m128i t = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+/* premultiply one channel for 16 pixels, coverage already widened */
+static inline __m128i premultiply_sse2(__m128i covLo, __m128i covHi, unsigned char channel)
+{
+  __m128i c = _mm_set1_epi16(channel);
+  return _mm_packus_epi16(mul_div255_sse2(covLo, c), mul_div255_sse2(covHi, c));
+}
+#elif defined(PIXEL_NEON)
+static inline uint8x16_t premultiply_neon(uint8x16_t cov, uint8x8_t channel)
+{
+  uint16x8_t lo = vaddq_u16(vmull_u8(vget_low_u8(cov), channel), vdupq_n_u16(128));
+  uint16x8_t hi = vaddq_u16(vmull_u8(vget_high_u8(cov), channel), vdupq_n_u16(128));
+  return vcombine_u8(vshrn_n_u16(vaddq_u16(lo, vshrq_n_u16(lo, 8)), 8),
+                     vshrn_n_u16(vaddq_u16(hi, vshrq_n_u16(hi, 8)), 8));
+}
+#endif
+
+void convert_coverage_argb32(uint32_t* dst, const unsigned char* cov, size_t n,
+                             pixel_color color)
+{
+  size_t i = 0;
+
+  /* SIMD paths store bytes B, G, R, A, which is ARGB32 on little endian */
+#if defined(PIXEL_SSE2)
+  __m128i zero = _mm_setzero_si128();
+  for(; i + 16 <= n; i += 16)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i*)(cov + i));
+      __m128i aLo = _mm_unpacklo_epi8(a, zero);
+      __m128i aHi = _mm_unpackhi_epi8(a, zero);
+      __m128i b = premultiply_sse2(aLo, aHi, color.b);
+      __m128i g = premultiply_sse2(aLo, aHi, color.g);
+      __m128i r = premultiply_sse2(aLo, aHi, color.r);
+      __m128i bgLo = _mm_unpacklo_epi8(b, g);
+      __m128i bgHi = _mm_unpackhi_epi8(b, g);
+      __m128i raLo = _mm_unpacklo_epi8(r, a);
+      __m128i raHi = _mm_unpackhi_epi8(r, a);
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(bgLo, raLo));
+      _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(bgLo, raLo));
+      _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpacklo_epi16(bgHi, raHi));
+      _mm_storeu_si128((__m128i*)(dst + i + 12), _mm_unpackhi_epi16(bgHi, raHi));
+    }
+#elif defined(PIXEL_NEON) && defined(__ARM_BIG_ENDIAN)
+  /* byte order differs on big endian; use the scalar loop */
+#elif defined(PIXEL_NEON)
+  uint8x8_t r = vdup_n_u8(color.r);
+  uint8x8_t g = vdup_n_u8(color.g);
+  uint8x8_t b = vdup_n_u8(color.b);
+  for(; i + 16 <= n; i += 16)
+    {
+      uint8x16x4_t px;
+      px.val[3] = vld1q_u8(cov + i);
+      px.val[0] = premultiply_neon(px.val[3], b);
+      px.val[1] = premultiply_neon(px.val[3], g);
+      px.val[2] = premultiply_neon(px.val[3], r);
+      vst4q_u8((uint8_t*)(dst + i), px);
+    }
+#endif
+
+  for(; i < n; i++)
+    {
+      unsigned int a = cov[i];
+      dst[i] = (a << 24) | (mul_div255(color.r, a) << 16)
+        | (mul_div255(color.g, a) << 8) | mul_div255(color.b, a);
+    }
+}
+
+void convert_coverage_gray_alpha(unsigned char* dst, const unsigned char* cov, size_t n,
+                                 unsigned char gray)
+{
+  size_t i = 0;
+
+#if defined(PIXEL_SSE2)
+  __m128i g = _mm_set1_epi8((char)gray);
+  for(; i + 16 <= n; i += 16)
+    {
+      __m128i c = _mm_loadu_si128((const __m128i*)(cov + i));
+      _mm_storeu_si128((__m128i*)(dst + i * 2), _mm_unpacklo_epi8(g, c));
+      _mm_storeu_si128((__m128i*)(dst + i * 2 + 16), _mm_unpackhi_epi8(g, c));
+    }
+#elif defined(PIXEL_NEON)
+  uint8x16x2_t px;
+  px.val[0] = vdupq_n_u8(gray);
+  for(; i + 16 <= n; i += 16)
+    {
+      px.val[1] = vld1q_u8(cov + i);
+      vst2q_u8(dst + i * 2, px);
+    }
+#endif
+
+  for(; i < n; i++)
+    {
+      dst[i * 2] = gray;
+      dst[i * 2 + 1] = cov[i];
+    }
+}
+
+unsigned char* coverage_to_rgba(const unsigned char* cov, int w, int h, pixel_color color)
+{
+  unsigned char* imgData = malloc((size_t)w * h * 4);
+  if (imgData == NULL)
+    return NULL;
+  convert_coverage_rgba(imgData, cov, (size_t)w * h, color);
+  return imgData;
+}
@@ -0,0 +1,60 @@
+/*
+ * Conversion of 8-bit glyph coverage into output pixel formats.
+ *
+ * The fill color is constant; coverage becomes alpha. Kernels use SSE2
+ * on x86 and NEON on ARM, with a scalar fallback. Premultiplication
+ * uses exact, rounded division by 255 in every kernel.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct pixel_color
+{
+  unsigned char r;
+  unsigned char g;
+  unsigned char b;
+} pixel_color;
+
+/* Parse "RRGGBB" (an optional leading '#' is allowed). Returns 0 on success. */
+int pixel_color_parse(const char* str, pixel_color* color);
+
+/* Rec. 601 luma of a color, used as the gray level of gray+alpha output. */
+unsigned char pixel_color_gray(pixel_color color);
+
+/*
+ * Straight (not premultiplied) RGBA, as libpng wants it. dst receives
+ * n * 4 bytes: R, G, B, A per pixel.
+ */
+void convert_coverage_rgba(unsigned char* dst, const unsigned char* cov, size_t n,
+                           pixel_color color);
+
+/*
+ * Premultiplied ARGB32 in native byte order, as cairo wants it
+ * (CAIRO_FORMAT_ARGB32). dst receives n pixels.
+ */
+void convert_coverage_argb32(uint32_t* dst, const unsigned char* cov, size_t n,
+                             pixel_color color);
+
+/*
+ * Gray+alpha pairs (PNG_COLOR_TYPE_GRAY_ALPHA). dst receives n * 2 bytes.
+ */
+void convert_coverage_gray_alpha(unsigned char* dst, const unsigned char* cov, size_t n,
+                                 unsigned char gray);
+
+/*
+ * Expand a whole coverage image (w bytes per row) into a new straight
+ * RGBA buffer. Returns NULL when out of memory.
+ */
+unsigned char* coverage_to_rgba(const unsigned char* cov, int w, int h, pixel_color color);
+
+#endif
@@ -0,0 +1,623 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <png.h>
+
+#include "png_parallel.h"
+
+/* a run of rows filtered and deflated by one thread */
+typedef struct chunk_job
+{
+  png_parallel* p;
+  const unsigned char* cov; /* coverage of the round */
+  int firstRow;             /* in the round */
+  int rowCount;
+  int first; /* starts the zlib stream */
+  int last;  /* ends it */
+  unsigned char* out;
+  size_t outLen;
+  size_t outCap;
+  unsigned long adler;
+  int failed;
+} chunk_job;
+
+/*
+ * Threads started with the encoder, kept for all its rounds. The
+ * calling thread runs jobs too, so there is one fewer than p->threads.
+ */
+typedef struct job_pool
+{
+  pthread_t* threads;
+  int threadCount;
+  pthread_mutex_t lock;
+  pthread_cond_t wake; /* a phase was started, or quit was set */
+  pthread_cond_t done; /* the last job of a phase finished */
+  int generation;      /* bumped by every phase */
+  int quit;
+  /* the current phase */
+  chunk_job* jobs;
+  int count;
+  int next;    /* first job not yet taken */
+  int running; /* jobs taken and not yet finished */
+  void (*fn)(chunk_job*);
+} job_pool;
+
+static void put_be32(unsigned char* p, unsigned int v)
+{
+  p[0] = (v >> 24) & 0xff;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+}
+
+static int write_chunk(png_parallel* p, const char* type, const unsigned char* data, size_t len)
+{
+  unsigned char head[8];
+  unsigned char tail[4];
+  unsigned long crc;
+
+  put_be32(head, len);
+  memcpy(head + 4, type, 4);
+  crc = crc32(0L, head + 4, 4);
+  /* crc32() of a NULL buffer is its initial value, not crc */
+  if (len > 0)
+    crc = crc32(crc, data, len);
+  put_be32(tail, crc);
+  if (p->writeFn(p->io, head, 8) != 0
+      || (len > 0 && p->writeFn(p->io, data, len) != 0)
+      || p->writeFn(p->io, tail, 4) != 0)
+    return -1;
+  return 0;
+}
+
+/* row i of the coverage in PNG layout, converted into buf if needed */
+static const unsigned char* row_at(const png_parallel* p, const unsigned char* cov, int i,
+                                   unsigned char* buf)
+{
+  const unsigned char* src = cov + (size_t)i * p->w;
+
+  switch(p->pngColor)
+    {
+    case IMAGE_PNG_PALETTE:
+      return src;
+    case IMAGE_PNG_GRAY_ALPHA:
+      convert_coverage_gray_alpha(buf, src, p->w, pixel_color_gray(p->color));
+      return buf;
+    default:
+      convert_coverage_rgba(buf, src, p->w, p->color);
+      return buf;
+    }
+}
+
+static int paeth(int a, int b, int c)
+{
+  int pa = abs(b - c);
+  int pb = abs(a - c);
+  int pc = abs(a + b - 2 * c);
+
+  if (pa <= pb && pa <= pc)
+    return a;
+  return pb <= pc ? b : c;
+}
+
+/* the libpng heuristic: bytes taken as signed, least sum of magnitudes */
+#define FILTER_COST(v) ((v) < 128 ? (v) : 256 - (v))
+
+/*
+ * Filter type 0-4 byte and filtered row at out. Returns the cost of the
+ * row, or of as much of it as was filtered before the cost reached limit.
+ */
+static unsigned long apply_filter(int type, unsigned char* out, const unsigned char* cur,
+                                  const unsigned char* prev, size_t len, int bpp,
+                                  unsigned long limit)
+{
+  unsigned long sum = 0;
+  size_t i;
+
+  *out++ = type;
+  switch(type)
+    {
+    case 1: /* sub */
+      for(i = 0; i < len && sum < limit; i++)
+        {
+          out[i] = cur[i] - (i >= (size_t)bpp ? cur[i - bpp] : 0);
+          sum += FILTER_COST(out[i]);
+        }
+      break;
+    case 2: /* up */
+      for(i = 0; i < len && sum < limit; i++)
+        {
+          out[i] = cur[i] - prev[i];
+          sum += FILTER_COST(out[i]);
+        }
+      break;
+    case 3: /* avg */
+      for(i = 0; i < len && sum < limit; i++)
+        {
+          out[i] = cur[i] - (((i >= (size_t)bpp ? cur[i - bpp] : 0) + prev[i]) >> 1);
+          sum += FILTER_COST(out[i]);
+        }
+      break;
+    case 4: /* paeth */
+      for(i = 0; i < len && sum < limit; i++)
+        {
+          if (i < (size_t)bpp)
+            out[i] = cur[i] - prev[i];
+          else
+            out[i] = cur[i] - paeth(cur[i - bpp], prev[i], prev[i - bpp]);
+          sum += FILTER_COST(out[i]);
+        }
+      break;
+    default:
+      memcpy(out, cur, len);
+      for(i = 0; i < len && sum < limit; i++)
+        sum += FILTER_COST(out[i]);
+    }
+  return sum;
+}
+
+/* filter a row into dst with the best of p->filter; trial is scratch */
+static void filter_row(const png_parallel* p, unsigned char* dst, const unsigned char* cur,
+                       const unsigned char* prev, unsigned char* trial)
+{
+  unsigned long best = ULONG_MAX;
+  unsigned char* bestOut = NULL;
+  unsigned char* out = dst;
+  int type;
+
+  for(type = 0; type < 5; type++)
+    {
+      unsigned long cost;
+
+      if ((p->filter & (PNG_FILTER_NONE << type)) == 0)
+        continue;
+      if (p->filter == (PNG_FILTER_NONE << type))
+        {
+          /* a single filter, nothing to choose */
+          apply_filter(type, dst, cur, prev, p->rowBytes, p->bpp, ULONG_MAX);
+          return;
+        }
+      /* a candidate stops being filtered once it cannot win */
+      cost = apply_filter(type, out, cur, prev, p->rowBytes, p->bpp, best);
+      if (cost < best)
+        {
+          best = cost;
+          bestOut = out;
+          out = out == dst ? trial : dst;
+        }
+    }
+  if (bestOut != dst)
+    memcpy(dst, bestOut, p->rowBytes + 1);
+}
+
+static void filter_chunk(chunk_job* job)
+{
+  png_parallel* p = job->p;
+  size_t stride = p->rowBytes + 1;
+  unsigned char* buf = malloc(p->rowBytes * 2 + stride);
+  unsigned char* dst = p->filtered + PNG_PARALLEL_WINDOW + stride * job->firstRow;
+  const unsigned char* prev;
+  int i;
+
+  if (buf == NULL)
+    {
+      job->failed = 1;
+      return;
+    }
+  /* rows alternate between the two buffers, trial comes after them */
+  prev = job->firstRow == 0 ? p->prevRow : row_at(p, job->cov, job->firstRow - 1, buf);
+  for(i = 0; i < job->rowCount; i++)
+    {
+      const unsigned char* cur = row_at(p, job->cov, job->firstRow + i,
+                                        buf + p->rowBytes * ((i + 1) & 1));
+      filter_row(p, dst, cur, prev, buf + p->rowBytes * 2);
+      prev = cur;
+      dst += stride;
+    }
+  free(buf);
+}
+
+static int zlib_header_level(int level)
+{
+  if (level < 0 || level == 6)
+    return 2;
+  if (level < 2)
+    return 0;
+  return level < 6 ? 1 : 3;
+}
+
+static void deflate_chunk(chunk_job* job)
+{
+  png_parallel* p = job->p;
+  size_t stride = p->rowBytes + 1;
+  unsigned char* data = p->filtered + PNG_PARALLEL_WINDOW + stride * job->firstRow;
+  size_t len = stride * job->rowCount;
+  /* filtered bytes before the chunk still in the buffer */
+  size_t before = p->dictLen + stride * job->firstRow;
+  size_t dictLen = before < PNG_PARALLEL_WINDOW ? before : PNG_PARALLEL_WINDOW;
+  int flush = job->last ? Z_FINISH : Z_SYNC_FLUSH;
+  z_stream zs;
+  int ret;
+
+  job->adler = adler32(1L, data, len);
+  memset(&zs, 0, sizeof(zs));
+  /* raw deflate; the zlib header and trailer are written once for all chunks */
+  if (deflateInit2(&zs, p->level, Z_DEFLATED, -15, 8, p->strategy) != Z_OK)
+    {
+      job->failed = 1;
+      return;
+    }
+  if (dictLen > 0)
+    deflateSetDictionary(&zs, data - dictLen, dictLen);
+  /* zlib header, the sync flush and the adler32 trailer on top of the bound */
+  job->outCap = deflateBound(&zs, len) + 2 + 16 + 4;
+  job->out = malloc(job->outCap);
+  if (job->out == NULL)
+    {
+      job->failed = 1;
+      deflateEnd(&zs);
+      return;
+    }
+  if (job->first)
+    {
+      int cmf = 0x78; /* deflate, 32 KB window */
+      int flg = zlib_header_level(p->level) << 6;
+      flg += 31 - (cmf * 256 + flg) % 31;
+      job->out[0] = cmf;
+      job->out[1] = flg;
+      job->outLen = 2;
+    }
+
+  zs.next_in = data;
+  zs.avail_in = len;
+  for(;;)
+    {
+      if (job->outCap - job->outLen < 64 + 4)
+        {
+          unsigned char* newOut = realloc(job->out, job->outCap * 2);
+          if (newOut == NULL)
+            {
+              job->failed = 1;
+              break;
+            }
+          job->out = newOut;
+          job->outCap *= 2;
+        }
+      zs.next_out = job->out + job->outLen;
+      /* the last 4 bytes are kept for the trailer */
+      zs.avail_out = job->outCap - job->outLen - 4;
+      ret = deflate(&zs, flush);
+      job->outLen = zs.next_out - job->out;
+      if (ret == Z_STREAM_ERROR)
+        {
+          job->failed = 1;
+          break;
+        }
+      /* a flush is complete once deflate leaves output space unused */
+      if (flush == Z_FINISH ? ret == Z_STREAM_END : zs.avail_out != 0)
+        break;
+    }
+  deflateEnd(&zs);
+}
+
+/* run jobs of the current phase until none are left; the lock is held around it */
+static void take_jobs(job_pool* pool)
+{
+  while(pool->next < pool->count)
+    {
+      chunk_job* job = &pool->jobs[pool->next++];
+      pool->running++;
+      pthread_mutex_unlock(&pool->lock);
+      pool->fn(job);
+      pthread_mutex_lock(&pool->lock);
+      pool->running--;
+    }
+  if (pool->running == 0)
+    pthread_cond_signal(&pool->done);
+}
+
+static void* pool_thread(void* arg)
+{
+  job_pool* pool = arg;
+  int seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for(;;)
+    {
+      while(pool->generation == seen && !pool->quit)
+        pthread_cond_wait(&pool->wake, &pool->lock);
+      if (pool->quit)
+        break;
+      seen = pool->generation;
+      take_jobs(pool);
+    }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/*
+ * Start up to threadCount threads. Fewer, or none, are started when
+ * creating them fails; the calling thread then takes their jobs.
+ */
+static job_pool* job_pool_new(int threadCount)
+{
+  job_pool* pool = calloc(1, sizeof(job_pool));
+  int i;
+
+  if (pool == NULL)
+    return NULL;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->threads = threadCount > 0 ? malloc(sizeof(pthread_t) * threadCount) : NULL;
+  for(i = 0; pool->threads != NULL && i < threadCount; i++)
+    {
+      if (pthread_create(&pool->threads[pool->threadCount], NULL, pool_thread, pool) == 0)
+        pool->threadCount++;
+    }
+  return pool;
+}
+
+static void job_pool_free(job_pool* pool)
+{
+  int i;
+
+  if (pool == NULL)
+    return;
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+  for(i = 0; i < pool->threadCount; i++)
+    {
+      pthread_join(pool->threads[i], NULL);
+    }
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->threads);
+  free(pool);
+}
+
+/* run fn on every job, on the pool's threads and the calling one */
+static void run_jobs(job_pool* pool, chunk_job* jobs, int count, void (*fn)(chunk_job*))
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->jobs = jobs;
+  pool->count = count;
+  pool->next = 0;
+  pool->fn = fn;
+  pool->generation++;
+  if (count > 1)
+    pthread_cond_broadcast(&pool->wake);
+  take_jobs(pool);
+  while(pool->running > 0)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void free_buffers(png_parallel* p)
+{
+  job_pool_free(p->pool);
+  free(p->prevRow);
+  free(p->filtered);
+  free(p->pending);
+  p->pool = NULL;
+  p->prevRow = NULL;
+  p->filtered = NULL;
+  p->pending = NULL;
+}
+
+/* encode n rows, at most one chunk per thread */
+static int encode_round(png_parallel* p, const unsigned char* cov, int n)
+{
+  size_t stride = p->rowBytes + 1;
+  size_t len = stride * n;
+  size_t keep;
+  int count = (n + p->chunkRows - 1) / p->chunkRows;
+  chunk_job* jobs = calloc(count, sizeof(chunk_job));
+  int ret = 0;
+  int i;
+
+  if (jobs == NULL)
+    return -1;
+  for(i = 0; i < count; i++)
+    {
+      jobs[i].p = p;
+      jobs[i].cov = cov;
+      jobs[i].firstRow = i * p->chunkRows;
+      jobs[i].rowCount = i == count - 1 ? n - jobs[i].firstRow : p->chunkRows;
+      jobs[i].first = p->y == 0 && i == 0;
+      jobs[i].last = p->y + n == p->h && i == count - 1;
+    }
+
+  run_jobs(p->pool, jobs, count, filter_chunk);
+  for(i = 0; i < count; i++)
+    {
+      if (jobs[i].failed)
+        ret = -1;
+    }
+  if (ret == 0)
+    {
+      unsigned char* row = p->prevRow + p->rowBytes;
+      memcpy(p->prevRow, row_at(p, cov, n - 1, row), p->rowBytes);
+      run_jobs(p->pool, jobs, count, deflate_chunk);
+    }
+
+  for(i = 0; i < count; i++)
+    {
+      chunk_job* job = &jobs[i];
+      if (ret == 0 && job->failed)
+        ret = -1;
+      if (ret == 0)
+        {
+          p->adler = adler32_combine(p->adler, job->adler, stride * job->rowCount);
+          if (job->last)
+            {
+              put_be32(job->out + job->outLen, p->adler);
+              job->outLen += 4;
+            }
+          ret = write_chunk(p, "IDAT", job->out, job->outLen);
+        }
+      free(job->out);
+    }
+  free(jobs);
+  if (ret != 0)
+    {
+      fprintf(stderr, "ERROR: parallel PNG encoding failed\n");
+      return -1;
+    }
+
+  /* the last window of filtered bytes is the next round's dictionary */
+  keep = p->dictLen + len < PNG_PARALLEL_WINDOW ? p->dictLen + len : PNG_PARALLEL_WINDOW;
+  memmove(p->filtered + PNG_PARALLEL_WINDOW - keep,
+          p->filtered + PNG_PARALLEL_WINDOW + len - keep, keep);
+  p->dictLen = keep;
+  p->y += n;
+  return 0;
+}
+
+int png_parallel_begin(png_parallel* p, int w, int h, pixel_color color,
+                       const image_options* opt, png_parallel_write_fn writeFn, void* io)
+{
+  static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+  unsigned char ihdr[13];
+  size_t stride;
+
+  memset(p, 0, sizeof(png_parallel));
+  if (w <= 0 || h <= 0)
+    {
+      fprintf(stderr, "ERROR: cannot write an empty PNG image\n");
+      return -1;
+    }
+  p->w = w;
+  p->h = h;
+  p->pngColor = opt->pngColor;
+  p->color = color;
+  p->threads = opt->threads < 1 ? 1
+    : opt->threads > PNG_PARALLEL_MAX_THREADS ? PNG_PARALLEL_MAX_THREADS : opt->threads;
+  p->bpp = p->pngColor == IMAGE_PNG_PALETTE ? 1 : p->pngColor == IMAGE_PNG_GRAY_ALPHA ? 2 : 4;
+  p->rowBytes = (size_t)w * p->bpp;
+  /* the libpng defaults: no filters for palette images, else all of them */
+  p->filter = opt->filter >= 0 ? opt->filter & PNG_ALL_FILTERS
+    : p->pngColor == IMAGE_PNG_PALETTE ? PNG_FILTER_NONE : PNG_ALL_FILTERS;
+  if (p->filter == 0)
+    p->filter = PNG_FILTER_NONE;
+  p->level = opt->level >= 0 ? opt->level : Z_DEFAULT_COMPRESSION;
+  p->strategy = opt->strategy >= 0 ? opt->strategy
+    : p->filter == PNG_FILTER_NONE ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+  stride = p->rowBytes + 1;
+  p->chunkRows = PNG_PARALLEL_CHUNK_BYTES / stride > 0 ? PNG_PARALLEL_CHUNK_BYTES / stride : 1;
+  p->writeFn = writeFn;
+  p->io = io;
+  p->adler = 1;
+
+  /* no more rounds than the image needs, so small images take little memory */
+  p->roundRows = p->chunkRows * p->threads < h ? p->chunkRows * p->threads : h;
+
+  /* the previous row, which is zeros for the first one, and a conversion buffer */
+  p->prevRow = calloc(2, p->rowBytes);
+  p->filtered = malloc(PNG_PARALLEL_WINDOW + stride * p->roundRows);
+  p->pending = malloc((size_t)w * p->roundRows);
+  p->pool = job_pool_new(p->threads - 1);
+  if (p->prevRow == NULL || p->filtered == NULL || p->pending == NULL || p->pool == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      free_buffers(p);
+      return -1;
+    }
+
+  put_be32(ihdr, w);
+  put_be32(ihdr + 4, h);
+  ihdr[8] = 8; /* bit depth */
+  ihdr[9] = p->pngColor == IMAGE_PNG_PALETTE ? PNG_COLOR_TYPE_PALETTE
+    : p->pngColor == IMAGE_PNG_GRAY_ALPHA ? PNG_COLOR_TYPE_GRAY_ALPHA : PNG_COLOR_TYPE_RGBA;
+  ihdr[10] = PNG_COMPRESSION_TYPE_DEFAULT;
+  ihdr[11] = PNG_FILTER_TYPE_DEFAULT;
+  ihdr[12] = PNG_INTERLACE_NONE;
+  if (p->writeFn(p->io, signature, 8) != 0 || write_chunk(p, "IHDR", ihdr, 13) != 0)
+    {
+      free_buffers(p);
+      return -1;
+    }
+  if (p->pngColor == IMAGE_PNG_PALETTE)
+    {
+      /* the fill color everywhere, index i has alpha i */
+      unsigned char palette[256 * 3];
+      unsigned char alpha[256];
+      int i;
+      for(i = 0; i < 256; i++)
+        {
+          palette[i * 3] = color.r;
+          palette[i * 3 + 1] = color.g;
+          palette[i * 3 + 2] = color.b;
+          alpha[i] = i;
+        }
+      if (write_chunk(p, "PLTE", palette, sizeof(palette)) != 0
+          || write_chunk(p, "tRNS", alpha, sizeof(alpha)) != 0)
+        {
+          free_buffers(p);
+          return -1;
+        }
+    }
+  return 0;
+}
+
+int png_parallel_write(png_parallel* p, const unsigned char* cov, int n)
+{
+  if (n < 0 || p->y + p->pendingRows + n > p->h)
+    {
+      fprintf(stderr, "ERROR: more rows than the image has\n");
+      return -1;
+    }
+  while(n > 0)
+    {
+      int rows;
+
+      /* whole rounds are encoded in place, the rest waits in pending */
+      if (p->pendingRows == 0 && (n >= p->roundRows || p->y + n == p->h))
+        {
+          rows = n < p->roundRows ? n : p->roundRows;
+          if (encode_round(p, cov, rows) != 0)
+            return -1;
+        }
+      else
+        {
+          rows = p->roundRows - p->pendingRows;
+          if (rows > n)
+            rows = n;
+          memcpy(p->pending + (size_t)p->pendingRows * p->w, cov, (size_t)rows * p->w);
+          p->pendingRows += rows;
+          if (p->pendingRows == p->roundRows || p->y + p->pendingRows == p->h)
+            {
+              int ret = encode_round(p, p->pending, p->pendingRows);
+              p->pendingRows = 0;
+              if (ret != 0)
+                return -1;
+            }
+        }
+      cov += (size_t)rows * p->w;
+      n -= rows;
+    }
+  return 0;
+}
+
+int png_parallel_end(png_parallel* p)
+{
+  /* the last row flushes pending rows; callers have reported whatever stopped them */
+  int ret = p->y == p->h ? write_chunk(p, "IEND", NULL, 0) : -1;
+
+  free_buffers(p);
+  return ret;
+}
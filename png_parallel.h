@@ -0,0 +1,106 @@
+/*
+ * PNG encoder deflating on several threads at once, selected with the
+ * j[N] item of a png format spec.
+ *
+ * libpng filters and deflates the rows one after another on the calling
+ * thread, which is most of the time spent on large images. Here the
+ * rows are cut into chunks of about PNG_PARALLEL_CHUNK_BYTES filtered
+ * bytes, and each chunk is filtered and then deflated on its own
+ * thread, the way pigz does it: every chunk gets the 32 KB of filtered
+ * data before it as preset dictionary, so matches still reach back
+ * across chunk boundaries, and ends with a sync flush on a byte
+ * boundary. The chunks then follow each other as one zlib stream, each
+ * in its own IDAT chunk, with the adler32 values combined into the
+ * stream trailer. The output decodes the same as libpng's; it is a bit
+ * larger, and faster the more threads there are.
+ *
+ * Rows are encoded a round of one chunk per thread at a time, so rows
+ * written in smaller strips are gathered until a round is full or the
+ * image ends. The threads are started by png_parallel_begin() and kept
+ * until png_parallel_end().
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef PNG_PARALLEL_H
+#define PNG_PARALLEL_H
+
+#include <stddef.h>
+
+#include "image_writer.h"
+#include "pixel_convert.h"
+
+/* filtered bytes per chunk, as pigz */
+#define PNG_PARALLEL_CHUNK_BYTES (128 * 1024)
+/* deflate window, the most of the data before a chunk it can refer to */
+#define PNG_PARALLEL_WINDOW 32768
+/* most threads an encoder uses; a round holds a chunk for each */
+#define PNG_PARALLEL_MAX_THREADS 64
+
+/* output function; returns -1 when writing failed */
+typedef int (*png_parallel_write_fn)(void* io, const unsigned char* data, size_t len);
+
+typedef struct png_parallel
+{
+  int w;
+  int h;
+  int y; /* rows encoded so far */
+  image_png_color pngColor;
+  pixel_color color;
+  int threads; /* 1 to PNG_PARALLEL_MAX_THREADS */
+  int level;
+  int strategy;
+  int filter;      /* PNG_FILTER_* mask rows are filtered with */
+  int bpp;         /* bytes per pixel */
+  size_t rowBytes; /* PNG row without the filter type byte */
+  int chunkRows;   /* rows per chunk */
+  int roundRows;   /* rows per round, a chunk for each thread */
+  png_parallel_write_fn writeFn;
+  void* io;
+
+  /* the threads besides the calling one */
+  struct job_pool* pool;
+  /* coverage of rows written but not yet encoded, up to a round */
+  unsigned char* pending;
+  int pendingRows;
+
+  /* last row of the previous call, converted, for the filters */
+  unsigned char* prevRow;
+  /*
+   * PNG_PARALLEL_WINDOW bytes ending in the last dictLen filtered bytes
+   * written so far, then room for the filtered rows of one round of
+   * chunks
+   */
+  unsigned char* filtered;
+  size_t dictLen;
+  unsigned long adler; /* of all filtered bytes so far */
+} png_parallel;
+
+/*
+ * Start a w * h coverage image drawn in color, in the pixel layout,
+ * filter, level and strategy of opt, on opt->threads threads, and write
+ * the PNG header through writeFn. Returns -1 when out of memory or
+ * writing fails.
+ */
+int png_parallel_begin(png_parallel* p, int w, int h, pixel_color color,
+                       const image_options* opt, png_parallel_write_fn writeFn, void* io);
+
+/*
+ * Take the next n rows (w bytes each). Rows are encoded and written
+ * once they fill a round, or with the last row of the image.
+ */
+int png_parallel_write(png_parallel* p, const unsigned char* cov, int n);
+
+/*
+ * Write the end of the image and free the encoder's buffers; call it
+ * after a successful png_parallel_begin() even when writing failed.
+ * Returns -1 when not all rows were written or writing fails; nothing
+ * is printed for the first.
+ */
+int png_parallel_end(png_parallel* p);
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Wire format between fontrenderd and its clients.
+ *
+ * All integers are 32 bit big-endian. A client sends any number of
+ * requests over one connection and gets one response for each, in order.
+ *
+ * request:  magic, flags, pixelSize, color (0xRRGGBB), fontPathLen,
+ *           textLen, then fontPathLen bytes of path and textLen bytes of
+ *           UTF-8 text.
+ * response: status, length, then length bytes. For RENDER_STATUS_OK the
+ *           payload is an image (PNG unless the server was started
+ *           with another -f format), otherwise an error message.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef RENDER_PROTOCOL_H
+#define RENDER_PROTOCOL_H
+
+#include <stdint.h>
+
+#define RENDER_DEFAULT_SOCKET "/tmp/fontrenderd.sock"
+
+#define RENDER_REQUEST_MAGIC 0x46525131 /* "FRQ1" */
+#define RENDER_REQUEST_HEADER_WORDS 6
+
+/* request flags */
+#define RENDER_FLAG_SINGLE_CHAR 1 /* render first character only, unshaped */
+#define RENDER_FLAG_BLEND_OVER 2  /* source-over instead of max compositing */
+
+/* response status */
+#define RENDER_STATUS_OK 0
+#define RENDER_STATUS_BAD_REQUEST 1
+#define RENDER_STATUS_FONT_ERROR 2
+#define RENDER_STATUS_RENDER_ERROR 3
+
+/* limits enforced by the server */
+#define RENDER_MAX_PATH_LEN 4096
+#define RENDER_MAX_TEXT_LEN (1024 * 1024)
+#define RENDER_MAX_PIXEL_SIZE 1024
+
+static inline void render_put_u32(unsigned char* p, uint32_t v)
+{
+  p[0] = (v >> 24) & 0xff;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+}
+
+static inline uint32_t render_get_u32(const unsigned char* p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+
+#include "render_stats.h"
+
+double render_stats_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void render_stats_add(render_stats* stats, render_stage stage, double seconds)
+{
+  render_stage_stats* s = &stats->stages[stage];
+
+  /* the nested stages are read from the same clock, but be safe */
+  if (seconds < 0)
+    seconds = 0;
+  s->count++;
+  s->seconds += seconds;
+  if (seconds > s->maxSeconds)
+    s->maxSeconds = seconds;
+}
+
+double render_stats_nested_seconds(const render_stats* stats)
+{
+  return stats->stages[RENDER_STAGE_SHAPE].seconds + stats->stages[RENDER_STAGE_GLYPH].seconds;
+}
+
+void render_stats_merge(render_stats* dst, const render_stats* src)
+{
+  int i;
+
+  for(i = 0; i < RENDER_STAGE_COUNT; i++)
+    {
+      dst->stages[i].count += src->stages[i].count;
+      dst->stages[i].seconds += src->stages[i].seconds;
+      if (src->stages[i].maxSeconds > dst->stages[i].maxSeconds)
+        dst->stages[i].maxSeconds = src->stages[i].maxSeconds;
+    }
+  dst->glyphs += src->glyphs;
+  dst->images += src->images;
+  dst->bytesWritten += src->bytesWritten;
+}
+
+const char* render_stage_name(render_stage stage)
+{
+  switch(stage)
+    {
+    case RENDER_STAGE_FACE_LOAD:
+      return "face_load";
+    case RENDER_STAGE_SHAPE:
+      return "shape";
+    case RENDER_STAGE_GLYPH:
+      return "glyph";
+    case RENDER_STAGE_COMPOSITE:
+      return "composite";
+    case RENDER_STAGE_ENCODE:
+      return "encode";
+    default:
+      return "unknown";
+    }
+}
+
+void render_stats_print_json(const render_stats* stats, FILE* out)
+{
+  int i;
+
+  fprintf(out, "{\"glyphs\": %lu, \"images\": %lu, \"bytes_written\": %lu, \"stages\": {",
+          stats->glyphs, stats->images, (unsigned long)stats->bytesWritten);
+  for(i = 0; i < RENDER_STAGE_COUNT; i++)
+    {
+      const render_stage_stats* s = &stats->stages[i];
+      fprintf(out, "%s\"%s\": {\"count\": %lu, \"total_ms\": %.3f, \"mean_us\": %.3f, \"max_us\": %.3f}",
+              i > 0 ? ", " : "", render_stage_name(i), s->count, s->seconds * 1e3,
+              s->count > 0 ? s->seconds * 1e6 / s->count : 0.0, s->maxSeconds * 1e6);
+    }
+  fprintf(out, "}}\n");
+}
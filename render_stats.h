@@ -0,0 +1,77 @@
+/*
+ * Timers and counters of the rendering stages.
+ *
+ * A render_stats is filled by the objects it is attached to. Shape and
+ * glyph caches time their misses: the hb_shape() call, and loading plus
+ * rasterizing a glyph. fontrender times compositing and encoding, and
+ * the tools add face loading and the bytes they write. The clock is only
+ * read while stats are attached, so detached stats cost one pointer
+ * test per cache miss.
+ *
+ * Compositing runs the shaping and glyph stages nested inside it; their
+ * time is subtracted, so the stages add up to the total.
+ *
+ * A render_stats has no lock. Give every thread its own and merge them
+ * at the end.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+typedef enum render_stage
+{
+  RENDER_STAGE_FACE_LOAD = 0,
+  RENDER_STAGE_SHAPE,
+  RENDER_STAGE_GLYPH,
+  RENDER_STAGE_COMPOSITE,
+  RENDER_STAGE_ENCODE,
+  RENDER_STAGE_COUNT
+} render_stage;
+
+typedef struct render_stage_stats
+{
+  unsigned long count;
+  double seconds;
+  double maxSeconds;
+} render_stage_stats;
+
+typedef struct render_stats
+{
+  render_stage_stats stages[RENDER_STAGE_COUNT];
+  /* glyphs of the shaped runs laid out */
+  unsigned long glyphs;
+  unsigned long images;
+  size_t bytesWritten;
+} render_stats;
+
+/* monotonic clock, in seconds */
+double render_stats_now(void);
+
+/* count one run of stage taking seconds */
+void render_stats_add(render_stats* stats, render_stage stage, double seconds);
+
+/* time of the stages that run nested inside compositing */
+double render_stats_nested_seconds(const render_stats* stats);
+
+void render_stats_merge(render_stats* dst, const render_stats* src);
+
+/* name of a stage as used in the JSON report, e.g. "glyph" */
+const char* render_stage_name(render_stage stage);
+
+/*
+ * Write the stats as one JSON object on a line: glyphs, images,
+ * bytes_written, then count, total_ms, mean_us and max_us of every
+ * stage.
+ */
+void render_stats_print_json(const render_stats* stats, FILE* out);
+
+#endif
@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <pthread.h>
+
+#include "sdf.h"
+#include "work_queue.h"
+#include FT_OUTLINE_H
+
+/* longest line segment used for curves, in pixels */
+#define CURVE_STEP 2.0f
+#define MAX_CURVE_STEPS 32
+
+/* a glyph outline flattened into line segments, in pixels */
+typedef struct sdf_outline
+{
+  float* segments; /* x0, y0, x1, y1 */
+  int segmentCount;
+  int segmentCap;
+  float startX, startY;
+  float lastX, lastY;
+  int evenOdd;
+  int failed;
+} sdf_outline;
+
+typedef struct sdf_pool
+{
+  work_queue* queue;
+  sdf_glyph* glyphs;
+  sdf_outline* outlines;
+  int spread;
+} sdf_pool;
+
+typedef struct sdf_worker
+{
+  int id;
+  pthread_t thread;
+  sdf_pool* pool;
+} sdf_worker;
+
+static void add_segment(sdf_outline* o, float x, float y)
+{
+  float* s;
+
+  if (o->segmentCount == o->segmentCap)
+    {
+      int newCap = o->segmentCap > 0 ? o->segmentCap * 2 : 64;
+      float* newSegments = realloc(o->segments, sizeof(float) * 4 * newCap);
+      if (newSegments == NULL)
+        {
+          o->failed = 1;
+          return;
+        }
+      o->segments = newSegments;
+      o->segmentCap = newCap;
+    }
+  s = &o->segments[o->segmentCount * 4];
+  s[0] = o->lastX;
+  s[1] = o->lastY;
+  s[2] = x;
+  s[3] = y;
+  o->segmentCount++;
+  o->lastX = x;
+  o->lastY = y;
+}
+
+static void close_contour(sdf_outline* o)
+{
+  if (o->lastX != o->startX || o->lastY != o->startY)
+    add_segment(o, o->startX, o->startY);
+}
+
+static int curve_steps(float length)
+{
+  int n = (int)(length / CURVE_STEP) + 1;
+  return n < MAX_CURVE_STEPS ? n : MAX_CURVE_STEPS;
+}
+
+static int move_to(const FT_Vector* to, void* user)
+{
+  sdf_outline* o = user;
+  close_contour(o);
+  o->startX = o->lastX = to->x / 64.0f;
+  o->startY = o->lastY = to->y / 64.0f;
+  return 0;
+}
+
+static int line_to(const FT_Vector* to, void* user)
+{
+  add_segment(user, to->x / 64.0f, to->y / 64.0f);
+  return 0;
+}
+
+static int conic_to(const FT_Vector* control, const FT_Vector* to, void* user)
+{
+  sdf_outline* o = user;
+  float x0 = o->lastX, y0 = o->lastY;
+  float x1 = control->x / 64.0f, y1 = control->y / 64.0f;
+  float x2 = to->x / 64.0f, y2 = to->y / 64.0f;
+  int n = curve_steps(hypotf(x1 - x0, y1 - y0) + hypotf(x2 - x1, y2 - y1));
+  int i;
+
+  for(i = 1; i <= n; i++)
+    {
+      float t = (float)i / n;
+      float u = 1 - t;
+      add_segment(o, u * u * x0 + 2 * u * t * x1 + t * t * x2,
+                  u * u * y0 + 2 * u * t * y1 + t * t * y2);
+    }
+  return 0;
+}
+
+static int cubic_to(const FT_Vector* control1, const FT_Vector* control2,
+                    const FT_Vector* to, void* user)
+{
+  sdf_outline* o = user;
+  float x0 = o->lastX, y0 = o->lastY;
+  float x1 = control1->x / 64.0f, y1 = control1->y / 64.0f;
+  float x2 = control2->x / 64.0f, y2 = control2->y / 64.0f;
+  float x3 = to->x / 64.0f, y3 = to->y / 64.0f;
+  int n = curve_steps(hypotf(x1 - x0, y1 - y0) + hypotf(x2 - x1, y2 - y1)
+                      + hypotf(x3 - x2, y3 - y2));
+  int i;
+
+  for(i = 1; i <= n; i++)
+    {
+      float t = (float)i / n;
+      float u = 1 - t;
+      add_segment(o, u * u * u * x0 + 3 * u * u * t * x1 + 3 * u * t * t * x2 + t * t * t * x3,
+                  u * u * u * y0 + 3 * u * u * t * y1 + 3 * u * t * t * y2 + t * t * t * y3);
+    }
+  return 0;
+}
+
+/*
+ * Load a glyph and flatten its outline; also fixes the bitmap box.
+ * Glyphs without an outline come out blank.
+ */
+static int load_outline(FT_Face face, sdf_glyph* g, sdf_outline* o, int spread)
+{
+  static const FT_Outline_Funcs funcs = { move_to, line_to, conic_to, cubic_to, 0, 0 };
+  FT_Outline* outline;
+  FT_BBox cbox;
+
+  if (FT_Load_Glyph(face, g->glyphIndex, FT_LOAD_NO_HINTING | FT_LOAD_NO_BITMAP))
+    {
+      fprintf(stderr, "ERROR: cannot load glyph %u\n", g->glyphIndex);
+      return -1;
+    }
+  if (face->glyph->format != FT_GLYPH_FORMAT_OUTLINE
+      || face->glyph->outline.n_contours == 0)
+    {
+      return 0;
+    }
+  outline = &face->glyph->outline;
+  o->evenOdd = (outline->flags & FT_OUTLINE_EVEN_ODD_FILL) != 0;
+  FT_Outline_Decompose(outline, &funcs, o);
+  close_contour(o);
+  if (o->failed)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return -1;
+    }
+
+  FT_Outline_Get_CBox(outline, &cbox);
+  g->left = (int)floor(cbox.xMin / 64.0) - spread;
+  g->top = (int)ceil(cbox.yMax / 64.0) + spread;
+  g->width = (int)ceil(cbox.xMax / 64.0) + spread - g->left;
+  g->rows = g->top - ((int)floor(cbox.yMin / 64.0) - spread);
+  return 0;
+}
+
+/*
+ * Distance from every pixel center to the nearest segment. The sign
+ * comes from the winding number of a ray cast towards +x.
+ */
+static int compute_field(sdf_glyph* g, const sdf_outline* o, int spread)
+{
+  int i, j, s;
+
+  if (o->segmentCount == 0)
+    return 0;
+  g->buffer = malloc((size_t)g->width * g->rows);
+  if (g->buffer == NULL)
+    return -1;
+
+  for(j = 0; j < g->rows; j++)
+    {
+      float py = g->top - j - 0.5f;
+      for(i = 0; i < g->width; i++)
+        {
+          float px = g->left + i + 0.5f;
+          float minSq = FLT_MAX;
+          int winding = 0;
+          int inside;
+          float d;
+
+          for(s = 0; s < o->segmentCount; s++)
+            {
+              const float* seg = &o->segments[s * 4];
+              float dx = seg[2] - seg[0];
+              float dy = seg[3] - seg[1];
+              float len2 = dx * dx + dy * dy;
+              float t = 0;
+              float ex, ey, cross;
+
+              if (len2 > 0)
+                {
+                  t = ((px - seg[0]) * dx + (py - seg[1]) * dy) / len2;
+                  t = t < 0 ? 0 : (t > 1 ? 1 : t);
+                }
+              ex = seg[0] + t * dx - px;
+              ey = seg[1] + t * dy - py;
+              if (ex * ex + ey * ey < minSq)
+                minSq = ex * ex + ey * ey;
+
+              cross = dx * (py - seg[1]) - (px - seg[0]) * dy;
+              if (seg[1] <= py)
+                {
+                  if (seg[3] > py && cross > 0)
+                    winding++;
+                }
+              else if (seg[3] <= py && cross < 0)
+                {
+                  winding--;
+                }
+            }
+
+          inside = o->evenOdd ? (winding & 1) : winding != 0;
+          d = sqrtf(minSq);
+          d = 127.5f + (inside ? d : -d) * 127.5f / spread;
+          g->buffer[j * g->width + i] = d <= 0 ? 0 : (d >= 255 ? 255 : (unsigned char)(d + 0.5f));
+        }
+    }
+  return 0;
+}
+
+static void* sdf_worker_main(void* arg)
+{
+  sdf_worker* wk = arg;
+  sdf_pool* pool = wk->pool;
+  int j;
+
+  while(work_queue_pop(pool->queue, wk->id, &j) == 0)
+    {
+      if (compute_field(&pool->glyphs[j], &pool->outlines[j], pool->spread) != 0)
+        pool->outlines[j].failed = 1;
+    }
+  return NULL;
+}
+
+int sdf_render_glyphs(FT_Face face, const unsigned int* glyphIndices, int count,
+                      int spread, int threads, sdf_glyph* out)
+{
+  sdf_pool pool;
+  sdf_worker* workers;
+  int failed = 0;
+  int started = 0;
+  int i;
+
+  if (spread <= 0)
+    spread = 1;
+  if (threads <= 0)
+    threads = 1;
+  if (threads > count)
+    threads = count > 0 ? count : 1;
+  memset(out, 0, sizeof(sdf_glyph) * count);
+  memset(&pool, 0, sizeof(pool));
+  pool.glyphs = out;
+  pool.spread = spread;
+  pool.outlines = calloc(count > 0 ? count : 1, sizeof(sdf_outline));
+  pool.queue = work_queue_new(threads, count / threads + 1);
+  workers = calloc(threads, sizeof(sdf_worker));
+  if (pool.outlines == NULL || pool.queue == NULL || workers == NULL)
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      failed = 1;
+    }
+
+  for(i = 0; i < count && !failed; i++)
+    {
+      out[i].glyphIndex = glyphIndices[i];
+      if (load_outline(face, &out[i], &pool.outlines[i], spread) != 0)
+        failed = 1;
+      else
+        work_queue_push(pool.queue, i % threads, i);
+    }
+
+  if (!failed)
+    {
+      /* the calling thread works too, as worker 0 */
+      for(i = 0; i < threads; i++)
+        {
+          workers[i].id = i;
+          workers[i].pool = &pool;
+        }
+      for(i = 1; i < threads; i++, started++)
+        {
+          if (pthread_create(&workers[i].thread, NULL, sdf_worker_main, &workers[i]) != 0)
+            break;
+        }
+      sdf_worker_main(&workers[0]);
+      for(i = 1; i <= started; i++)
+        {
+          pthread_join(workers[i].thread, NULL);
+        }
+      /* jobs of workers that could not start were stolen by the others */
+    }
+
+  for(i = 0; i < count && pool.outlines != NULL; i++)
+    {
+      if (pool.outlines[i].failed && !failed)
+        {
+          fprintf(stderr, "ERROR: out of memory\n");
+          failed = 1;
+        }
+      free(pool.outlines[i].segments);
+    }
+  free(pool.outlines);
+  free(workers);
+  work_queue_free(pool.queue);
+  if (failed)
+    {
+      sdf_glyphs_free(out, count);
+      return -1;
+    }
+  return 0;
+}
+
+void sdf_glyphs_free(sdf_glyph* glyphs, int count)
+{
+  int i;
+  for(i = 0; i < count; i++)
+    {
+      free(glyphs[i].buffer);
+      glyphs[i].buffer = NULL;
+    }
+}
@@ -0,0 +1,51 @@
+/*
+ * Signed distance field glyphs.
+ *
+ * Outlines are flattened into line segments, and every pixel stores the
+ * distance from its center to the nearest segment, signed by whether the
+ * center is inside the glyph. 128 is on the outline, larger values are
+ * inside, and spread pixels away from the outline the value reaches 0 or
+ * 255. A shader thresholding at 0.5 draws sharp edges at any scale from
+ * one small bitmap.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef SDF_H
+#define SDF_H
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+typedef struct sdf_glyph
+{
+  unsigned int glyphIndex;
+  /* like bitmap_left and bitmap_top, including the spread margin */
+  int left;
+  int top;
+  int width;
+  int rows;
+  /* width bytes per row; NULL for blank glyphs */
+  unsigned char* buffer;
+} sdf_glyph;
+
+/*
+ * Build distance fields for count glyphs of face, at its current size.
+ * Glyphs are loaded unhinted. spread is the distance, in pixels, covered
+ * by the value range on each side of the outline; the bitmaps get a
+ * margin of that many pixels.
+ *
+ * Outlines are loaded on the calling thread, since FT_Face is not
+ * thread-safe; the distance fields are computed by threads worker
+ * threads. Returns -1 on failure, after freeing everything.
+ */
+int sdf_render_glyphs(FT_Face face, const unsigned int* glyphIndices, int count,
+                      int spread, int threads, sdf_glyph* out);
+
+void sdf_glyphs_free(sdf_glyph* glyphs, int count);
+
+#endif
@@ -0,0 +1,386 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "shape_cache.h"
+
+#define INITIAL_BUCKET_COUNT 256
+
+shape_cache* shape_cache_new(size_t maxBytes)
+{
+  shape_cache* cache = calloc(1, sizeof(shape_cache));
+  if (cache == NULL)
+    {
+      return NULL;
+    }
+  cache->bucketCount = INITIAL_BUCKET_COUNT;
+  cache->buckets = calloc(cache->bucketCount, sizeof(shape_cache_entry*));
+  if (cache->buckets == NULL)
+    {
+      free(cache);
+      return NULL;
+    }
+  cache->maxBytes = maxBytes;
+  return cache;
+}
+
+void shape_cache_free(shape_cache* cache)
+{
+  shape_cache_entry* e;
+  shape_cache_entry* next;
+
+  if (cache == NULL)
+    return;
+  for(e = cache->lruHead; e != NULL; e = next)
+    {
+      next = e->lruNext;
+      free(e);
+    }
+  free(cache->joinedGlyphs);
+  free(cache->segments);
+  free(cache->buckets);
+  free(cache);
+}
+
+static uint32_t hash_bytes(uint32_t h, const void* data, size_t len)
+{
+  const unsigned char* p = data;
+  size_t i;
+  for(i = 0; i < len; i++)
+    {
+      h = (h ^ p[i]) * 16777619u;
+    }
+  return h;
+}
+
+static unsigned int hash_key(hb_font_t* font, int xScale, int yScale,
+                             hb_direction_t direction, hb_script_t script, hb_language_t language,
+                             const char* text, int textLen,
+                             const hb_feature_t* features, unsigned int featureCount)
+{
+  uint32_t h = 2166136261u;
+  h = (h ^ (uint32_t)(uintptr_t)font) * 16777619u;
+  h = (h ^ (uint32_t)xScale) * 16777619u;
+  h = (h ^ (uint32_t)yScale) * 16777619u;
+  h = (h ^ (uint32_t)direction) * 16777619u;
+  h = (h ^ (uint32_t)script) * 16777619u;
+  /* languages are interned by harfbuzz, so the pointer is the identity */
+  h = (h ^ (uint32_t)(uintptr_t)language) * 16777619u;
+  h = hash_bytes(h, text, textLen);
+  h = hash_bytes(h, features, sizeof(hb_feature_t) * featureCount);
+  return h;
+}
+
+static void lru_unlink(shape_cache* cache, shape_cache_entry* e)
+{
+  if (e->lruPrev != NULL)
+    e->lruPrev->lruNext = e->lruNext;
+  else
+    cache->lruHead = e->lruNext;
+  if (e->lruNext != NULL)
+    e->lruNext->lruPrev = e->lruPrev;
+  else
+    cache->lruTail = e->lruPrev;
+  e->lruPrev = NULL;
+  e->lruNext = NULL;
+}
+
+static void lru_push_front(shape_cache* cache, shape_cache_entry* e)
+{
+  e->lruPrev = NULL;
+  e->lruNext = cache->lruHead;
+  if (cache->lruHead != NULL)
+    cache->lruHead->lruPrev = e;
+  cache->lruHead = e;
+  if (cache->lruTail == NULL)
+    cache->lruTail = e;
+}
+
+static void hash_remove(shape_cache* cache, shape_cache_entry* e)
+{
+  shape_cache_entry** p = &cache->buckets[e->hash & (cache->bucketCount - 1)];
+  while(*p != NULL && *p != e)
+    {
+      p = &(*p)->hashNext;
+    }
+  if (*p == e)
+    *p = e->hashNext;
+}
+
+static void grow_buckets(shape_cache* cache)
+{
+  unsigned int newCount = cache->bucketCount * 2;
+  shape_cache_entry** newBuckets = calloc(newCount, sizeof(shape_cache_entry*));
+  shape_cache_entry* e;
+
+  /* keep the old table if we are short of memory; lookups still work */
+  if (newBuckets == NULL)
+    return;
+  for(e = cache->lruHead; e != NULL; e = e->lruNext)
+    {
+      unsigned int b = e->hash & (newCount - 1);
+      e->hashNext = newBuckets[b];
+      newBuckets[b] = e;
+    }
+  free(cache->buckets);
+  cache->buckets = newBuckets;
+  cache->bucketCount = newCount;
+}
+
+static void evict_until(shape_cache* cache, size_t limit)
+{
+  while(cache->bytes > limit && cache->lruTail != NULL)
+    {
+      shape_cache_entry* victim = cache->lruTail;
+      lru_unlink(cache, victim);
+      hash_remove(cache, victim);
+      cache->bytes -= victim->bytes;
+      cache->count--;
+      cache->evictions++;
+      free(victim);
+    }
+}
+
+/*
+ * Copy the shaped buffer and the key into one new allocation: the entry,
+ * the glyphs, the features, then the text.
+ */
+static shape_cache_entry* new_entry(hb_buffer_t* buffer, const char* text, int textLen,
+                                    const hb_feature_t* features, unsigned int featureCount)
+{
+  unsigned int infoLen, posLen, count, i;
+  hb_glyph_info_t* glyphInfo = hb_buffer_get_glyph_infos(buffer, &infoLen);
+  hb_glyph_position_t* glyphPos = hb_buffer_get_glyph_positions(buffer, &posLen);
+  shape_cache_entry* e;
+  shaped_glyph* glyphs;
+  hb_feature_t* featureCopy;
+  char* textCopy;
+  size_t bytes;
+
+  if(infoLen != posLen)
+    {
+      fprintf(stderr, "WARNING: infoLen != posLen!!\n");
+    }
+  count = infoLen < posLen ? infoLen : posLen;
+  bytes = sizeof(shape_cache_entry) + sizeof(shaped_glyph) * count
+    + sizeof(hb_feature_t) * featureCount + textLen;
+  e = malloc(bytes);
+  if (e == NULL)
+    {
+      return NULL;
+    }
+  memset(e, 0, sizeof(shape_cache_entry));
+  glyphs = (shaped_glyph*)(e + 1);
+  featureCopy = (hb_feature_t*)(glyphs + count);
+  textCopy = (char*)(featureCopy + featureCount);
+
+  for(i = 0; i < count; i++)
+    {
+      glyphs[i].glyphIndex = glyphInfo[i].codepoint;
+      glyphs[i].cluster = glyphInfo[i].cluster;
+      glyphs[i].xAdvance = glyphPos[i].x_advance;
+      glyphs[i].yAdvance = glyphPos[i].y_advance;
+      glyphs[i].xOffset = glyphPos[i].x_offset;
+      glyphs[i].yOffset = glyphPos[i].y_offset;
+    }
+  if (featureCount > 0)
+    memcpy(featureCopy, features, sizeof(hb_feature_t) * featureCount);
+  memcpy(textCopy, text, textLen);
+
+  e->glyphs = glyphs;
+  e->count = count;
+  e->features = featureCopy;
+  e->featureCount = featureCount;
+  e->text = textCopy;
+  e->textLen = textLen;
+  e->bytes = bytes;
+  return e;
+}
+
+const shape_cache_entry* shape_cache_shape(shape_cache* cache, hb_font_t* font,
+                                           hb_buffer_t* buffer,
+                                           const char* text, int textLen,
+                                           const hb_segment_properties_t* props,
+                                           const hb_feature_t* features,
+                                           unsigned int featureCount)
+{
+  hb_direction_t direction = props != NULL ? props->direction : HB_DIRECTION_INVALID;
+  hb_script_t script = props != NULL ? props->script : HB_SCRIPT_INVALID;
+  hb_language_t language = props != NULL ? props->language : HB_LANGUAGE_INVALID;
+  int xScale, yScale;
+  unsigned int h;
+  shape_cache_entry* e;
+  double start = 0;
+
+  hb_font_get_scale(font, &xScale, &yScale);
+  h = hash_key(font, xScale, yScale, direction, script, language,
+               text, textLen, features, featureCount);
+  for(e = cache->buckets[h & (cache->bucketCount - 1)]; e != NULL; e = e->hashNext)
+    {
+      if (e->hash == h && e->font == font && e->xScale == xScale && e->yScale == yScale
+          && e->direction == direction && e->script == script && e->language == language
+          && e->textLen == textLen && e->featureCount == featureCount
+          && memcmp(e->text, text, textLen) == 0
+          && (featureCount == 0
+              || memcmp(e->features, features, sizeof(hb_feature_t) * featureCount) == 0))
+        {
+          cache->hits++;
+          lru_unlink(cache, e);
+          lru_push_front(cache, e);
+          return e;
+        }
+    }
+
+  cache->misses++;
+  if (cache->stats != NULL)
+    start = render_stats_now();
+  hb_buffer_clear_contents(buffer);
+  hb_buffer_add_utf8(buffer, text, textLen, 0, textLen);
+  if (props != NULL)
+    hb_buffer_set_segment_properties(buffer, props);
+  else
+    hb_buffer_guess_segment_properties(buffer);
+  hb_shape(font, buffer, features, featureCount);
+  if (cache->stats != NULL)
+    render_stats_add(cache->stats, RENDER_STAGE_SHAPE, render_stats_now() - start);
+
+  e = new_entry(buffer, text, textLen, features, featureCount);
+  if (e == NULL)
+    {
+      return NULL;
+    }
+  e->hash = h;
+  e->font = font;
+  e->xScale = xScale;
+  e->yScale = yScale;
+  e->direction = direction;
+  e->script = script;
+  e->language = language;
+
+  /* make room first, so the new entry itself is never evicted here */
+  if (e->bytes < cache->maxBytes)
+    evict_until(cache, cache->maxBytes - e->bytes);
+  else
+    evict_until(cache, 0);
+
+  if (cache->count >= cache->bucketCount * 2)
+    grow_buckets(cache);
+  e->hashNext = cache->buckets[h & (cache->bucketCount - 1)];
+  cache->buckets[h & (cache->bucketCount - 1)] = e;
+  lru_push_front(cache, e);
+  cache->bytes += e->bytes;
+  cache->count++;
+  return e;
+}
+
+/* start and length of every piece, in text order */
+static int split_words(shape_cache* cache, const char* text, int textLen)
+{
+  int count = 0;
+  int start = 0;
+  int i = 0;
+
+  while(start < textLen)
+    {
+      while(i < textLen && text[i] != ' ')
+        i++;
+      while(i < textLen && text[i] == ' ')
+        i++;
+      if (count * 2 + 2 > cache->segmentCap)
+        {
+          int newCap = cache->segmentCap > 0 ? cache->segmentCap * 2 : 64;
+          int* newSegments = realloc(cache->segments, sizeof(int) * newCap);
+          if (newSegments == NULL)
+            return -1;
+          cache->segments = newSegments;
+          cache->segmentCap = newCap;
+        }
+      cache->segments[count * 2] = start;
+      cache->segments[count * 2 + 1] = i - start;
+      count++;
+      start = i;
+    }
+  return count;
+}
+
+const shape_cache_entry* shape_cache_shape_words(shape_cache* cache, hb_font_t* font,
+                                                 hb_buffer_t* buffer,
+                                                 const char* text, int textLen,
+                                                 const hb_feature_t* features,
+                                                 unsigned int featureCount)
+{
+  hb_segment_properties_t props;
+  int segmentCount;
+  int backward;
+  unsigned int total = 0;
+  int n, i;
+
+  segmentCount = split_words(cache, text, textLen);
+  if (segmentCount < 0)
+    {
+      return NULL;
+    }
+
+  /* the whole text decides direction, script and language */
+  hb_buffer_clear_contents(buffer);
+  hb_buffer_add_utf8(buffer, text, textLen, 0, textLen);
+  hb_buffer_guess_segment_properties(buffer);
+  hb_buffer_get_segment_properties(buffer, &props);
+  backward = HB_DIRECTION_IS_BACKWARD(props.direction);
+
+  for(n = 0; n < segmentCount; n++)
+    {
+      int seg = backward ? segmentCount - 1 - n : n;
+      int start = cache->segments[seg * 2];
+      const shape_cache_entry* e = shape_cache_shape(cache, font, buffer,
+                                                     text + start, cache->segments[seg * 2 + 1],
+                                                     &props, features, featureCount);
+      if (e == NULL)
+        {
+          return NULL;
+        }
+      if (total + e->count > cache->joinedCap)
+        {
+          unsigned int newCap = cache->joinedCap > 0 ? cache->joinedCap : 256;
+          shaped_glyph* newGlyphs;
+          while(newCap < total + e->count)
+            newCap *= 2;
+          newGlyphs = realloc(cache->joinedGlyphs, sizeof(shaped_glyph) * newCap);
+          if (newGlyphs == NULL)
+            {
+              return NULL;
+            }
+          cache->joinedGlyphs = newGlyphs;
+          cache->joinedCap = newCap;
+        }
+      for(i = 0; i < e->count; i++)
+        {
+          cache->joinedGlyphs[total + i] = e->glyphs[i];
+          cache->joinedGlyphs[total + i].cluster += start;
+        }
+      total += e->count;
+    }
+
+  memset(&cache->joined, 0, sizeof(shape_cache_entry));
+  cache->joined.font = font;
+  hb_font_get_scale(font, &cache->joined.xScale, &cache->joined.yScale);
+  cache->joined.direction = props.direction;
+  cache->joined.script = props.script;
+  cache->joined.language = props.language;
+  cache->joined.text = text;
+  cache->joined.textLen = textLen;
+  cache->joined.features = features;
+  cache->joined.featureCount = featureCount;
+  cache->joined.glyphs = cache->joinedGlyphs;
+  cache->joined.count = total;
+  return &cache->joined;
+}
@@ -0,0 +1,148 @@
+/*
+ * Cache of shaping results.
+ *
+ * Labels, UI strings and numbers are rendered over and over, and
+ * hb_shape() is a large part of the cost of short strings. Results are
+ * kept in LRU order, keyed by the hb_font_t and its scale, the text,
+ * the segment properties and the features it was shaped with. A hit
+ * skips hb_buffer_add_utf8(), hb_buffer_guess_segment_properties() and
+ * hb_shape().
+ *
+ * Each entry is one allocation: the entry, its glyphs as a flat array,
+ * then the copied key text and features.
+ *
+ * Text can also be shaped a word at a time, the way browsers do it: a
+ * changed word in a templated sentence then costs one small miss instead
+ * of shaping the whole sentence again.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef SHAPE_CACHE_H
+#define SHAPE_CACHE_H
+
+#include <stddef.h>
+#include <hb.h>
+
+#include "render_stats.h"
+
+/* one shaped glyph; positions are in font units, as harfbuzz gives them */
+typedef struct shaped_glyph
+{
+  unsigned int glyphIndex;
+  unsigned int cluster;
+  int xAdvance;
+  int yAdvance;
+  int xOffset;
+  int yOffset;
+} shaped_glyph;
+
+typedef struct shape_cache_entry
+{
+  /* key */
+  unsigned int hash;
+  hb_font_t* font;
+  int xScale;
+  int yScale;
+  hb_direction_t direction;
+  hb_script_t script;
+  hb_language_t language;
+  const char* text;
+  int textLen;
+  const hb_feature_t* features;
+  unsigned int featureCount;
+
+  /* value */
+  const shaped_glyph* glyphs;
+  unsigned int count;
+
+  /* bookkeeping */
+  size_t bytes;
+  struct shape_cache_entry* hashNext;
+  struct shape_cache_entry* lruPrev;
+  struct shape_cache_entry* lruNext;
+} shape_cache_entry;
+
+typedef struct shape_cache
+{
+  shape_cache_entry** buckets;
+  unsigned int bucketCount;
+  unsigned int count;
+  size_t bytes;
+  size_t maxBytes;
+  /* text_render shapes through shape_cache_shape_words() when set */
+  int splitWords;
+  /* most recently used at head */
+  shape_cache_entry* lruHead;
+  shape_cache_entry* lruTail;
+
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  /*
+   * when set, hb_shape() of every miss is timed as RENDER_STAGE_SHAPE,
+   * and text_render counts the glyphs it lays out
+   */
+  render_stats* stats;
+
+  /* result of shape_cache_shape_words(), reused between calls */
+  shape_cache_entry joined;
+  shaped_glyph* joinedGlyphs;
+  unsigned int joinedCap;
+  int* segments;
+  int segmentCap;
+} shape_cache;
+
+/*
+ * maxBytes bounds the memory of all entries. With 0 nothing is kept
+ * beyond the latest result, which turns caching off.
+ */
+shape_cache* shape_cache_new(size_t maxBytes);
+void shape_cache_free(shape_cache* cache);
+
+/*
+ * Shape textLen bytes of UTF-8 text with font, or find the result of an
+ * earlier call with the same key. buffer is only used on a miss. props
+ * NULL means the properties are guessed from the text. features are
+ * passed to hb_shape() as they are.
+ *
+ * The cache identifies fonts by pointer, so it must not outlive the
+ * fonts it has seen; keep one cache per font when fonts come and go.
+ *
+ * The entry belongs to the cache and stays valid until the next call to
+ * shape_cache_shape() or shape_cache_free(). Returns NULL when out of
+ * memory.
+ */
+const shape_cache_entry* shape_cache_shape(shape_cache* cache, hb_font_t* font,
+                                           hb_buffer_t* buffer,
+                                           const char* text, int textLen,
+                                           const hb_segment_properties_t* props,
+                                           const hb_feature_t* features,
+                                           unsigned int featureCount);
+
+/*
+ * Like shape_cache_shape(), but the text is cut after every run of
+ * spaces (U+0020), each piece is shaped and cached on its own, and the
+ * glyphs are joined again with clusters relative to the whole text.
+ *
+ * The segment properties are guessed once from the whole text and used
+ * for every piece, so a piece like "42" still follows the direction of
+ * the sentence; in right-to-left text the pieces are joined in reverse.
+ * Joining scripts such as Arabic are safe, since no shaping crosses a
+ * space; scripts written without spaces are never cut. Kerning against
+ * a space is lost.
+ *
+ * The result belongs to the cache and stays valid until the next call
+ * to shape_cache_shape_words(). Returns NULL when out of memory.
+ */
+const shape_cache_entry* shape_cache_shape_words(shape_cache* cache, hb_font_t* font,
+                                                 hb_buffer_t* buffer,
+                                                 const char* text, int textLen,
+                                                 const hb_feature_t* features,
+                                                 unsigned int featureCount);
+
+#endif
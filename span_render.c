@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "span_render.h"
+
+static void gray_spans(int y, int count, const FT_Span* spans, void* user)
+{
+  span_target* t = user;
+  int row = t->originY - 1 - y;
+  unsigned char* dst;
+  int i;
+
+  if (row < 0 || row >= t->rows)
+    return;
+  dst = t->buffer + (size_t)row * t->pitch;
+  for(i = 0; i < count; i++)
+    {
+      int x0 = spans[i].x + t->originX;
+      int x1 = x0 + spans[i].len;
+
+      if (x0 < 0)
+        x0 = 0;
+      if (x1 > t->width)
+        x1 = t->width;
+      if (x0 >= x1)
+        continue;
+      memset(dst + x0, spans[i].coverage, x1 - x0);
+    }
+}
+
+void span_outline_box(const FT_Outline* outline, FT_Pos xShift,
+                      int* left, int* top, int* width, int* rows)
+{
+  FT_BBox cbox;
+
+  FT_Outline_Get_CBox(outline, &cbox);
+  cbox.xMin = (cbox.xMin + xShift) & -64;
+  cbox.xMax = (cbox.xMax + xShift + 63) & -64;
+  cbox.yMin = cbox.yMin & -64;
+  cbox.yMax = (cbox.yMax + 63) & -64;
+  *left = cbox.xMin >> 6;
+  *top = cbox.yMax >> 6;
+  *width = (cbox.xMax - cbox.xMin) >> 6;
+  *rows = (cbox.yMax - cbox.yMin) >> 6;
+}
+
+int span_render_outline(FT_Library library, FT_Outline* outline, span_target* target)
+{
+  FT_Raster_Params params;
+  FT_BBox cbox;
+  span_target shifted = *target;
+  FT_Error err;
+
+  if (target->width <= 0 || target->rows <= 0)
+    return 0;
+
+  /*
+   * Like FT_Render_Glyph(), move the pixel-aligned control box to the
+   * origin first. The rasterizer rounds negative coordinates slightly
+   * differently, so this keeps the coverage identical.
+   */
+  FT_Outline_Get_CBox(outline, &cbox);
+  cbox.xMin &= -64;
+  cbox.yMin &= -64;
+  FT_Outline_Translate(outline, -cbox.xMin, -cbox.yMin);
+  shifted.originX += cbox.xMin >> 6;
+  shifted.originY -= cbox.yMin >> 6;
+
+  memset(&params, 0, sizeof(params));
+  params.source = outline;
+  params.flags = FT_RASTER_FLAG_AA | FT_RASTER_FLAG_DIRECT;
+  params.gray_spans = gray_spans;
+  params.user = &shifted;
+  err = FT_Outline_Render(library, outline, &params);
+  FT_Outline_Translate(outline, cbox.xMin, cbox.yMin);
+  if (err)
+    {
+      fprintf(stderr, "ERROR: cannot rasterize outline\n");
+      return -1;
+    }
+  return 0;
+}
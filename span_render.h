@@ -0,0 +1,53 @@
+/*
+ * Outline rasterization straight into a caller's coverage buffer.
+ *
+ * FT_Render_Glyph() renders into a bitmap owned by the glyph slot, which
+ * then has to be copied to where it is needed. Here the smooth
+ * rasterizer runs in direct mode instead: it hands over horizontal spans
+ * of equal coverage, and these are written into the target as they
+ * come, clipped to its rectangle. The coverage values are the
+ * ones FT_Render_Glyph() would produce for the same outline.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef SPAN_RENDER_H
+#define SPAN_RENDER_H
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_OUTLINE_H
+
+typedef struct span_target
+{
+  /* 8-bit coverage, pitch bytes per row, top row first; spans overwrite it */
+  unsigned char* buffer;
+  int pitch;
+  int width;
+  int rows;
+  /*
+   * where the outline origin lands: outline pixel (x, y) goes to column
+   * x + originX, row originY - 1 - y
+   */
+  int originX;
+  int originY;
+} span_target;
+
+/*
+ * Pixel box the smooth rasterizer would give the outline after shifting
+ * it right by xShift (26.6), as bitmap_left, bitmap_top, width and rows.
+ */
+void span_outline_box(const FT_Outline* outline, FT_Pos xShift,
+                      int* left, int* top, int* width, int* rows);
+
+/*
+ * Rasterize an outline, in 26.6 pixels, into the target. Pixels outside
+ * the target are dropped. Returns -1 if FreeType fails.
+ */
+int span_render_outline(FT_Library library, FT_Outline* outline, span_target* target);
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "text_batch.h"
+
+text_batch* text_batch_new(GLint positionVar, GLint uvVar)
+{
+  text_batch* batch;
+  GLushort* indices;
+  int i;
+
+  batch = calloc(1, sizeof(text_batch));
+  if (batch == NULL)
+    {
+      return NULL;
+    }
+  batch->vertices = malloc(sizeof(text_vertex) * 4 * TEXT_BATCH_MAX_QUADS);
+  indices = malloc(sizeof(GLushort) * 6 * TEXT_BATCH_MAX_QUADS);
+  if (batch->vertices == NULL || indices == NULL)
+    {
+      free(batch->vertices);
+      free(indices);
+      free(batch);
+      return NULL;
+    }
+  batch->positionVar = positionVar;
+  batch->uvVar = uvVar;
+  batch->page = -1;
+
+  /* the index pattern is the same for every quad, so it is built once */
+  for(i = 0; i < TEXT_BATCH_MAX_QUADS; i++)
+    {
+      /* counter-clockwise: top-left, bottom-left, bottom-right, top-right */
+      indices[i * 6] = i * 4;
+      indices[i * 6 + 1] = i * 4 + 1;
+      indices[i * 6 + 2] = i * 4 + 2;
+      indices[i * 6 + 3] = i * 4;
+      indices[i * 6 + 4] = i * 4 + 2;
+      indices[i * 6 + 5] = i * 4 + 3;
+    }
+  glGenBuffers(1, &batch->indexBuffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->indexBuffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * 6 * TEXT_BATCH_MAX_QUADS,
+               indices, GL_STATIC_DRAW);
+  free(indices);
+
+  glGenBuffers(1, &batch->vertexBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, batch->vertexBuffer);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(text_vertex) * 4 * TEXT_BATCH_MAX_QUADS,
+               NULL, GL_STREAM_DRAW);
+  return batch;
+}
+
+void text_batch_free(text_batch* batch)
+{
+  if (batch == NULL)
+    return;
+  glDeleteBuffers(1, &batch->vertexBuffer);
+  glDeleteBuffers(1, &batch->indexBuffer);
+  free(batch->vertices);
+  free(batch);
+}
+
+void text_batch_flush(text_batch* batch, glyph_atlas* atlas)
+{
+  size_t bytes = sizeof(text_vertex) * 4 * batch->quadCount;
+
+  if (batch->quadCount == 0)
+    return;
+
+  glBindBuffer(GL_ARRAY_BUFFER, batch->vertexBuffer);
+  /* orphan the old storage, then fill the fresh one */
+  glBufferData(GL_ARRAY_BUFFER, sizeof(text_vertex) * 4 * TEXT_BATCH_MAX_QUADS,
+               NULL, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, batch->vertices);
+  glVertexAttribPointer(batch->positionVar, 2, GL_FLOAT, GL_FALSE,
+                        sizeof(text_vertex), (const void*)0);
+  glVertexAttribPointer(batch->uvVar, 2, GL_FLOAT, GL_FALSE,
+                        sizeof(text_vertex), (const void*)(2 * sizeof(float)));
+  glEnableVertexAttribArray(batch->positionVar);
+  glEnableVertexAttribArray(batch->uvVar);
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->indexBuffer);
+  glBindTexture(GL_TEXTURE_2D, atlas->pages[batch->page].texture);
+  glDrawElements(GL_TRIANGLES, batch->quadCount * 6, GL_UNSIGNED_SHORT, NULL);
+
+  batch->drawCalls++;
+  batch->quads += batch->quadCount;
+  batch->quadCount = 0;
+  batch->page = -1;
+}
+
+static void put_vertex(text_vertex* v, float x, float y, float u, float tv)
+{
+  v->x = x;
+  v->y = y;
+  v->u = u;
+  v->v = tv;
+}
+
+float text_batch_add_run(text_batch* batch, glyph_atlas* atlas, FT_Face face,
+                         hb_buffer_t* buffer, float x, float y)
+{
+  unsigned int infoLen, posLen;
+  hb_glyph_info_t* glyphInfo = hb_buffer_get_glyph_infos(buffer, &infoLen);
+  hb_glyph_position_t* glyphPos = hb_buffer_get_glyph_positions(buffer, &posLen);
+  int x26_6 = 0;
+  int y26_6 = 0;
+  unsigned int i;
+
+  for(i = 0; i < infoLen && i < posLen; i++)
+    {
+      const glyph_atlas_entry* g;
+      text_vertex* v;
+      float x0, y0;
+
+      g = glyph_atlas_find(atlas, face, glyphInfo[i].codepoint);
+      if (g == NULL)
+        {
+          /* uploading may reuse texels the queued quads still sample */
+          text_batch_flush(batch, atlas);
+          g = glyph_atlas_get(atlas, face, glyphInfo[i].codepoint);
+        }
+      if (g != NULL && g->page >= 0)
+        {
+          if (batch->quadCount == TEXT_BATCH_MAX_QUADS
+              || (batch->quadCount > 0 && batch->page != g->page))
+            {
+              text_batch_flush(batch, atlas);
+            }
+          batch->page = g->page;
+
+          x0 = floorf(x + (x26_6 + glyphPos[i].x_offset) / 64.0f + 0.5f) + g->left;
+          y0 = floorf(y - (y26_6 + glyphPos[i].y_offset) / 64.0f + 0.5f) - g->top;
+          v = &batch->vertices[batch->quadCount * 4];
+          put_vertex(&v[0], x0, y0, g->u0, g->v0);
+          put_vertex(&v[1], x0, y0 + g->rows, g->u0, g->v1);
+          put_vertex(&v[2], x0 + g->width, y0 + g->rows, g->u1, g->v1);
+          put_vertex(&v[3], x0 + g->width, y0, g->u1, g->v0);
+          batch->quadCount++;
+        }
+      x26_6 += glyphPos[i].x_advance;
+      y26_6 += glyphPos[i].y_advance;
+    }
+  return x26_6 / 64.0f;
+}
@@ -0,0 +1,75 @@
+/*
+ * Batched text drawing on top of a glyph atlas.
+ *
+ * Shaped runs are turned into one quad per glyph in a single interleaved
+ * vertex buffer (x, y, u, v). All queued quads are drawn with one
+ * glDrawElements call, so a whole screen of labels normally costs one
+ * texture bind and one draw. A flush happens earlier only when the
+ * atlas page changes, when the buffer is full, or before a glyph has to
+ * be uploaded (uploading may empty a page that queued quads sample).
+ *
+ * The vertex buffer is orphaned with glBufferData(NULL) before every
+ * upload, so the driver never stalls on a draw still reading it.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef TEXT_BATCH_H
+#define TEXT_BATCH_H
+
+#include <hb.h>
+
+#include "glyph_atlas.h"
+
+/* quads per draw call; 4 vertices each, indexed with 16-bit indices */
+#define TEXT_BATCH_MAX_QUADS 16384
+
+typedef struct text_vertex
+{
+  float x;
+  float y;
+  float u;
+  float v;
+} text_vertex;
+
+typedef struct text_batch
+{
+  text_vertex* vertices;
+  int quadCount;
+  /* atlas page sampled by the queued quads */
+  int page;
+
+  GLuint vertexBuffer;
+  GLuint indexBuffer;
+  GLint positionVar;
+  GLint uvVar;
+
+  unsigned long drawCalls;
+  unsigned long quads;
+} text_batch;
+
+/*
+ * positionVar and uvVar are the vec2 attributes of the shader program
+ * used for drawing. Positions are in pixels, with y growing downwards.
+ * Needs a current GL context.
+ */
+text_batch* text_batch_new(GLint positionVar, GLint uvVar);
+void text_batch_free(text_batch* batch);
+
+/*
+ * Queue the glyphs of a shaped buffer, with the pen starting at (x, y)
+ * on the baseline. face must be the font the buffer was shaped with, at
+ * the same size. Positions are rounded to whole pixels so glyph texels
+ * map 1:1 onto the screen. Returns the advance of the run in pixels.
+ */
+float text_batch_add_run(text_batch* batch, glyph_atlas* atlas, FT_Face face,
+                         hb_buffer_t* buffer, float x, float y);
+
+/* draw and drop all queued quads */
+void text_batch_flush(text_batch* batch, glyph_atlas* atlas);
+
+#endif
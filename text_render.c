@@ -0,0 +1,556 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "text_render.h"
+
+/* ints per glyph in the layout_run() result */
+#define LAYOUT_STRIDE 5
+
+/*
+ * Shape text through the shape cache, a word at a time if the cache
+ * says so. The entry stays valid until the next shaping call on the
+ * cache.
+ */
+static const shape_cache_entry* shape_text(hb_font_t* font, hb_buffer_t* buffer,
+                                           shape_cache* shapes,
+                                           const char* text, int textLen, int verbose)
+{
+  unsigned long misses = shapes->misses;
+  const shape_cache_entry* run;
+  int i;
+
+  if (shapes->splitWords)
+    run = shape_cache_shape_words(shapes, font, buffer, text, textLen, NULL, 0);
+  else
+    run = shape_cache_shape(shapes, font, buffer, text, textLen, NULL, NULL, 0);
+  if (run == NULL)
+    {
+      return NULL;
+    }
+  if (shapes->stats != NULL)
+    shapes->stats->glyphs += run->count;
+  
+  /* print shaping result, glyph by glyph only when asked for */
+  if (verbose)
+    {
+      fprintf(stderr, "%u glyphs, %lu runs shaped.\n", run->count, shapes->misses - misses);
+      for(i = 0; i < run->count && verbose > 1; i++)
+        {
+          fprintf(stderr, "Codepoint: %u\n", run->glyphs[i].glyphIndex);
+          fprintf(stderr, "Cluster: %u\n", run->glyphs[i].cluster);
+          fprintf(stderr, "X advance: %d\n", run->glyphs[i].xAdvance);
+          fprintf(stderr, "Y advance: %d\n", run->glyphs[i].yAdvance);
+          fprintf(stderr, "X offset: %d\n", run->glyphs[i].xOffset);
+          fprintf(stderr, "Y offset: %d\n\n", run->glyphs[i].yOffset);
+        }
+    }
+  return run;
+}
+
+/*
+ * Layout pass
+ * Pen positions are computed once and the ink box of every glyph is
+ * taken from the glyph cache, or from the outline control box when the
+ * glyph has not been rendered yet. The canvas is the union of these
+ * boxes, so nothing is clipped and no empty rows are allocated.
+ * Positions are in pixels, y grows downwards, the baseline is y = 0.
+ *
+ * Glyph i comes from runs[glyphRuns[i]], or from runs[0] when glyphRuns
+ * is NULL.
+ *
+ * Returns a new array of LAYOUT_STRIDE ints per glyph (pen x, pen y,
+ * phase, then the first and one past the last row of its ink, equal for
+ * blank glyphs), or NULL when out of memory.
+ */
+static int* layout_run(const text_run* runs, const int* glyphRuns,
+                       const shaped_glyph* glyphs, unsigned int count, int verbose,
+                       int* outMinX, int* outMinY, int* outW, int* outH)
+{
+  int mono = runs[0].cache->mono;
+  int* penPos = malloc(sizeof(int) * LAYOUT_STRIDE * (count > 0 ? count : 1));
+  int minX = INT_MAX, minY = INT_MAX, maxX = INT_MIN, maxY = INT_MIN;
+  int x26_6 = 0;
+  int y26_6 = 0;
+  int i;
+
+  if (penPos == NULL)
+    {
+      return NULL;
+    }
+  for(i = 0; i < count; i++)
+    {
+      const text_run* r = glyphRuns != NULL ? &runs[glyphRuns[i]] : runs;
+      int penX, penY, phase, yPhase;
+      int left, top, gw, gh;
+      /*
+       * The fractional part of the horizontal pen position selects a
+       * pre-shifted bitmap; vertical positions are rounded. Mono glyphs
+       * have no phases, so they are rounded both ways.
+       */
+      glyph_cache_split_position(x26_6 + glyphs[i].xOffset + (mono ? 32 : 0),
+                                 &penX, &phase);
+      glyph_cache_split_position(y26_6 + glyphs[i].yOffset + 32, &penY, &yPhase);
+      penY = -penY;
+      if (mono)
+        phase = 0;
+      penPos[i * LAYOUT_STRIDE] = penX;
+      penPos[i * LAYOUT_STRIDE + 1] = penY;
+      penPos[i * LAYOUT_STRIDE + 2] = phase;
+      penPos[i * LAYOUT_STRIDE + 3] = penY;
+      penPos[i * LAYOUT_STRIDE + 4] = penY;
+      x26_6 += glyphs[i].xAdvance;
+      y26_6 += glyphs[i].yAdvance;
+
+      if (glyph_cache_get_box(r->cache, r->ftFace, glyphs[i].glyphIndex, phase,
+                              &left, &top, &gw, &gh) != 0 || gw <= 0 || gh <= 0)
+        {
+          continue;
+        }
+      penPos[i * LAYOUT_STRIDE + 3] = penY - top;
+      penPos[i * LAYOUT_STRIDE + 4] = penY - top + gh;
+      if (penX + left < minX)
+        minX = penX + left;
+      if (penY - top < minY)
+        minY = penY - top;
+      if (penX + left + gw > maxX)
+        maxX = penX + left + gw;
+      if (penY - top + gh > maxY)
+        maxY = penY - top + gh;
+    }
+
+  if (maxX <= minX || maxY <= minY)
+    {
+      /* no ink (empty text or blanks); libpng refuses zero sized images */
+      *outMinX = *outMinY = 0;
+      *outW = *outH = 1;
+    }
+  else
+    {
+      *outMinX = minX;
+      *outMinY = minY;
+      *outW = maxX - minX;
+      *outH = maxY - minY;
+    }
+  if (verbose)
+    {
+      fprintf(stderr, "Ink box: %d, %d, %d x %d\n", *outMinX, *outMinY, *outW, *outH);
+    }
+  return penPos;
+}
+
+int measure_text(hb_font_t* font, FT_Face ftFace,
+                 hb_buffer_t* buffer, shape_cache* shapes, glyph_cache* cache,
+                 const char* text, int textLen, int* outW, int* outH)
+{
+  text_run single = {font, ftFace, shapes, cache, 0, textLen};
+  const shape_cache_entry* run;
+  int minX, minY;
+  int* penPos;
+
+  run = shape_text(font, buffer, shapes, text, textLen, 0);
+  if (run == NULL)
+    {
+      return -1;
+    }
+  penPos = layout_run(&single, NULL, run->glyphs, run->count, 0, &minX, &minY, outW, outH);
+  if (penPos == NULL)
+    {
+      return -1;
+    }
+  free(penPos);
+  return 0;
+}
+
+/*
+ * Lay out and composite shaped glyphs into a new coverage image; see
+ * layout_run() for runs and glyphRuns.
+ */
+static unsigned char* composite_glyphs(const text_run* runs, const int* glyphRuns,
+                                       const shaped_glyph* glyphs, unsigned int count,
+                                       composite_mode mode, int verbose, int* outW, int* outH)
+{
+  composite_row_func rowFunc = composite_get_row_func(mode);
+  int minX, minY, w, h;
+  int i;
+
+  int* penPos = layout_run(runs, glyphRuns, glyphs, count, verbose, &minX, &minY, &w, &h);
+  if (penPos == NULL)
+    {
+      return NULL;
+    }
+  if (verbose)
+    {
+      fprintf(stderr, "Compositing kernel: %s\n", composite_kernel_name());
+    }
+
+  /* Rendering */
+  unsigned char* imgData = calloc(1, (size_t)w * h);
+  if (imgData == NULL)
+    {
+      free(penPos);
+      return NULL;
+    }
+  for(i = 0; i < count; i++)
+    {
+      const text_run* r = glyphRuns != NULL ? &runs[glyphRuns[i]] : runs;
+      /* glyphs repeat a lot in a string, so bitmaps come from the cache */
+      const glyph_cache_entry* g = glyph_cache_get(r->cache, r->ftFace, glyphs[i].glyphIndex,
+                                                   penPos[i * LAYOUT_STRIDE + 2]);
+      if (g == NULL)
+        {
+          continue;
+        }
+      composite_glyph(imgData, w, h, g->buffer, g->width, g->rows,
+                      penPos[i * LAYOUT_STRIDE] + g->left - minX,
+                      penPos[i * LAYOUT_STRIDE + 1] - g->top - minY, rowFunc);
+    }
+  free(penPos);
+  *outW = w;
+  *outH = h;
+  return imgData;
+}
+
+unsigned char* render_text(hb_font_t* font, FT_Face ftFace,
+                           hb_buffer_t* buffer, shape_cache* shapes, glyph_cache* cache,
+                           const char* text, int textLen, composite_mode mode,
+                           int verbose, int* outW, int* outH)
+{
+  text_run single = {font, ftFace, shapes, cache, 0, textLen};
+  const shape_cache_entry* run;
+
+  run = shape_text(font, buffer, shapes, text, textLen, verbose);
+  if (run == NULL)
+    {
+      return NULL;
+    }
+  return composite_glyphs(&single, NULL, run->glyphs, run->count, mode, verbose, outW, outH);
+}
+
+unsigned char* render_text_runs(hb_buffer_t* buffer, const text_run* runs, int runCount,
+                                const char* text, composite_mode mode,
+                                int verbose, int* outW, int* outH)
+{
+  shaped_glyph* glyphs = NULL;
+  int* glyphRuns = NULL;
+  unsigned int count = 0, cap = 0;
+  unsigned char* img = NULL;
+  int failed = 0;
+  int i;
+
+  /*
+   * Every run is shaped on its own. The glyphs are joined in text order,
+   * like the pieces of shape_cache_shape_words(), with clusters made
+   * relative to the whole text.
+   */
+  for(i = 0; i < runCount && !failed; i++)
+    {
+      const shape_cache_entry* run = shape_text(runs[i].font, buffer, runs[i].shapes,
+                                                text + runs[i].start, runs[i].len, verbose);
+      unsigned int j;
+
+      if (run == NULL)
+        {
+          failed = 1;
+          break;
+        }
+      if (count + run->count > cap)
+        {
+          unsigned int newCap = (count + run->count) * 2;
+          shaped_glyph* newGlyphs = realloc(glyphs, sizeof(shaped_glyph) * newCap);
+          int* newRuns = newGlyphs != NULL ? realloc(glyphRuns, sizeof(int) * newCap) : NULL;
+          if (newGlyphs != NULL)
+            glyphs = newGlyphs;
+          if (newRuns == NULL)
+            {
+              failed = 1;
+              break;
+            }
+          glyphRuns = newRuns;
+          cap = newCap;
+        }
+      for(j = 0; j < run->count; j++, count++)
+        {
+          glyphs[count] = run->glyphs[j];
+          glyphs[count].cluster += runs[i].start;
+          glyphRuns[count] = i;
+        }
+    }
+
+  if (!failed && runCount > 0)
+    img = composite_glyphs(runs, glyphRuns, glyphs, count, mode, verbose, outW, outH);
+  free(glyphRuns);
+  free(glyphs);
+  return img;
+}
+
+/* a glyph with ink, by its rows in the image, for strip rendering */
+typedef struct strip_glyph
+{
+  int top;
+  int bottom;
+  int index;
+} strip_glyph;
+
+static int compare_strip_top(const void* a, const void* b)
+{
+  const strip_glyph* x = a;
+  const strip_glyph* y = b;
+  if (x->top != y->top)
+    return x->top < y->top ? -1 : 1;
+  return x->index - y->index;
+}
+
+static int compare_strip_index(const void* a, const void* b)
+{
+  return ((const strip_glyph*)a)->index - ((const strip_glyph*)b)->index;
+}
+
+int render_text_strips(hb_font_t* font, FT_Face ftFace,
+                       hb_buffer_t* buffer, shape_cache* shapes, glyph_cache* cache,
+                       const char* text, int textLen, composite_mode mode,
+                       int verbose, int stripRows, const text_strip_sink* sink)
+{
+  composite_row_func rowFunc = composite_get_row_func(mode);
+  text_run single = {font, ftFace, shapes, cache, 0, textLen};
+  const shape_cache_entry* run;
+  strip_glyph* order;
+  strip_glyph* active;
+  unsigned char* strip;
+  int minX, minY, w, h;
+  int glyphCount = 0, activeCount = 0, next = 0;
+  int ret = 0;
+  int i, y;
+
+  run = shape_text(font, buffer, shapes, text, textLen, verbose);
+  if (run == NULL)
+    {
+      return -1;
+    }
+  int* penPos = layout_run(&single, NULL, run->glyphs, run->count, verbose,
+                           &minX, &minY, &w, &h);
+  if (penPos == NULL)
+    {
+      return -1;
+    }
+  if (stripRows <= 0 || stripRows > h)
+    stripRows = h;
+  if (verbose)
+    {
+      fprintf(stderr, "Compositing kernel: %s\n", composite_kernel_name());
+      fprintf(stderr, "Strips of %d rows.\n", stripRows);
+    }
+
+  order = malloc(sizeof(strip_glyph) * (run->count > 0 ? run->count : 1));
+  active = malloc(sizeof(strip_glyph) * (run->count > 0 ? run->count : 1));
+  strip = malloc((size_t)w * stripRows);
+  if (order == NULL || active == NULL || strip == NULL)
+    {
+      free(strip);
+      free(active);
+      free(order);
+      free(penPos);
+      return -1;
+    }
+  for(i = 0; i < run->count; i++)
+    {
+      if (penPos[i * LAYOUT_STRIDE + 4] > penPos[i * LAYOUT_STRIDE + 3])
+        {
+          order[glyphCount].top = penPos[i * LAYOUT_STRIDE + 3] - minY;
+          order[glyphCount].bottom = penPos[i * LAYOUT_STRIDE + 4] - minY;
+          order[glyphCount].index = i;
+          glyphCount++;
+        }
+    }
+  qsort(order, glyphCount, sizeof(strip_glyph), compare_strip_top);
+
+  if (sink->begin(sink->user, w, h) != 0)
+    {
+      ret = -1;
+    }
+  for(y = 0; y < h && ret == 0; y += stripRows)
+    {
+      int rows = h - y < stripRows ? h - y : stripRows;
+      int added = 0;
+      int j, k;
+
+      /* drop glyphs ending above this strip, pick up those starting in it */
+      for(j = 0, k = 0; j < activeCount; j++)
+        {
+          if (active[j].bottom > y)
+            active[k++] = active[j];
+        }
+      activeCount = k;
+      while(next < glyphCount && order[next].top < y + rows)
+        {
+          active[activeCount++] = order[next++];
+          added = 1;
+        }
+      /* blend in text order, so the bytes match render_text() */
+      if (added)
+        qsort(active, activeCount, sizeof(strip_glyph), compare_strip_index);
+
+      memset(strip, 0, (size_t)w * rows);
+      for(j = 0; j < activeCount; j++)
+        {
+          int* pos = &penPos[active[j].index * LAYOUT_STRIDE];
+          const glyph_cache_entry* g = glyph_cache_get(cache, ftFace,
+                                                       run->glyphs[active[j].index].glyphIndex,
+                                                       pos[2]);
+          if (g == NULL)
+            {
+              continue;
+            }
+          composite_glyph(strip, w, rows, g->buffer, g->width, g->rows,
+                          pos[0] + g->left - minX, pos[1] - g->top - minY - y, rowFunc);
+        }
+      ret = sink->strip(sink->user, strip, y, rows) != 0 ? -1 : 0;
+    }
+
+  free(strip);
+  free(active);
+  free(order);
+  free(penPos);
+  return ret;
+}
+
+unsigned char* render_text_mono(hb_font_t* font, FT_Face ftFace,
+                                hb_buffer_t* buffer, shape_cache* shapes, glyph_cache* cache,
+                                const char* text, int textLen,
+                                int verbose, int* outW, int* outH, int* outStride)
+{
+  text_run single = {font, ftFace, shapes, cache, 0, textLen};
+  const shape_cache_entry* run;
+  int minX, minY, w, h, stride;
+  int* penPos;
+  unsigned char* bits;
+  int i;
+
+  if (!cache->mono)
+    {
+      fprintf(stderr, "ERROR: render_text_mono needs a mono glyph cache\n");
+      return NULL;
+    }
+  run = shape_text(font, buffer, shapes, text, textLen, verbose);
+  if (run == NULL)
+    {
+      return NULL;
+    }
+  penPos = layout_run(&single, NULL, run->glyphs, run->count, verbose,
+                      &minX, &minY, &w, &h);
+  if (penPos == NULL)
+    {
+      return NULL;
+    }
+
+  stride = composite_mono_stride(w);
+  bits = calloc(1, (size_t)stride * h);
+  if (bits == NULL)
+    {
+      free(penPos);
+      return NULL;
+    }
+  for(i = 0; i < run->count; i++)
+    {
+      const glyph_cache_entry* g = glyph_cache_get(cache, ftFace, run->glyphs[i].glyphIndex, 0);
+      if (g == NULL || g->buffer == NULL)
+        {
+          continue;
+        }
+      composite_glyph_mono(bits, stride, w, h, g->buffer, g->pitch, g->width, g->rows,
+                           penPos[i * LAYOUT_STRIDE] + g->left - minX,
+                           penPos[i * LAYOUT_STRIDE + 1] - g->top - minY);
+    }
+  free(penPos);
+  *outW = w;
+  *outH = h;
+  *outStride = stride;
+  return bits;
+}
+
+unsigned char* render_char(FT_Face face, glyph_cache* cache, unsigned int utf32,
+                           int* outW, int* outH)
+{
+  unsigned int glyphIndex;
+  const glyph_cache_entry* g;
+  unsigned char* imgData;
+  int w, h;
+
+  glyphIndex = FT_Get_Char_Index(face, utf32);
+  if (glyphIndex == 0)
+    {
+      return NULL;
+    }
+  g = glyph_cache_get(cache, face, glyphIndex, 0);
+  if (g == NULL)
+    {
+      return NULL;
+    }
+  /* blank glyphs such as space still produce a 1x1 image */
+  w = g->width > 0 ? g->width : 1;
+  h = g->rows > 0 ? g->rows : 1;
+  imgData = calloc(1, (size_t)w * h);
+  if (imgData == NULL)
+    {
+      return NULL;
+    }
+  if (g->buffer != NULL)
+    {
+      memcpy(imgData, g->buffer, (size_t)g->width * g->rows);
+    }
+  *outW = w;
+  *outH = h;
+  return imgData;
+}
+
+/*
+ * UTF-8 rule: see http://zh.wikipedia.org/wiki/UTF-8
+ */
+unsigned int first_utf8_char(const char* str, int len)
+{
+  const unsigned char* s = (const unsigned char*)str;
+  unsigned int c;
+  int codeLength;
+  int i;
+
+  if (len <= 0)
+    return 0;
+  if ((s[0] & 0x80) == 0)
+    return s[0];
+  else if ((s[0] & 0xe0) == 0xc0)
+    {
+      codeLength = 2;
+      c = s[0] & 0x1f;
+    }
+  else if ((s[0] & 0xf0) == 0xe0)
+    {
+      codeLength = 3;
+      c = s[0] & 0x0f;
+    }
+  else if ((s[0] & 0xf8) == 0xf0)
+    {
+      codeLength = 4;
+      c = s[0] & 0x07;
+    }
+  else
+    return 0;
+
+  if (len < codeLength)
+    return 0;
+  for(i = 1; i < codeLength; i++)
+    {
+      if ((s[i] & 0xc0) != 0x80)
+        return 0;
+      c = (c << 6) | (s[i] & 0x3f);
+    }
+  return c;
+}
@@ -0,0 +1,124 @@
+/*
+ * Shaping and compositing of text into 8-bit coverage images, or 1-bit
+ * images for mono glyph caches.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef TEXT_RENDER_H
+#define TEXT_RENDER_H
+
+#include <hb.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "glyph_cache.h"
+#include "shape_cache.h"
+#include "composite.h"
+
+/* a piece of text shaped and rasterized with one font, for render_text_runs() */
+typedef struct text_run
+{
+  hb_font_t* font;
+  FT_Face ftFace; /* same font as font, at the same size */
+  shape_cache* shapes;
+  glyph_cache* cache;
+  int start;      /* byte offset into the text */
+  int len;
+} text_run;
+
+/*
+ * Size of the image render_text() (or render_text_mono()) would return
+ * for the same arguments, without compositing anything. Returns -1 when
+ * out of memory.
+ */
+int measure_text(hb_font_t* font, FT_Face ftFace,
+                 hb_buffer_t* buffer, shape_cache* shapes, glyph_cache* cache,
+                 const char* text, int textLen, int* outW, int* outH);
+
+/*
+ * Shape a UTF-8 string and render it into a newly allocated coverage
+ * image (one byte per pixel, w bytes per row). Shaping goes through
+ * shapes; buffer is only used when the run is not cached, and is cleared
+ * before use, so it can be reused between calls. ftFace rasterizes the
+ * glyphs; it must be the same font as font, at the same size. mode
+ * selects how overlapping glyphs combine. The image is cropped to the
+ * ink box of the shaped run. cache must not be a mono cache. verbose
+ * prints a summary of shaping and layout on stderr, plus every shaped
+ * glyph when greater than 1. Returns NULL on allocation failure; free
+ * the result with free().
+ */
+unsigned char* render_text(hb_font_t* font, FT_Face ftFace,
+                           hb_buffer_t* buffer, shape_cache* shapes, glyph_cache* cache,
+                           const char* text, int textLen, composite_mode mode,
+                           int verbose, int* outW, int* outH);
+
+/*
+ * Like render_text(), but every run of the text is shaped and rasterized
+ * with its own font, e.g. fallback fonts for characters the main font
+ * lacks. The runs must cover the text in order; their glyphs are placed
+ * one after the other in that order, so a right-to-left run stays
+ * right-to-left inside but runs are not reordered. All fonts should have
+ * the same size, and none of the glyph caches may be mono. Returns NULL
+ * on allocation failure.
+ */
+unsigned char* render_text_runs(hb_buffer_t* buffer, const text_run* runs, int runCount,
+                                const char* text, composite_mode mode,
+                                int verbose, int* outW, int* outH);
+
+/*
+ * Receiver of an image rendered a strip at a time. begin is called once
+ * with the image size, then strip for every strip, top to bottom, with
+ * n rows of w bytes starting at image row y. The rows are only valid
+ * during the call. A non-zero return stops rendering.
+ */
+typedef struct text_strip_sink
+{
+  int (*begin)(void* user, int w, int h);
+  int (*strip)(void* user, const unsigned char* rows, int y, int n);
+  void* user;
+} text_strip_sink;
+
+/*
+ * Like render_text(), but the image is composited stripRows rows at a
+ * time and handed to sink, so only one strip is ever allocated. Glyphs
+ * are sorted by their first row and only those overlapping a strip are
+ * blended into it. stripRows <= 0 means a single strip. The strips put
+ * together are the image render_text() returns. Returns -1 when out of
+ * memory or when sink fails.
+ */
+int render_text_strips(hb_font_t* font, FT_Face ftFace,
+                       hb_buffer_t* buffer, shape_cache* shapes, glyph_cache* cache,
+                       const char* text, int textLen, composite_mode mode,
+                       int verbose, int stripRows, const text_strip_sink* sink);
+
+/*
+ * Like render_text(), but for a mono glyph cache: the image is 1 bit per
+ * pixel, most significant bit first, 1 where there is ink, with rows
+ * *outStride bytes long (see composite_mono_stride()). Overlapping glyphs
+ * are ORed together.
+ */
+unsigned char* render_text_mono(hb_font_t* font, FT_Face ftFace,
+                                hb_buffer_t* buffer, shape_cache* shapes, glyph_cache* cache,
+                                const char* text, int textLen,
+                                int verbose, int* outW, int* outH, int* outStride);
+
+/*
+ * Render a single character, looked up through the face's charmap, into
+ * a coverage image just large enough for the glyph bitmap. Returns NULL
+ * when the character has no glyph in the face.
+ */
+unsigned char* render_char(FT_Face face, glyph_cache* cache, unsigned int utf32,
+                           int* outW, int* outH);
+
+/*
+ * Decode the first character of a UTF-8 string. Returns 0 on an empty
+ * or malformed string.
+ */
+unsigned int first_utf8_char(const char* str, int len);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#include <stdlib.h>
+
+#include "work_queue.h"
+
+work_queue* work_queue_new(int workerCount, int capacity)
+{
+  work_queue* queue;
+  int i;
+
+  queue = calloc(1, sizeof(work_queue));
+  if (queue == NULL)
+    return NULL;
+  queue->deques = calloc(workerCount, sizeof(work_deque));
+  if (queue->deques == NULL)
+    {
+      free(queue);
+      return NULL;
+    }
+  queue->workerCount = workerCount;
+  pthread_mutex_init(&queue->statLock, NULL);
+  for(i = 0; i < workerCount; i++)
+    {
+      work_deque* d = &queue->deques[i];
+      d->jobs = malloc(sizeof(int) * capacity);
+      d->capacity = capacity;
+      pthread_mutex_init(&d->lock, NULL);
+      if (d->jobs == NULL)
+        {
+          queue->workerCount = i + 1;
+          work_queue_free(queue);
+          return NULL;
+        }
+    }
+  return queue;
+}
+
+void work_queue_free(work_queue* queue)
+{
+  int i;
+
+  if (queue == NULL)
+    return;
+  for(i = 0; i < queue->workerCount; i++)
+    {
+      pthread_mutex_destroy(&queue->deques[i].lock);
+      free(queue->deques[i].jobs);
+    }
+  pthread_mutex_destroy(&queue->statLock);
+  free(queue->deques);
+  free(queue);
+}
+
+void work_queue_clear(work_queue* queue)
+{
+  int i;
+  for(i = 0; i < queue->workerCount; i++)
+    {
+      queue->deques[i].head = 0;
+      queue->deques[i].tail = 0;
+    }
+}
+
+int work_queue_push(work_queue* queue, int worker, int job)
+{
+  work_deque* d = &queue->deques[worker];
+  int ret = -1;
+
+  pthread_mutex_lock(&d->lock);
+  if (d->tail < d->capacity)
+    {
+      d->jobs[d->tail++] = job;
+      ret = 0;
+    }
+  pthread_mutex_unlock(&d->lock);
+  return ret;
+}
+
+int work_queue_pop(work_queue* queue, int worker, int* job)
+{
+  work_deque* d = &queue->deques[worker];
+  int i;
+
+  /* own deque, newest job first */
+  pthread_mutex_lock(&d->lock);
+  if (d->tail > d->head)
+    {
+      *job = d->jobs[--d->tail];
+      pthread_mutex_unlock(&d->lock);
+      return 0;
+    }
+  pthread_mutex_unlock(&d->lock);
+
+  /* steal the oldest job of another worker */
+  for(i = 1; i < queue->workerCount; i++)
+    {
+      work_deque* victim = &queue->deques[(worker + i) % queue->workerCount];
+      pthread_mutex_lock(&victim->lock);
+      if (victim->tail > victim->head)
+        {
+          *job = victim->jobs[victim->head++];
+          pthread_mutex_unlock(&victim->lock);
+          pthread_mutex_lock(&queue->statLock);
+          queue->steals++;
+          pthread_mutex_unlock(&queue->statLock);
+          return 0;
+        }
+      pthread_mutex_unlock(&victim->lock);
+    }
+  return -1;
+}
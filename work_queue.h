@@ -0,0 +1,55 @@
+/*
+ * Work-stealing job queue for a fixed set of worker threads.
+ *
+ * Every worker has its own deque of job ids. A worker takes jobs from the
+ * back of its own deque, and when that is empty it steals from the front
+ * of the other workers' deques. Each deque is protected by its own mutex,
+ * so workers only contend while stealing.
+ *
+ * Copyright (C) 2013  Inori Sakura <inorindesu@gmail.com>
+ *
+ * This work is free. You can redistribute it and/or modify it under the
+ * terms of the Do What The Fuck You Want To Public License, Version 2,
+ * as published by Sam Hocevar. See the COPYING file for more details.
+ */
+
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#include <pthread.h>
+
+typedef struct work_deque
+{
+  int* jobs;
+  int capacity;
+  int head; /* next job to steal */
+  int tail; /* one past the next job for the owner */
+  pthread_mutex_t lock;
+} work_deque;
+
+typedef struct work_queue
+{
+  work_deque* deques;
+  int workerCount;
+  /* jobs taken from another worker's deque, for diagnostics */
+  unsigned long steals;
+  pthread_mutex_t statLock;
+} work_queue;
+
+/* capacity is the largest number of jobs a single deque can hold */
+work_queue* work_queue_new(int workerCount, int capacity);
+void work_queue_free(work_queue* queue);
+
+/* Drop all queued jobs. Call only while no worker is using the queue. */
+void work_queue_clear(work_queue* queue);
+
+/* Append a job to a worker's deque. Returns -1 when the deque is full. */
+int work_queue_push(work_queue* queue, int worker, int job);
+
+/*
+ * Get the next job for a worker, stealing when its own deque is empty.
+ * Returns 0 and sets *job, or -1 when every deque is empty.
+ */
+int work_queue_pop(work_queue* queue, int worker, int* job);
+
+#endif